@@ -111,6 +111,7 @@ MODULE_DEVICE_TABLE (of, spif_driver_of_match);
 #define SPIF_TRANSFER        SPIF_OP_REQ(3)
 #define SPIF_GET_OUTP        SPIF_OP_REQ(4)
 #define SPIF_BUF_SIZE        SPIF_OP_REQ(5)
+#define SPIF_SET_SRC         SPIF_OP_REQ(6)
 
 // DMA controller registers
 #define SPIF_DMAC_CR         0   // input stream control
@@ -138,6 +139,7 @@ MODULE_DEVICE_TABLE (of, spif_driver_of_match);
 struct spif_pipe_data {
          unsigned long     pmem_pa;      // pipe memory address
          unsigned int      pmem_sz;      // pipe memory size
+         unsigned int      src_off;      // input transfer source offset
          dev_t             dev_num;      // character device number
   struct cdev              dev_cdev;     // pipe character device
          int               dev_open;     // device is open
@@ -209,6 +211,7 @@ static int spif_open (struct inode * ino, struct file * fp)
 
   // write spif buffer physical address to DMA controller
   iowrite32 ((uint) pipe->pmem_pa, (void *) &dma_regs[SPIF_DMAC_SA]);
+  pipe->src_off = 0;
 
   // configure the output DMA controller - if present
   if (pipe->dma_irq > 0) {
@@ -334,6 +337,11 @@ static long spif_ioctl (struct file * fp, unsigned int req , unsigned long arg)
     }
 
     // arg is transfer length in bytes
+    // transfer must not go past the end of the input buffer
+    if (arg > (pipe->pmem_sz - pipe->src_off)) {
+      return -EINVAL;
+    }
+
     // write length to DMA controller length register to trigger transfer
     iowrite32 ((uint) arg, (void *) &dma_regs[SPIF_DMAC_LEN]);
 
@@ -375,6 +383,27 @@ static long spif_ioctl (struct file * fp, unsigned int req , unsigned long arg)
 
     return 0;
 
+  case SPIF_SET_SRC:  // select input buffer offset of next transfer
+    dma_regs = (int *) pipe->dmar_va;
+
+    // source can only be changed when no transfer is in progress
+    //NOTE: the DMA controller *not* reported idle at init state!
+    if (!pipe->dma_init &&
+        !(ioread32 ((void *) &dma_regs[SPIF_DMAC_SR]) & SPIF_DMAC_IDLE)) {
+      return -EBUSY;
+    }
+
+    // arg is a word-aligned byte offset into the input buffer
+    if ((arg >= pipe->pmem_sz) || (arg & 0x3)) {
+      return -EINVAL;
+    }
+
+    // write new source physical address to DMA controller
+    iowrite32 ((uint) (pipe->pmem_pa + arg), (void *) &dma_regs[SPIF_DMAC_SA]);
+    pipe->src_off = (unsigned int) arg;
+
+    return 0;
+
   default:
 
     return -EINVAL;
@@ -678,15 +707,11 @@ static int spif_cdev_init (struct spif_pipe_data * pipe,
   )
 {
   int  rc;
-  char name[] = { 's', 'p', 'i', 'f', 'x', '\0' };
-
-  // create device name from device minor
-  //NOTE: replace 'x' with minor number
-  name[4] = MINOR (cdev_num) + '0';
 
-  // create device
+  // create device - named from device minor
   //NOTE: no need for further access to this device
-  if (device_create (spif_class, NULL, cdev_num, NULL, name) == NULL) {
+  if (device_create (spif_class, NULL, cdev_num, NULL,
+                     "spif%d", MINOR (cdev_num)) == NULL) {
     printk (KERN_WARNING "%s: cannot create device\n", SPIF_DRV_NAME);
     rc = -ENODEV;
     goto error0;
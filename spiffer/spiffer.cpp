@@ -21,9 +21,13 @@
 
 #include <errno.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
+#include <poll.h>
 #include <pthread.h>
 #include <string.h>
 
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 // spif support
@@ -32,58 +36,83 @@
 // spiffer constants and function prototypes
 # include "spiffer.h"
 
-// event camera support
-#ifdef CAER_SUPPORT
-#include "spiffer_caer_support.h"
-#endif
+// spiffer configuration
+#include "spiffer_config.h"
 
-// Prophesee camera support
-#ifdef META_SUPPORT
-#include "spiffer_meta_support.h"
-#endif
+// deadline-bounded batching
+#include "spiffer_batch.h"
+
+// event pre-filtering
+#include "spiffer_filter.h"
+
+// input rate limiting
+#include "spiffer_rate.h"
+
+// timestamp-paced replay
+#include "spiffer_pace.h"
+
+// time-ordered source merging
+#include "spiffer_merge.h"
+
+// thread placement and memory locking
+#include "spiffer_rt.h"
+
+// camera event processing
+#include "spiffer_camera.h"
+
+// software event routing
+#include "spiffer_route.h"
+
+// camera acquisition queues
+#include "spiffer_queue.h"
+
+// USB camera connection monitor
+#include "spiffer_udev.h"
+
+// recorded camera replay
+#include "spiffer_replay.h"
+
+// camera-side rate control
+#include "spiffer_sensor.h"
+
+// USB camera plugins
+#include "spiffer_plugin.h"
+
+// batched SpiNNaker output
+#include "spiffer_out.h"
 
 
 //global variables
 // signals
 bool             signal_usr1_taken;
+volatile sig_atomic_t signal_hup_pending;
 pthread_mutex_t  signal_mtx = PTHREAD_MUTEX_INITIALIZER;
 struct sigaction signal_term_cfg;
 struct sigaction signal_usr1_cfg;
-
-// threads
-pthread_t listener[SPIF_HW_PIPES_NUM];
-pthread_t out_listener[SPIF_HW_PIPES_NUM];
-pthread_t spinn_listener[SPIF_HW_PIPES_NUM];
+struct sigaction signal_usr2_cfg;
+struct sigaction signal_hup_cfg;
 
 // spif pipe data
 int pipe_num_in  = 0;
 int pipe_num_out = 0;
 
-int    pipe_fd[SPIF_HW_PIPES_NUM];
-uint * pipe_buf[SPIF_HW_PIPES_NUM];
-uint * pipe_out_buf[SPIF_HW_PIPES_NUM];
+// per-pipe context - one for every pipe found in spif
+pipe_ctx_t * pipe_ctx;
 
 // used to pass integers as (void *)
 int dev_to_ptr[SPIFFER_USB_DISCOVER_CNT + 1];
 
-// SpiNNaker listener
-int out_start[SPIF_HW_PIPES_NUM];
-
-// UDP listener
-//NOTE: also listen to UDP ports for output commands
-int udp_skt[SPIF_HW_PIPES_NUM];
-int out_udp_skt[SPIF_HW_PIPES_NUM];
-
-struct sockaddr_in client_addr[SPIF_HW_PIPES_NUM];
-socklen_t          client_addr_len[SPIF_HW_PIPES_NUM];
-
 // USB devices
 usb_devs_t      usb_devs;
 pthread_mutex_t usb_mtx = PTHREAD_MUTEX_INITIALIZER;
 
+// spiffer configuration
+extern spiffer_cfg_t cfg;
+
 // log file
 //TODO: maybe change to system/kernel log
-FILE * lf;
+const char * log_name = "/tmp/spiffer.log";
+FILE *       lf;
 
 
 //--------------------------------------------------------------------
@@ -97,65 +126,167 @@ void log_time (void) {
 //--------------------------------------------------------------------
 
 
+//--------------------------------------------------------------------
+// write input and output statistics to log file
+//--------------------------------------------------------------------
+void spiffer_report_stats (void) {
+  uint64_t rate_dropped = 0;
+
+  for (int pipe = 0; pipe < pipe_num_in; pipe++) {
+    log_time ();
+    fprintf (lf, "pipe%i UDP datagrams: %llu truncated: %llu incomplete events: %llu\n",
+             pipe,
+             (unsigned long long) pipe_ctx[pipe].udp_rx.dgrams,
+             (unsigned long long) pipe_ctx[pipe].udp_rx.trunc,
+             (unsigned long long) pipe_ctx[pipe].udp_rx.partial
+             );
+
+    spiffer_queue_report (pipe);
+    spiffer_replay_report (pipe);
+    spiffer_camera_report (pipe);
+    spiffer_merge_report (pipe);
+    spiffer_pace_report (pipe);
+    spiffer_route_report (pipe);
+    spiffer_filter_report (pipe);
+    rate_dropped += spiffer_rate_report (pipe);
+    spiffer_batch_report (pipe);
+  }
+
+  // spif input drop counter is shared by all pipes
+  if (pipe_num_in != 0) {
+    log_time ();
+    fprintf (lf, "input events dropped by spiffer rate limit: %llu by spif: %u\n",
+             (unsigned long long) rate_dropped,
+             (uint) spif_read_reg (0, SPIF_COUNT_IN_DROP)
+             );
+  }
+
+  for (int pipe = 0; pipe < pipe_num_out; pipe++) {
+    spiffer_out_report (pipe);
+  }
+
+  (void) fflush (lf);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// wait until spif finishes the current transfer on a pipe
+//
+// reports when waiting for too long
+//--------------------------------------------------------------------
+void spiffer_wait_idle (int pipe) {
+  int wc = 0;
+  while (spif_busy (pipe)) {
+    wc++;
+    if (wc < 0) {
+      log_time ();
+      fprintf (lf, "error: spif not responding\n");
+      (void) fflush (lf);
+      wc = 0;
+    }
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// get the address of an input buffer slot
+//--------------------------------------------------------------------
+uint * spiffer_in_slot (int pipe, int slot) {
+  return ((uint *) ((char *) pipe_ctx[pipe].buf + slot * pipe_ctx[pipe].in_slot_size));
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// transfer the contents of an input buffer slot to SpiNNaker
+//
+// waits for the previous transfer to finish before starting this one,
+// the remaining slots can be filled while the transfer is in progress
+//
+// with a single slot, waits for this transfer to finish as well - the
+// slot cannot be refilled while spif is still reading it
+//--------------------------------------------------------------------
+void spiffer_in_transfer (int pipe, int slot, int bytes) {
+  // wait until spif finishes the previous transfer,
+  spiffer_wait_idle (pipe);
+
+  // point spif to the slot - if using more than one,
+  if ((pipe_ctx[pipe].in_slot_num > 1) &&
+      (spif_set_source (pipe, slot * pipe_ctx[pipe].in_slot_size) != 0)) {
+    log_time ();
+    fprintf (lf, "error: pipe%i input slot %i not selected (%s) - ", pipe, slot, strerror (errno));
+
+    // fall back to a single slot - at the start of the buffer,
+    //NOTE: spif still points to the previous slot if this fails too
+    if (spif_set_source (pipe, 0) != 0) {
+      fprintf (lf, "events dropped\n");
+      (void) fflush (lf);
+      return;
+    }
+
+    fprintf (lf, "using a single slot\n");
+    (void) fflush (lf);
+
+    memmove (pipe_ctx[pipe].buf, spiffer_in_slot (pipe, slot), bytes);
+    pipe_ctx[pipe].in_slot_num = 1;
+  }
+
+  // trigger a transfer to SpiNNaker,
+  spif_transfer (pipe, bytes);
+
+  // and wait for it to finish - if the slot is reused straight away
+  if (pipe_ctx[pipe].in_slot_num == 1) {
+    spiffer_wait_idle (pipe);
+  }
+}
+//--------------------------------------------------------------------
+
+
 //--------------------------------------------------------------------
 // shutdown input listeners and USB devices
 //
-// needed when USB devices are connected or disconnected
+// needed when spiffer stops
 //--------------------------------------------------------------------
-void spiffer_input_shutdown (int discon_dev) {
-  int discon_pipe = (discon_dev != SPIFFER_USB_NO_DEVICE) ? usb_devs.params[discon_dev].pipe : SPIFFER_USB_NO_DEVICE;
+void spiffer_input_shutdown (void) {
+  pthread_t listeners[2 * SPIFFER_PIPES_MAX];
+  int       num = 0;
 
-  // shutdown input listeners,
-  for (int pipe = 0; pipe < pipe_num_in; pipe++) {
-    // cancel listener thread,
-    if (pipe == discon_pipe) {
-      switch (usb_devs.params[discon_dev].type) {
-#ifdef CAER_SUPPORT
-      case CAER:
-        (void) pthread_cancel (listener[pipe]);
+  // keep USB surveys from starting listeners,
+  pthread_mutex_lock (&usb_mtx);
+  usb_devs.stopping = true;
 
-        // and wait for it to exit.
-        pthread_join (listener[pipe], NULL);
+  // take over input listeners - including exited camera listeners,
+  //NOTE: pipes fed by the listener of another pipe have none
+  for (int pipe = 0; pipe < pipe_num_in; pipe++) {
+    if (pipe_ctx[pipe].listening) {
+      (void) pthread_cancel (pipe_ctx[pipe].listener);
+      listeners[num++] = pipe_ctx[pipe].listener;
+      pipe_ctx[pipe].listening = false;
+    }
 
-        break;
-#endif
-#ifdef META_SUPPORT
-      case META:
-        // if a Prophesee camera is disconnected it will exit the thread
-        break;
-#endif
-      default:
-        log_time ();
-        fprintf (lf, "warning: ignoring unsupported camera type\n");
-        break;
-      }
-    } else {
-      (void) pthread_cancel (listener[pipe]);
-      pthread_join (listener[pipe], NULL);
+    if (pipe_ctx[pipe].old_listening) {
+      listeners[num++] = pipe_ctx[pipe].old_listener;
+      pipe_ctx[pipe].old_listening = false;
     }
   }
+  pthread_mutex_unlock (&usb_mtx);
 
-  // shutdown USB devices,
-  for (int dv = 0; dv < usb_devs.cnt; dv++) {
-    if (dv != discon_dev) {
-      switch (usb_devs.params[dv].type) {
-#ifdef CAER_SUPPORT
-      case CAER:
-        spiffer_caer_shutdown_dev (dv);
-        break;
-#endif
-#ifdef META_SUPPORT
-      case META:
-        spiffer_meta_shutdown_dev (dv);
-        break;
-#endif
-      default:
-        log_time ();
-        fprintf (lf, "warning: ignoring unsupported camera type\n");
-        break;
-      }
+  // wait for them to finish,
+  //NOTE: a camera listener may need the lock to detach its camera
+  for (int i = 0; i < num; i++) {
+    pthread_join (listeners[i], NULL);
+  }
+
+  // and shutdown the USB devices left
+  pthread_mutex_lock (&usb_mtx);
+  for (int dv = 0; dv < SPIFFER_USB_DISCOVER_CNT; dv++) {
+    if (usb_devs.params[dv].present) {
+      usb_close_dev (dv);
     }
   }
+  pthread_mutex_unlock (&usb_mtx);
 
   (void) fflush (lf);
 }
@@ -167,26 +298,49 @@ void spiffer_input_shutdown (int discon_dev) {
 // caused by systemd request or error condition
 //--------------------------------------------------------------------
 void spiffer_stop (int ec) {
+  // stop monitoring USB camera connections,
+  spiffer_udev_stop ();
+
   // shutdown input listeners and USB devices,
-  spiffer_input_shutdown (SPIFFER_USB_NO_DEVICE);
+  spiffer_input_shutdown ();
 
   // close UDP ports,
   for (int pipe = 0; pipe < pipe_num_in; pipe++) {
-    close (udp_skt[pipe]);
+    close (pipe_ctx[pipe].udp_skt);
+    spiffer_merge_close (pipe);
+
+    free (pipe_ctx[pipe].udp_rx.msgs);
+    free (pipe_ctx[pipe].udp_rx.iovs);
+    free (pipe_ctx[pipe].udp_rx.ctrl);
+    free (pipe_ctx[pipe].udp_rx.buf);
   }
 
   // shutdown SpiNNaker and output listeners,
   for (int pipe = 0; pipe < pipe_num_out; pipe++) {
     // shutdown SpiNNaker listener,
-    (void) pthread_cancel (spinn_listener[pipe]);
-    pthread_join (spinn_listener[pipe], NULL);
+    if (pipe_ctx[pipe].spinn_listening) {
+      (void) pthread_cancel (pipe_ctx[pipe].spinn_listener);
+      pthread_join (pipe_ctx[pipe].spinn_listener, NULL);
+      pipe_ctx[pipe].spinn_listening = false;
+    }
 
     // shutdown output UDP listener,
-    (void) pthread_cancel (out_listener[pipe]);
-    pthread_join (out_listener[pipe], NULL);
+    if (pipe_ctx[pipe].out_listening) {
+      (void) pthread_cancel (pipe_ctx[pipe].out_listener);
+      pthread_join (pipe_ctx[pipe].out_listener, NULL);
+      pipe_ctx[pipe].out_listening = false;
+    }
 
     // and close UDP port
-    close (out_udp_skt[pipe]);
+    close (pipe_ctx[pipe].out_udp_skt);
+  }
+
+  // report final statistics,
+  spiffer_report_stats ();
+
+  // save what camera processing learnt,
+  for (int pipe = 0; pipe < pipe_num_in; pipe++) {
+    spiffer_camera_save (pipe);
   }
 
   // close all spif pipes,
@@ -221,8 +375,8 @@ void spiffer_stop (int ec) {
 int spiNNaker_init (void) {
   // start SpiNNaker listeners
   for (int pipe = 0; pipe < pipe_num_out; pipe++) {
-    (void) pthread_create (&spinn_listener[pipe], NULL,
-                           spiNNaker_listener, (void *) &dev_to_ptr[pipe]);
+    pipe_ctx[pipe].spinn_listening = (spiffer_rt_create (&pipe_ctx[pipe].spinn_listener,
+                                        spiNNaker_listener, (void *) &dev_to_ptr[pipe], "SpiNNaker listener") == 0);
   }
 
   return (SPIFFER_OK);
@@ -245,15 +399,21 @@ void * spiNNaker_listener (void * data) {
   sigfillset (&set);
   sigprocmask (SIG_BLOCK, &set, NULL);
 
+  // pin thread and set its priority - if configured
+  spiffer_rt_thread (RT_SPINN, pipe, "spinn");
+
   // announce that output has started
   log_time ();
   fprintf (lf, "listening SpiNNaker -> outpipe%i (UDP %i client)\n",
            pipe, SPIFFER_UDP_PORT_BASE - (pipe + 1));
   (void) fflush (lf);
 
-  uint * sb = pipe_out_buf[pipe];
+  uint * sb = pipe_ctx[pipe].out_buf;
   size_t ss = SPIFFER_BATCH_SIZE * sizeof (uint);
-  int    us = out_udp_skt[pipe];
+
+  // frames may be held and sent together - if configured
+  spiffer_out_start (pipe);
+  pthread_cleanup_push (spiffer_out_stop, data);
 
   // get event batches from SpiNNaker
   while (1) {
@@ -267,12 +427,10 @@ void * spiNNaker_listener (void * data) {
     }
 
     // send data to output client - if active
-    if (out_start[pipe] != 0) {
-      sendto (us, sb, rcv_bytes, 0,
-              (struct sockaddr *) &client_addr[pipe],
-              client_addr_len[pipe]);
-    }
+    spiffer_out_put (pipe, sb, rcv_bytes);
   }
+
+  pthread_cleanup_pop (0);
 }
 //--------------------------------------------------------------------
 
@@ -290,68 +448,45 @@ int udp_init (void) {
   for (int pipe = 0; pipe < pipe_num_in; pipe++) {
     int eth_port = SPIFFER_UDP_PORT_BASE + pipe;
 
-    // create UDP socket,
-    int skt = socket (AF_INET, SOCK_DGRAM, 0);
+    // create and bind UDP socket,
+    int skt = udp_bind (eth_port);
     if (skt == SPIFFER_ERROR) {
-      log_time ();
-      fprintf (lf, "error: failed to create socket for UDP port %i\n", eth_port);
       return (SPIFFER_ERROR);
     }
 
-    // configure server,
-    struct sockaddr_in srv_addr;
-    srv_addr.sin_family      = AF_INET;
-    srv_addr.sin_port        = htons (eth_port);
-    srv_addr.sin_addr.s_addr = INADDR_ANY;
-    bzero (&(srv_addr.sin_zero), 8);
-
-    // bind socket,
-    if (bind (skt, (struct sockaddr *) &srv_addr, sizeof (struct sockaddr)) == SPIFFER_ERROR) {
+    // set up batched reception,
+    if (udp_rx_init (&pipe_ctx[pipe].udp_rx, pipe, skt) == SPIFFER_ERROR) {
       close (skt);
       log_time ();
-      fprintf (lf, "error: failed to bind socket for UDP port %i\n", eth_port);
+      fprintf (lf, "error: failed to set up reception for UDP port %i\n", eth_port);
       return (SPIFFER_ERROR);
     }
 
-    //  and map socket to pipe
-    udp_skt[pipe] = skt;
+    //  map socket to pipe,
+    pipe_ctx[pipe].udp_skt = skt;
+
+    // and set up additional sources merged into the pipe - if any
+    spiffer_merge_init (pipe);
   }
 
   // set up output command UDP servers
   for (int pipe = 0; pipe < pipe_num_out; pipe++) {
     int eth_port = SPIFFER_UDP_PORT_BASE - (pipe + 1);
 
-    // create UDP socket,
-    int skt = socket (AF_INET, SOCK_DGRAM, 0);
+    // create and bind UDP socket,
+    int skt = udp_bind (eth_port);
     if (skt == SPIFFER_ERROR) {
-      log_time ();
-      fprintf (lf, "error: failed to create socket for UDP port %i\n", eth_port);
-      return (SPIFFER_ERROR);
-    }
-
-    // configure server,
-    struct sockaddr_in srv_addr;
-    srv_addr.sin_family      = AF_INET;
-    srv_addr.sin_port        = htons (eth_port);
-    srv_addr.sin_addr.s_addr = INADDR_ANY;
-    bzero (&(srv_addr.sin_zero), 8);
-
-    // bind socket,
-    if (bind (skt, (struct sockaddr *) &srv_addr, sizeof (struct sockaddr)) == SPIFFER_ERROR) {
-      close (skt);
-      log_time ();
-      fprintf (lf, "error: failed to bind socket for UDP port %i\n", eth_port);
       return (SPIFFER_ERROR);
     }
 
     //  and map socket to pipe
-    out_udp_skt[pipe] = skt;
+    pipe_ctx[pipe].out_udp_skt = skt;
   }
 
   // start output command UDP listeners
   for (int pipe = 0; pipe < pipe_num_out; pipe++) {
-    (void) pthread_create (&out_listener[pipe], NULL,
-                           out_udp_listener, (void *) &dev_to_ptr[pipe]);
+    pipe_ctx[pipe].out_listening = (spiffer_rt_create (&pipe_ctx[pipe].out_listener,
+                                      out_udp_listener, (void *) &dev_to_ptr[pipe], "output command listener") == 0);
   }
 
   return (SPIFFER_OK);
@@ -359,11 +494,189 @@ int udp_init (void) {
 //--------------------------------------------------------------------
 
 
+//--------------------------------------------------------------------
+// create a UDP socket and bind it to a local port
+//
+// returns the socket or SPIFFER_ERROR if problems found
+//--------------------------------------------------------------------
+int udp_bind (int eth_port) {
+  // create UDP socket,
+  int skt = socket (AF_INET, SOCK_DGRAM, 0);
+  if (skt == SPIFFER_ERROR) {
+    log_time ();
+    fprintf (lf, "error: failed to create socket for UDP port %i\n", eth_port);
+    return (SPIFFER_ERROR);
+  }
+
+  // configure server,
+  struct sockaddr_in srv_addr;
+  srv_addr.sin_family      = AF_INET;
+  srv_addr.sin_port        = htons (eth_port);
+  srv_addr.sin_addr.s_addr = INADDR_ANY;
+  bzero (&(srv_addr.sin_zero), 8);
+
+  // and bind socket
+  if (bind (skt, (struct sockaddr *) &srv_addr, sizeof (struct sockaddr)) == SPIFFER_ERROR) {
+    close (skt);
+    log_time ();
+    fprintf (lf, "error: failed to bind socket for UDP port %i\n", eth_port);
+    return (SPIFFER_ERROR);
+  }
+
+  return (skt);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// set up batched reception on an input UDP socket
+// enable UDP GRO if available and allocate recvmmsg structures
+//
+// returns SPIFFER_ERROR if problems found
+//--------------------------------------------------------------------
+int udp_rx_init (udp_rx_t * rx, int pipe, int skt) {
+  // let the kernel coalesce datagrams - if supported,
+  //NOTE: coalesced datagrams can be as large as SPIFFER_UDP_GRO_SIZE
+  rx->gro = false;
+#ifdef UDP_GRO
+  int on = 1;
+  if (SPIFFER_UDP_USE_GRO &&
+      (setsockopt (skt, IPPROTO_UDP, UDP_GRO, &on, sizeof (on)) == 0)) {
+    rx->gro = true;
+  }
+#endif
+
+  // datagrams can be as large as the pipe buffer - or a jumbo frame,
+  rx->size = cfg.pipe[pipe].udp_dgram_size;
+  if (rx->size == 0) {
+    rx->size = spif_get_buffer_size (pipe);
+    if (rx->size < SPIFFER_UDP_JUMBO_SIZE) {
+      rx->size = SPIFFER_UDP_JUMBO_SIZE;
+    }
+  }
+
+  if (rx->gro && (rx->size < SPIFFER_UDP_GRO_SIZE)) {
+    rx->size = SPIFFER_UDP_GRO_SIZE;
+  }
+
+  // split the staging area into datagram-sized receive buffers,
+  rx->num = SPIFFER_UDP_RX_SIZE / rx->size;
+  if (rx->num > SPIFFER_UDP_MMSG_MAX) {
+    rx->num = SPIFFER_UDP_MMSG_MAX;
+  } else if (rx->num < 1) {
+    rx->num = 1;
+  }
+
+  rx->buf  = (char *) malloc (rx->num * rx->size);
+  rx->ctrl = (char *) calloc (rx->num, SPIFFER_UDP_CTRL_SIZE);
+  rx->iovs = (struct iovec *) calloc (rx->num, sizeof (struct iovec));
+  rx->msgs = (struct mmsghdr *) calloc (rx->num, sizeof (struct mmsghdr));
+  if ((rx->buf == NULL) || (rx->ctrl == NULL) || (rx->iovs == NULL) || (rx->msgs == NULL)) {
+    return (SPIFFER_ERROR);
+  }
+
+  // and point every message to its own receive buffer
+  for (int i = 0; i < rx->num; i++) {
+    rx->iovs[i].iov_base = rx->buf + i * rx->size;
+    rx->iovs[i].iov_len  = rx->size;
+    rx->msgs[i].msg_hdr.msg_iov    = &rx->iovs[i];
+    rx->msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  rx->dgrams  = 0;
+  rx->trunc   = 0;
+  rx->partial = 0;
+
+  return (SPIFFER_OK);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// receive all queued datagrams on an input UDP socket
+// blocks only until the first one arrives
+//
+// returns the number of datagrams received
+//--------------------------------------------------------------------
+int udp_rx_recv (udp_rx_t * rx, int skt) {
+  // restore ancillary data buffers - updated on every reception,
+  for (int m = 0; m < rx->num; m++) {
+    rx->msgs[m].msg_hdr.msg_control    = rx->ctrl + m * SPIFFER_UDP_CTRL_SIZE;
+    rx->msgs[m].msg_hdr.msg_controllen = SPIFFER_UDP_CTRL_SIZE;
+  }
+
+  // and get all queued datagrams
+  //NOTE: this is a thread cancellation point
+  return (recvmmsg (skt, rx->msgs, rx->num, MSG_WAITFORONE, NULL));
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// add the events in a received datagram to the current batch
+// src identifies the source when several are merged into a pipe
+//
+// counts truncated datagrams and drops incomplete events
+//--------------------------------------------------------------------
+void udp_rx_add (udp_rx_t * rx, int pipe, int src, struct mmsghdr * msg) {
+  char * db = (char *) msg->msg_hdr.msg_iov->iov_base;
+  size_t dl = msg->msg_len;
+
+  // datagram did not fit in receive buffer - its tail is lost
+  if (msg->msg_hdr.msg_flags & MSG_TRUNC) {
+    rx->trunc++;
+  }
+
+  // coalesced datagrams must be processed one segment at a time
+  size_t sl = dl;
+#ifdef UDP_GRO
+  if (rx->gro) {
+    for (struct cmsghdr * cm = CMSG_FIRSTHDR (&msg->msg_hdr); cm != NULL;
+         cm = CMSG_NXTHDR (&msg->msg_hdr, cm)) {
+      if ((cm->cmsg_level == IPPROTO_UDP) && (cm->cmsg_type == UDP_GRO)) {
+        int gs;
+        memcpy (&gs, CMSG_DATA (cm), sizeof (gs));
+        if (gs > 0) {
+          sl = gs;
+        }
+      }
+    }
+  }
+#endif
+
+  while (dl != 0) {
+    size_t cl = (dl < sl) ? dl : sl;
+
+    // only complete events are forwarded
+    if (cl % sizeof (uint)) {
+      rx->partial++;
+    }
+
+    // keep events word-aligned - the previous segment is already used
+    size_t ma = (uintptr_t) db % sizeof (uint);
+    if (ma != 0) {
+      memmove (db - ma, db, cl);
+      db -= ma;
+    }
+
+    spiffer_merge_add (pipe, src, (uint *) db, cl / sizeof (uint));
+
+    rx->dgrams++;
+    db += cl;
+    dl -= cl;
+  }
+}
+//--------------------------------------------------------------------
+
+
 //--------------------------------------------------------------------
 // receive events through Ethernet UDP port and forward them to spif
 //
 // expects event to arrive in spif format - no mapping is done
 //
+// drains all queued datagrams in a single call and adds them
+// to the current batch
+//
 // terminated as a result of signal servicing
 //--------------------------------------------------------------------
 void * udp_listener (void * data) {
@@ -374,35 +687,95 @@ void * udp_listener (void * data) {
   sigfillset (&set);
   sigprocmask (SIG_BLOCK, &set, NULL);
 
+  // pin thread and set its priority - if configured
+  spiffer_rt_thread (RT_INPUT, pipe, "udp");
+
   // announce that listener is ready
   log_time ();
-  fprintf (lf, "listening UDP %i -> pipe%i\n", SPIFFER_UDP_PORT_BASE + pipe, pipe);
+  fprintf (lf, "listening UDP %i -> pipe%i [datagrams up to %lu bytes%s]\n",
+           SPIFFER_UDP_PORT_BASE + pipe, pipe, (unsigned long) pipe_ctx[pipe].udp_rx.size,
+           pipe_ctx[pipe].udp_rx.gro ? " - GRO" : "");
   (void) fflush (lf);
 
-  uint * sb = pipe_buf[pipe];
-  size_t ss = SPIFFER_BATCH_SIZE * sizeof (uint);
-  int    us = udp_skt[pipe];
+  udp_rx_t * rx = &pipe_ctx[pipe].udp_rx;
+  int        us = pipe_ctx[pipe].udp_skt;
+
+  struct pollfd   pfd[2] = {{us, POLLIN, 0}, {spiffer_merge_fd (pipe), POLLIN, 0}};
+  int             pfn    = (pfd[1].fd == -1) ? 1 : 2;
+  struct timespec ts;
+  struct timespec pts;
+  struct timespec mts;
+
+  // hold timestamped events for paced replay - if configured
+  if (spiffer_pace_start (pipe) == SPIFFER_ERROR) {
+    log_time ();
+    fprintf (lf, "warning: no memory for paced replay on pipe%i - pacing disabled\n", pipe);
+    (void) fflush (lf);
+  }
+
+  // start sources merged into this pipe - if any,
+  //NOTE: they are stopped when this listener is cancelled
+  spiffer_merge_start (pipe);
+  pthread_cleanup_push (spiffer_merge_stop, data);
 
   // get event batches from UDP port and send them to spif
+  spiffer_batch_start (pipe);
   while (1) {
-    // get next batch of events (blocking),
+    // stop reading while no more events can be held for replay,
+    pfd[0].events = spiffer_pace_full (pipe) ? 0 : POLLIN;
+
+    // wait for datagrams or merged events - or until the next merge,
+    // the next event release or the current batch deadline,
     //NOTE: this is a thread cancellation point
-    int rcv_bytes = recv (us, (void *) sb, ss, 0);
-
-    // trigger a transfer to SpiNNaker,
-    spif_transfer (pipe, rcv_bytes);
-
-    // and wait until spif finishes the transfer
-    //NOTE: report if waiting for too long!
-    int wc = 0;
-    while (spif_busy (pipe)) {
-      wc++;
-      if (wc < 0) {
-        log_time ();
-        fprintf (lf, "error: spif not responding\n");
-        (void) fflush (lf);
-        wc = 0;
-      }
+    struct timespec * to = spiffer_batch_timeout (pipe, &ts);
+    to = spiffer_pace_timeout (pipe, to, &pts);
+    to = spiffer_merge_timeout (pipe, to, &mts);
+    int rdy = ppoll (pfd, pfn, to, NULL);
+    if ((rdy <= 0) || !(pfd[0].revents & POLLIN)) {
+      spiffer_merge_poll (pipe);
+      spiffer_pace_poll (pipe);
+      spiffer_batch_poll (pipe);
+      continue;
+    }
+
+    // get all queued datagrams - block only until the first one arrives,
+    //NOTE: this is a thread cancellation point
+    int rcv_msgs = udp_rx_recv (rx, us);
+    if (rcv_msgs <= 0) {
+      continue;
+    }
+
+    // add their events to the current batch,
+    for (int m = 0; m < rcv_msgs; m++) {
+      udp_rx_add (rx, pipe, SPIFFER_MERGE_OWN_SRC, &rx->msgs[m]);
+    }
+
+    // merge events from all sources,
+    spiffer_merge_poll (pipe);
+
+    // release events that are due,
+    spiffer_pace_poll (pipe);
+
+    // and send the batch if its deadline has expired
+    spiffer_batch_poll (pipe);
+  }
+
+  pthread_cleanup_pop (0);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// start UDP listeners on pipes without a USB device - if not already
+// listening
+//
+// must be called with the USB lock held
+//--------------------------------------------------------------------
+void udp_start_listeners (void) {
+  //NOTE: pipes fed by the listener of another pipe get none
+  for (int pipe = 0; pipe < pipe_num_in; pipe++) {
+    if ((pipe_ctx[pipe].dev == SPIFFER_USB_NO_DEVICE) && !pipe_ctx[pipe].listening && !spiffer_route_taken (pipe)) {
+      pipe_ctx[pipe].listening = (spiffer_rt_create (&pipe_ctx[pipe].listener, udp_listener, (void *) &dev_to_ptr[pipe], "UDP listener") == 0);
     }
   }
 }
@@ -422,15 +795,18 @@ void * out_udp_listener (void * data) {
   sigfillset (&set);
   sigprocmask (SIG_BLOCK, &set, NULL);
 
+  // pin thread and set its priority - if configured
+  spiffer_rt_thread (RT_COMMAND, pipe, "cmd");
+
   // announce that listener is ready
   log_time ();
   fprintf (lf, "listening UDP %i for output commands\n",
            SPIFFER_UDP_PORT_BASE - (pipe + 1));
   (void) fflush (lf);
 
-  client_addr_len[pipe] = sizeof (struct sockaddr);
+  pipe_ctx[pipe].client_addr_len = sizeof (struct sockaddr);
 
-  int us = out_udp_skt[pipe];
+  int us = pipe_ctx[pipe].out_udp_skt;
   int ds = SPIFFER_BATCH_SIZE;
   int dd[SPIFFER_BATCH_SIZE];
 
@@ -438,8 +814,8 @@ void * out_udp_listener (void * data) {
     // wait for connection from output client
     //NOTE: keep client IP address and UDP port
     int rcv_bytes = recvfrom (us, dd, ds * sizeof (uint), 0,
-                              (struct sockaddr *) &client_addr[pipe],
-                              (socklen_t *) &client_addr_len[pipe]);
+                              (struct sockaddr *) &pipe_ctx[pipe].client_addr,
+                              (socklen_t *) &pipe_ctx[pipe].client_addr_len);
 
     // execute received output commands
     uint num_cmds = rcv_bytes / sizeof (uint);
@@ -449,11 +825,11 @@ void * out_udp_listener (void * data) {
       log_time ();
       switch (cmd) {
       case SPIF_OUT_START:
-        out_start[pipe] = 1;
+        pipe_ctx[pipe].out_start = 1;
         fprintf (lf, "starting outpipe%i\n", pipe);
         break;
       case SPIF_OUT_STOP:
-        out_start[pipe] = 0;
+        pipe_ctx[pipe].out_start = 0;
         fprintf (lf, "stopping outpipe%i\n", pipe);
         break;
       case SPIF_OUT_SET_TICK:
@@ -477,22 +853,116 @@ void * out_udp_listener (void * data) {
 
 
 //--------------------------------------------------------------------
-// sort USB devices by serial number and assign pipes
+// get a free USB device entry
+//
+// returns the device entry or SPIFFER_USB_NO_DEVICE if none free
+//--------------------------------------------------------------------
+int usb_dev_slot (void) {
+  for (int dv = 0; dv < SPIFFER_USB_DISCOVER_CNT; dv++) {
+    if (!usb_devs.params[dv].present) {
+      return (dv);
+    }
+  }
+
+  return (SPIFFER_USB_NO_DEVICE);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// check if a connected USB device is named by id
+// id must contain the device serial number
+//
+// returns true if the device is connected
+//--------------------------------------------------------------------
+bool usb_dev_known (const char * id) {
+  for (int dv = 0; dv < SPIFFER_USB_DISCOVER_CNT; dv++) {
+    if (usb_devs.params[dv].present && (strstr (id, usb_devs.params[dv].sn) != NULL)) {
+      return (true);
+    }
+  }
+
+  return (false);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// check if a connected USB camera is supported by a different plugin
+// replayed recordings do not count
+//
+// returns true if one is found
+//--------------------------------------------------------------------
+bool usb_dev_other (int plugin) {
+  for (int dv = 0; dv < SPIFFER_USB_DISCOVER_CNT; dv++) {
+    if (usb_devs.params[dv].present && (usb_devs.params[dv].type == CAMERA) &&
+        (usb_devs.params[dv].plugin != plugin)) {
+      return (true);
+    }
+  }
+
+  return (false);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// close a USB device and free its entry
+//--------------------------------------------------------------------
+void usb_close_dev (int dev) {
+  switch (usb_devs.params[dev].type) {
+  case CAMERA:
+    spiffer_plugin_shutdown_dev (dev);
+    break;
+  case REPLAY:
+    spiffer_replay_shutdown_dev (dev);
+    break;
+  default:
+    log_time ();
+    fprintf (lf, "warning: ignoring unsupported camera type\n");
+    break;
+  }
+
+  usb_devs.params[dev].present = false;
+  usb_devs.cnt--;
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// give a pipe to a new USB device
+//--------------------------------------------------------------------
+void usb_give_pipe (int dev, int pipe) {
+  usb_devs.params[dev].pipe = pipe;
+  pipe_ctx[pipe].dev = dev;
+
+  // remember who had the pipe - for the next connection
+  (void) strcpy (usb_devs.pipe_sn[pipe], usb_devs.params[dev].sn);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// sort new USB devices by serial number and assign free pipes
+// a device gets back the pipe it had before if still free, otherwise
+// pipes never used by a device go first
 //
 // no return value
 //--------------------------------------------------------------------
 void usb_sort_pipes () {
-  // create a sorted list of serial numbers,
+  // create a sorted list of serial numbers - new devices only,
   int sorted[SPIFFER_USB_DISCOVER_CNT];
+  int num = 0;
 
-  // start with an unsorted list,
-  for (int dv = 0; dv < usb_devs.cnt; dv++) {
-    sorted[dv] = dv;
+  for (int dv = 0; dv < SPIFFER_USB_DISCOVER_CNT; dv++) {
+    if (usb_devs.params[dv].present && (usb_devs.params[dv].pipe == SPIFFER_USB_NO_DEVICE)) {
+      sorted[num++] = dv;
+    }
   }
 
   // straightforward bubble sort - small number of devices!
-  for (int i = 0; i < (usb_devs.cnt - 1); i++) {
-    for (int j = 0; j < (usb_devs.cnt - i - 1); j++) {
+  for (int i = 0; i < (num - 1); i++) {
+    for (int j = 0; j < (num - i - 1); j++) {
       if (strcmp (usb_devs.params[sorted[j]].sn, usb_devs.params[sorted[j + 1]].sn) > 0) {
         // swap
         int temp      = sorted[j];
@@ -502,9 +972,47 @@ void usb_sort_pipes () {
     }
   }
 
-  // associate each device, in sorted order, with a spif pipe
-  for (int p = 0; p < usb_devs.cnt; p++) {
-    usb_devs.params[sorted[p]].pipe = p;
+  // give devices back their previous pipe - if still free,
+  //NOTE: pipes fed by the listener of another pipe are never free
+  for (int p = 0; p < num; p++) {
+    for (int pipe = 0; pipe < pipe_num_in; pipe++) {
+      if ((pipe_ctx[pipe].dev == SPIFFER_USB_NO_DEVICE) && !spiffer_route_taken (pipe) &&
+          (strcmp (usb_devs.pipe_sn[pipe], usb_devs.params[sorted[p]].sn) == 0)) {
+        usb_give_pipe (sorted[p], pipe);
+        break;
+      }
+    }
+  }
+
+  // and associate the rest, in sorted order, with a free pipe
+  for (int p = 0; p < num; p++) {
+    if (usb_devs.params[sorted[p]].pipe != SPIFFER_USB_NO_DEVICE) {
+      continue;
+    }
+
+    int free_pipe = SPIFFER_USB_NO_DEVICE;
+    for (int pipe = 0; pipe < pipe_num_in; pipe++) {
+      if ((pipe_ctx[pipe].dev != SPIFFER_USB_NO_DEVICE) || spiffer_route_taken (pipe)) {
+        continue;
+      }
+
+      // prefer pipes never used by a device,
+      if (usb_devs.pipe_sn[pipe][0] == '\0') {
+        free_pipe = pipe;
+        break;
+      }
+
+      if (free_pipe == SPIFFER_USB_NO_DEVICE) {
+        free_pipe = pipe;
+      }
+    }
+
+    if (free_pipe != SPIFFER_USB_NO_DEVICE) {
+      usb_give_pipe (sorted[p], free_pipe);
+    } else {
+      log_time ();
+      fprintf (lf, "warning: no free pipe for device %s\n", usb_devs.params[sorted[p]].sn);
+    }
   }
 }
 //--------------------------------------------------------------------
@@ -512,91 +1020,189 @@ void usb_sort_pipes () {
 
 //--------------------------------------------------------------------
 // attempt to discover new devices connected to the USB bus
-// sort devices by serial number for consistent mapping to spif pipes
+// devices already connected are left alone
 //
-// discon_dev = disconnected USB device, SPIFFER_USB_NO_DEVICE for unknown
+// new devices are sorted by serial number for consistent
+// mapping to spif pipes
 //--------------------------------------------------------------------
-void usb_discover_devs (int discon_dev) {
-  // start from a clean state,
-  usb_devs.cnt = 0;
+void usb_discover_devs (void) {
+  int known = usb_devs.cnt;
 
-#ifdef META_SUPPORT
-  // find prophesee devices (updates usb_devs.cnt),
-  spiffer_meta_discover_devs ();
-#endif
+  // open recordings to be replayed - they come with their pipe,
+  spiffer_replay_discover_devs ();
 
-#ifdef CAER_SUPPORT
-  // find Inivation devices (updates usb_devs.cnt),
-  spiffer_caer_discover_devs ();
-#endif
+  // find USB cameras - through their plugins (updates usb_devs.cnt),
+  spiffer_plugin_discover_devs ();
 
-  // and assign pipes to devices (sorted by serial number)
-  if (usb_devs.cnt > 0) {
+  // and assign pipes to new devices (sorted by serial number)
+  if (usb_devs.cnt > known) {
+    usb_devs.found += usb_devs.cnt - known;
     usb_sort_pipes ();
   }
 }
 //--------------------------------------------------------------------
 
 
+//--------------------------------------------------------------------
+// detach a disconnected USB device from its pipe and close it
+// the listeners of other pipes are left alone
+//--------------------------------------------------------------------
+void usb_detach_dev (int dev) {
+  int pipe = usb_devs.params[dev].pipe;
+
+  if (!usb_devs.params[dev].present) {
+    return;
+  }
+
+  log_time ();
+  fprintf (lf, "device %s disconnected\n", usb_devs.params[dev].sn);
+
+  // stop its listener - unless spiffer took it over,
+  switch (usb_devs.params[dev].type) {
+  case CAMERA:
+    // if a camera is disconnected its listener exits the thread,
+    //NOTE: this runs in that listener - it is joined later
+    if (pipe_ctx[pipe].listening) {
+      if (pipe_ctx[pipe].old_listening) {
+        pthread_join (pipe_ctx[pipe].old_listener, NULL);
+      }
+      pipe_ctx[pipe].old_listener  = pipe_ctx[pipe].listener;
+      pipe_ctx[pipe].old_listening = true;
+    }
+    break;
+  case REPLAY:
+    if (pipe_ctx[pipe].listening) {
+      (void) pthread_cancel (pipe_ctx[pipe].listener);
+      pthread_join (pipe_ctx[pipe].listener, NULL);
+    }
+    break;
+  default:
+    log_time ();
+    fprintf (lf, "warning: ignoring unsupported camera type\n");
+    break;
+  }
+
+  // free the pipe,
+  pipe_ctx[pipe].listening     = false;
+  pipe_ctx[pipe].dev           = SPIFFER_USB_NO_DEVICE;
+  usb_devs.params[dev].pipe    = SPIFFER_USB_NO_DEVICE;
+  usb_devs.params[dev].present = false;
+  usb_devs.cnt--;
+
+  // and close the camera - marked closed first, so it is closed once
+  //NOTE: its listener no longer uses it
+  if (usb_devs.params[dev].type == CAMERA) {
+    spiffer_plugin_shutdown_dev (dev);
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// release a USB device that failed to start and give its pipe back
+// to UDP input - the device is closed
+//
+// the device is not looked for again until the next survey
+//--------------------------------------------------------------------
+void usb_release_dev (int dev) {
+  pthread_mutex_lock (&usb_mtx);
+
+  // detach and close it - as if disconnected,
+  usb_detach_dev (dev);
+
+  // and listen to UDP on its pipe - unless spiffer is stopping
+  if (!usb_devs.stopping) {
+    udp_start_listeners ();
+  }
+
+  (void) fflush (lf);
+
+  pthread_mutex_unlock (&usb_mtx);
+}
+//--------------------------------------------------------------------
+
+
 //--------------------------------------------------------------------
 // survey USB devices
 // called at start up and on USB device connection and disconnection
 //
-// data = pipe associated with disconnected USB device, -1 for unknown
+// only the pipes of connected or disconnected devices are affected,
+// the listeners of the other pipes keep running
+//
+// data = disconnected USB device, NULL or SPIFFER_USB_DISCOVER_CNT for unknown
 //
 // no return value
 //--------------------------------------------------------------------
 void usb_survey_devs (void * data) {
-  // try to grab the lock - keep other threads out
-  if (pthread_mutex_trylock (&usb_mtx)) {
+  int discon_dev = (data == NULL) ? SPIFFER_USB_DISCOVER_CNT : *((int *) data);
+
+  // grab the lock - keep other threads out
+  //NOTE: disconnections must always be processed
+  if (discon_dev < SPIFFER_USB_DISCOVER_CNT) {
+    pthread_mutex_lock (&usb_mtx);
+  } else if (pthread_mutex_trylock (&usb_mtx)) {
     // other thread surveying USB devices - leave without doing anything
     return;
   };
 
-  // report disconnected device
-  int discon_dev;
-  if (data == NULL) {
-    discon_dev = SPIFFER_USB_NO_DEVICE;
-  } else {
-    discon_dev = *((int *) data);
-    if (discon_dev < SPIFFER_USB_DISCOVER_CNT) {
-      log_time ();
-      fprintf (lf, "device %s disconnected\n", usb_devs.params[discon_dev].sn);
-    }
+  // detach disconnected device,
+  if (discon_dev < SPIFFER_USB_DISCOVER_CNT) {
+    usb_detach_dev (discon_dev);
   }
 
-  // if needed shutdown input listeners and USB devices,
-  if (discon_dev < SPIFFER_USB_DISCOVER_CNT) {
-    spiffer_input_shutdown (discon_dev);
+  // and leave the rest alone if spiffer is stopping
+  if (usb_devs.stopping) {
+    pthread_mutex_unlock (&usb_mtx);
+    return;
   }
 
-  // try to discover supported USB devices
-  usb_discover_devs (discon_dev);
+  // try to discover new USB devices
+  bool known[SPIFFER_USB_DISCOVER_CNT];
+  for (int dv = 0; dv < SPIFFER_USB_DISCOVER_CNT; dv++) {
+    known[dv] = usb_devs.params[dv].present;
+  }
+
+  usb_discover_devs ();
+
+  // start USB listeners on new devices - if they got a pipe,
+  for (int dv = 0; dv < SPIFFER_USB_DISCOVER_CNT; dv++) {
+    int pipe = usb_devs.params[dv].pipe;
+
+    if (known[dv] || !usb_devs.params[dv].present) {
+      continue;
+    }
+
+    // close devices left without a pipe,
+    if (pipe == SPIFFER_USB_NO_DEVICE) {
+      usb_close_dev (dv);
+      continue;
+    }
+
+    // stop the UDP listener on its pipe,
+    if (pipe_ctx[pipe].listening) {
+      (void) pthread_cancel (pipe_ctx[pipe].listener);
+      pthread_join (pipe_ctx[pipe].listener, NULL);
+    }
 
-  // start USB listeners on discovered devices
-  for (int dv = 0; dv < usb_devs.cnt; dv++) {
     switch (usb_devs.params[dv].type) {
-#ifdef CAER_SUPPORT
-    case CAER:
-      (void) pthread_create (&listener[usb_devs.params[dv].pipe], NULL, spiffer_caer_usb_listener, (void *) &dev_to_ptr[dv]);
+    case CAMERA:
+      pipe_ctx[pipe].listening = (spiffer_rt_create (&pipe_ctx[pipe].listener, spiffer_plugin_listener, (void *) &dev_to_ptr[dv], "USB listener") == 0);
       break;
-#endif
-#ifdef META_SUPPORT
-    case META:
-      (void) pthread_create (&listener[usb_devs.params[dv].pipe], NULL, spiffer_meta_usb_listener, (void *) &dev_to_ptr[dv]);
+    case REPLAY:
+      pipe_ctx[pipe].listening = (spiffer_rt_create (&pipe_ctx[pipe].listener, spiffer_replay_listener, (void *) &dev_to_ptr[dv], "replay listener") == 0);
       break;
-#endif
     default:
       log_time ();
       fprintf (lf, "warning: ignoring unsupported camera type\n");
+      pipe_ctx[pipe].listening = false;
       break;
     }
   }
 
-  // and start UDP listeners on the rest of the pipes
-  for (int pipe = usb_devs.cnt; pipe < pipe_num_in; pipe++) {
-    (void) pthread_create (&listener[pipe], NULL, udp_listener, (void *) &dev_to_ptr[pipe]);
-  }
+  // and start UDP listeners on free pipes
+  udp_start_listeners ();
+
+  (void) fflush (lf);
 
   // release the lock
   pthread_mutex_unlock (&usb_mtx);
@@ -616,15 +1222,12 @@ int usb_init (void) {
 
   usb_devs.cnt = 0;
 
-#ifdef CAER_SUPPORT
-  // Libcaer initialisation,
-  spiffer_caer_init ();
-#endif
+  // no devices on pipes yet,
+  for (int pipe = 0; pipe < pipe_num_in; pipe++) {
+    pipe_ctx[pipe].dev = SPIFFER_USB_NO_DEVICE;
+  }
 
-#ifdef META_SUPPORT
-  // Metavision SDK library initialisation,
-  spiffer_meta_init ();
-#endif
+  //NOTE: camera plugins are set up when first loaded
 
   return (SPIFFER_OK);
 }
@@ -641,8 +1244,8 @@ int spif_pipes_init (void) {
   size_t batch_size = SPIFFER_BATCH_SIZE * sizeof (uint);
 
   // try to open spif pipe 0
-  pipe_fd[0] = spif_open (0);
-  if (pipe_fd[0] == SPIFFER_ERROR) {
+  int fd = spif_open (0);
+  if (fd == SPIFFER_ERROR) {
     log_time ();
     fprintf (lf, "error: unable to open pipe0 - ");
     switch (errno) {
@@ -676,19 +1279,39 @@ int spif_pipes_init (void) {
     pipe_num_out
     );
 
-  // check that hw and sw number of pipes are compatible
+  // the driver creates a device for every input pipe - and no more,
+  if (pipe_num_out > pipe_num_in) {
+    log_time ();
+    fprintf (lf, "warning: no spif device for output pipes %i to %i - not used\n",
+             pipe_num_in, pipe_num_out - 1);
+    pipe_num_out = pipe_num_in;
+  }
+
+  // allocate pipe state - for the pipes found,
   int pipe_max_num = (pipe_num_in >= pipe_num_out) ? pipe_num_in : pipe_num_out;
-  if (pipe_max_num > SPIF_HW_PIPES_NUM) {
+  //NOTE: every pipe context starts on its own cache line
+  size_t ctx_size = ((pipe_max_num == 0) ? 1 : pipe_max_num) * sizeof (pipe_ctx_t);
+  if (posix_memalign ((void **) &pipe_ctx, SPIFFER_CACHE_LINE, ctx_size) != 0) {
+    pipe_ctx = NULL;
+  } else {
+    memset (pipe_ctx, 0, ctx_size);
+  }
+
+  if (pipe_ctx == NULL) {
+    pipe_num_in  = 0;
+    pipe_num_out = 0;
+    spif_close (0);
     log_time ();
-    fprintf (lf, "error: incompatible number of hw and sw pipes\n");
+    fprintf (lf, "error: no memory for %i spif pipes\n", pipe_max_num);
     return (SPIFFER_ERROR);
   }
+  pipe_ctx[0].fd = fd;
 
   // open the rest of the pipes
   for (int pipe = 1; pipe < pipe_max_num; pipe++) {
     // open spif pipe
-    pipe_fd[pipe] = spif_open (pipe);
-    if (pipe_fd[pipe] == SPIFFER_ERROR) {
+    pipe_ctx[pipe].fd = spif_open (pipe);
+    if (pipe_ctx[pipe].fd == SPIFFER_ERROR) {
       log_time ();
       fprintf (lf, "error: unable to open spif pipe%i\n", pipe);
       return (SPIFFER_ERROR);
@@ -698,19 +1321,34 @@ int spif_pipes_init (void) {
   // set up input buffers
   for (int pipe = 0; pipe < pipe_num_in; pipe++) {
     // get pipe buffer
-    pipe_buf[pipe] = (uint *) spif_get_buffer (pipe, batch_size);
-    if (pipe_buf[pipe] == NULL) {
+    pipe_ctx[pipe].buf = (uint *) spif_get_buffer (pipe, batch_size);
+    if (pipe_ctx[pipe].buf == NULL) {
       log_time ();
       fprintf (lf, "error: failed to get buffer for spif pipe%i\n", pipe);
       return (SPIFFER_ERROR);
     }
+
+    // split buffer into slots - if they fit and the driver supports them
+    //NOTE: slot size must keep slots word-aligned
+    size_t slot_size = (spif_get_buffer_size (pipe) / SPIFFER_IN_SLOTS) & ~(sizeof (uint) - 1);
+    if ((slot_size >= batch_size) && (spif_set_source (pipe, 0) == 0)) {
+      pipe_ctx[pipe].in_slot_num  = SPIFFER_IN_SLOTS;
+      pipe_ctx[pipe].in_slot_size = slot_size;
+    } else {
+      pipe_ctx[pipe].in_slot_num  = 1;
+      pipe_ctx[pipe].in_slot_size = spif_get_buffer_size (pipe);
+    }
+
+    log_time ();
+    fprintf (lf, "pipe%i: %i input slot%s of %lu bytes\n", pipe, pipe_ctx[pipe].in_slot_num,
+             pipe_ctx[pipe].in_slot_num == 1 ? "" : "s", (unsigned long) pipe_ctx[pipe].in_slot_size);
   }
 
   // set up output buffers
   for (int pipe = 0; pipe < pipe_num_out; pipe++) {
     // get pipe buffer
-    pipe_out_buf[pipe] = (uint *) spif_get_output_buffer (pipe, batch_size);
-    if (pipe_out_buf[pipe] == NULL) {
+    pipe_ctx[pipe].out_buf = (uint *) spif_get_output_buffer (pipe, batch_size);
+    if (pipe_ctx[pipe].out_buf == NULL) {
       log_time ();
       fprintf (lf, "error: failed to get output buffer for spif pipe%i\n", pipe);
       return (SPIFFER_ERROR);
@@ -734,12 +1372,33 @@ int sig_init (void) {
   signal_usr1_cfg.sa_handler = &sig_usr1;
   signal_usr1_cfg.sa_flags = 0;
   sigemptyset (&signal_usr1_cfg.sa_mask);
+  sigaddset   (&signal_usr1_cfg.sa_mask, SIGTERM);
 
   // register signal service routine
   if (sigaction (SIGUSR1,  &signal_usr1_cfg, NULL) == SPIFFER_ERROR) {
     return (SPIFFER_ERROR);
   }
 
+  // set up USR2 signal servicing
+  signal_usr2_cfg.sa_handler = &sig_usr2;
+  signal_usr2_cfg.sa_flags = 0;
+  sigemptyset (&signal_usr2_cfg.sa_mask);
+
+  // register signal service routine
+  if (sigaction (SIGUSR2,  &signal_usr2_cfg, NULL) == SPIFFER_ERROR) {
+    return (SPIFFER_ERROR);
+  }
+
+  // set up HUP signal servicing
+  signal_hup_cfg.sa_handler = &sig_hup;
+  signal_hup_cfg.sa_flags = 0;
+  sigemptyset (&signal_hup_cfg.sa_mask);
+
+  // register signal service routine
+  if (sigaction (SIGHUP,  &signal_hup_cfg, NULL) == SPIFFER_ERROR) {
+    return (SPIFFER_ERROR);
+  }
+
   // set up TERM signal servicing
   signal_term_cfg.sa_handler = &sig_term;
   signal_term_cfg.sa_flags = 0;
@@ -770,7 +1429,9 @@ void sig_term (int signum) {
 //--------------------------------------------------------------------
 // service USR1 signal
 //
-// SIGUSR1 indicates that a USB device has been connected
+// SIGUSR1 requests a USB device survey
+//NOTE: USB camera connections are detected by the udev monitor,
+//      the signal is kept to force a survey by hand
 //
 // no return value
 //--------------------------------------------------------------------
@@ -804,6 +1465,38 @@ void sig_usr1 (int signum) {
 //--------------------------------------------------------------------
 
 
+//--------------------------------------------------------------------
+// service USR2 signal
+//
+// SIGUSR2 requests a statistics report
+//
+// no return value
+//--------------------------------------------------------------------
+void sig_usr2 (int signum) {
+  (void) signum;
+
+  spiffer_report_stats ();
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// service HUP signal
+//
+// SIGHUP requests camera sensor settings to be re-read from the
+// configuration file - applied to cameras while they run
+//NOTE: the file is read by the main thread, not in the signal handler
+//
+// no return value
+//--------------------------------------------------------------------
+void sig_hup (int signum) {
+  (void) signum;
+
+  signal_hup_pending = 1;
+}
+//--------------------------------------------------------------------
+
+
 //--------------------------------------------------------------------
 // main thread:
 // opens spif pipes
@@ -832,9 +1525,16 @@ int main (int argc, char *argv[])
     spiffer_stop (SPIFFER_ERROR);
   }
 
+  // read configuration,
+  spiffer_config_init ();
+  spiffer_config_read (cfg_name);
+
+  // lock memory - if configured,
+  spiffer_rt_memory ();
+
   // initialise output control
   for (int pipe = 0; pipe < pipe_num_out; pipe++) {
-    out_start[pipe] = 0;
+    pipe_ctx[pipe].out_start = 0;
   }
 
   // set up UDP servers - one for every pipe,
@@ -857,19 +1557,39 @@ int main (int argc, char *argv[])
     spiffer_stop (SPIFFER_ERROR);
   }
 
+  // monitor USB camera connections - before looking for cameras,
+  if (spiffer_udev_start () == SPIFFER_ERROR) {
+    log_time ();
+    fprintf (lf, "warning: USB camera connections not monitored - use SIGUSR1\n");
+  }
+
   // update log,
   (void) fflush (lf);
 
-  // discover USB devces only if no USB-triggered signals already caused discovery
-  //NOTE: allow enough time for signals to be procesed
-  sleep (SPIFFER_SIG_DLY);
-  if (usb_devs.cnt == 0) {
-    usb_survey_devs (&dev_to_ptr[SPIFFER_USB_DISCOVER_CNT]);
-  }
+  // signals are serviced only while the main thread waits - never in
+  // the middle of a survey or a settings reload,
+  sigset_t sigs;
+  sigset_t idle;
+  sigemptyset (&sigs);
+  sigaddset   (&sigs, SIGTERM);
+  sigaddset   (&sigs, SIGUSR1);
+  sigaddset   (&sigs, SIGUSR2);
+  sigaddset   (&sigs, SIGHUP);
+  sigprocmask (SIG_BLOCK, &sigs, &idle);
+
+  // discover USB devices already connected,
+  //NOTE: cameras connected from now on are attached by the monitor
+  usb_survey_devs (&dev_to_ptr[SPIFFER_USB_DISCOVER_CNT]);
 
   // and go to sleep - let the listeners do the work
   while (1) {
-    pause ();
+    sigsuspend (&idle);
+
+    // re-read sensor settings - if requested
+    if (signal_hup_pending) {
+      signal_hup_pending = 0;
+      spiffer_sensor_reload ();
+    }
   }
 }
 //--------------------------------------------------------------------
@@ -14,22 +14,9 @@
 #define __SPIFFER_H__
 
 
-// Inivation camera support
-#ifdef CAER_SUPPORT
-#include <libcaer/libcaer.h>
-#include <libcaer/devices/davis.h>
-#endif
-
-// Prophesee camera support
-#ifdef META_SUPPORT
-#include "metavision/sdk/base/events/event_cd.h"
-#include <metavision/hal/device/device_discovery.h>
-#include <metavision/hal/device/device.h>
-#include <metavision/hal/facilities/i_hw_identification.h>
-#include <metavision/hal/facilities/i_event_decoder.h>
-#include <metavision/hal/facilities/i_events_stream.h>
-#include <metavision/hal/facilities/i_events_stream_decoder.h>
-#endif
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
 
 // constants
 #define SPIFFER_VER_MAJ     0
@@ -38,11 +25,28 @@
 #define SPIFFER_ERROR      -1
 #define SPIFFER_OK         0
 #define SPIFFER_BATCH_SIZE 256
+#define SPIFFER_IN_SLOTS   2
+
+// pipe state is allocated for the pipes found in spif - up to
+// the number of pipes the hardware can report
+#define SPIFFER_PIPES_MAX  SPIF_HW_PIPES_MAX
+
+// per-pipe state written by different threads is kept in
+// separate cache lines - no false sharing between pipes
+#define SPIFFER_CACHE_LINE 64
 
 #define SPIFFER_UDP_PORT_BASE      3333
+#define SPIFFER_UDP_RX_SIZE        (256 * 1024)
+#define SPIFFER_UDP_MMSG_MAX       64
+#define SPIFFER_UDP_GRO_SIZE       65536
+#define SPIFFER_UDP_JUMBO_SIZE     9000
+#define SPIFFER_UDP_CTRL_SIZE      64
+#define SPIFFER_UDP_USE_GRO        true
+#define SPIFFER_MERGE_SRC_MAX      8
+#define SPIFFER_MERGE_OWN_SRC      0
 
 #define SPIFFER_USB_EVTS_PER_PKT   256
-#define SPIFFER_USB_DISCOVER_CNT   SPIF_HW_PIPES_NUM
+#define SPIFFER_USB_DISCOVER_CNT   SPIFFER_PIPES_MAX
 #define SPIFFER_USB_NO_DEVICE      -1
 #define SPIFFER_USB_MIX_CAMERAS    false
 
@@ -58,35 +62,81 @@
 #define SPIFFER_OUT_START  0x5ec00051
 #define SPIFFER_OUT_STOP   0x5ec00050
 
-#define SPIFFER_SIG_DLY    3
-
 // log file
 //TODO: maybe change to system/kernel log
-static const char * log_name = "/tmp/spiffer.log";
+extern const char * log_name;
 
 // USB devices
 typedef char serial_t[9];
 
 typedef enum {
-  CAER,
-  META
+  CAMERA,    // USB camera - supported by a plugin
+  REPLAY     // recording replayed as a camera
 } device_type_t;
 
 typedef struct dev_params {
+  bool                                present;
   int                                 pipe;
   device_type_t                       type;
   serial_t                            sn;
-#ifdef CAER_SUPPORT
-  caerDeviceHandle                    caer_hdl;
-#endif
-#ifdef META_SUPPORT
-  std::unique_ptr<Metavision::Device> meta_hdl;
-#endif
+  int                                 plugin;   // CAMERA plugin
+  void *                              hdl;      // and its device handle
 } device_params_t;
 
+// UDP input
+typedef struct udp_rx {
+  int                num;      // number of datagrams received per call
+  size_t             size;     // maximum size of each datagram
+  bool               gro;      // datagrams can be coalesced by UDP GRO
+  char *             buf;      // receive staging area
+  char *             ctrl;     // ancillary data (GRO segment size)
+  struct iovec *     iovs;     // one iovec per datagram
+  struct mmsghdr *   msgs;     // recvmmsg message headers
+  unsigned long long dgrams;   // received datagrams
+  unsigned long long trunc;    // truncated datagrams
+  unsigned long long partial;  // datagrams with an incomplete event
+} udp_rx_t;
+
+// per-pipe context
+//NOTE: each group is written by a different thread - they start
+//      on their own cache line
+typedef struct alignas (SPIFFER_CACHE_LINE) pipe_ctx {
+  // spif input pipe and UDP input - input listener,
+  alignas (SPIFFER_CACHE_LINE)
+  int                fd;
+  uint *             buf;
+  int                in_slot_num;       // input buffer slots - filled while
+  size_t             in_slot_size;      // the previous slot is transferred
+  int                udp_skt;
+  udp_rx_t           udp_rx;
+
+  // SpiNNaker output and its client - output command listener,
+  alignas (SPIFFER_CACHE_LINE)
+  uint *             out_buf;
+  int                out_udp_skt;
+  int                out_start;
+  struct sockaddr_in client_addr;
+  socklen_t          client_addr_len;
+
+  // and listeners and USB device on the pipe - USB survey
+  alignas (SPIFFER_CACHE_LINE)
+  pthread_t          listener;
+  bool               listening;
+  pthread_t          old_listener;      // listener of a disconnected camera -
+  bool               old_listening;     // exited, but not joined yet
+  pthread_t          out_listener;
+  bool               out_listening;
+  pthread_t          spinn_listener;
+  bool               spinn_listening;
+  int                dev;
+} pipe_ctx_t;
+
 typedef struct usb_devs {
-  int              cnt;                         // number of connected USB devices
-  device_params_t  params[SPIF_HW_PIPES_NUM];   // USB device params
+  int              cnt;                                // number of connected USB devices
+  device_params_t  params[SPIFFER_USB_DISCOVER_CNT];  // USB device params - entries stay put while connected
+  serial_t         pipe_sn[SPIFFER_PIPES_MAX];         // last USB device on each pipe - kept when disconnected
+  uint             found;                              // USB devices discovered since start up
+  bool             stopping;                           // spiffer stopping - no new listeners
 } usb_devs_t;
 
 
@@ -100,9 +150,45 @@ void log_time (void);
 //--------------------------------------------------------------------
 // shutdown input listeners and USB devices
 //
-// needed when USB devices are connected or disconnected
+// needed when spiffer stops
+//--------------------------------------------------------------------
+void spiffer_input_shutdown (void);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// write input and output statistics to log file
+//--------------------------------------------------------------------
+void spiffer_report_stats (void);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// wait until spif finishes the current transfer on a pipe
+//
+// reports when waiting for too long
 //--------------------------------------------------------------------
-void spiffer_input_shutdown (int discon_dev);
+void spiffer_wait_idle (int pipe);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// get the address of an input buffer slot
+//--------------------------------------------------------------------
+uint * spiffer_in_slot (int pipe, int slot);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// transfer the contents of an input buffer slot to SpiNNaker
+//
+// waits for the previous transfer to finish before starting this one,
+// the remaining slots can be filled while the transfer is in progress
+//
+// with a single slot, waits for this transfer to finish as well - the
+// slot cannot be refilled while spif is still reading it
+//--------------------------------------------------------------------
+void spiffer_in_transfer (int pipe, int slot, int bytes);
 //--------------------------------------------------------------------
 
 
@@ -142,17 +228,69 @@ int udp_init (void);
 //--------------------------------------------------------------------
 
 
+//--------------------------------------------------------------------
+// create a UDP socket and bind it to a local port
+//
+// returns the socket or SPIFFER_ERROR if problems found
+//--------------------------------------------------------------------
+int udp_bind (int eth_port);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// set up batched reception on an input UDP socket
+// enable UDP GRO if available and allocate recvmmsg structures
+//
+// returns SPIFFER_ERROR if problems found
+//--------------------------------------------------------------------
+int udp_rx_init (udp_rx_t * rx, int pipe, int skt);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// receive all queued datagrams on an input UDP socket
+// blocks only until the first one arrives
+//
+// returns the number of datagrams received
+//--------------------------------------------------------------------
+int udp_rx_recv (udp_rx_t * rx, int skt);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// add the events in a received datagram to the current batch
+// src identifies the source when several are merged into a pipe
+//
+// counts truncated datagrams and drops incomplete events
+//--------------------------------------------------------------------
+void udp_rx_add (udp_rx_t * rx, int pipe, int src, struct mmsghdr * msg);
+//--------------------------------------------------------------------
+
+
 //--------------------------------------------------------------------
 // receive events through Ethernet UDP port and forward them to spif
 //
 // expects event to arrive in spif format - no mapping is done
 //
+// drains all queued datagrams in a single call and adds them
+// to the current batch
+//
 // terminated as a result of signal servicing
 //--------------------------------------------------------------------
 void * udp_listener (void * data);
 //--------------------------------------------------------------------
 
 
+//--------------------------------------------------------------------
+// start UDP listeners on pipes without a USB device - if not already
+// listening
+//
+// must be called with the USB lock held
+//--------------------------------------------------------------------
+void udp_start_listeners (void);
+//--------------------------------------------------------------------
+
+
 //--------------------------------------------------------------------
 // receive output commands through Ethernet UDP port
 //
@@ -172,7 +310,52 @@ int usb_dev_config (int pipe);
 
 
 //--------------------------------------------------------------------
-// sort USB devices by serial number and assign pipes
+// get a free USB device entry
+//
+// returns the device entry or SPIFFER_USB_NO_DEVICE if none free
+//--------------------------------------------------------------------
+int usb_dev_slot (void);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// check if a connected USB device is named by id
+// id must contain the device serial number
+//
+// returns true if the device is connected
+//--------------------------------------------------------------------
+bool usb_dev_known (const char * id);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// check if a connected USB camera is supported by a different plugin
+// replayed recordings do not count
+//
+// returns true if one is found
+//--------------------------------------------------------------------
+bool usb_dev_other (int plugin);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// give a pipe to a new USB device
+//--------------------------------------------------------------------
+void usb_give_pipe (int dev, int pipe);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// close a USB device and free its entry
+//--------------------------------------------------------------------
+void usb_close_dev (int dev);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// sort new USB devices by serial number and assign free pipes
+// a device gets back the pipe it had before if still free, otherwise
+// pipes never used by a device go first
 //
 // no return value
 //--------------------------------------------------------------------
@@ -182,11 +365,30 @@ void usb_sort_pipes ();
 
 //--------------------------------------------------------------------
 // attempt to discover new devices connected to the USB bus
-// sort devices by serial number for consistent mapping to spif pipes
+// devices already connected are left alone
+//
+// new devices are sorted by serial number for consistent
+// mapping to spif pipes
+//--------------------------------------------------------------------
+void usb_discover_devs (void);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// detach a disconnected USB device from its pipe and close it
+// the listeners of other pipes are left alone
+//--------------------------------------------------------------------
+void usb_detach_dev (int dev);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// release a USB device that failed to start and give its pipe back
+// to UDP input - the device is closed
 //
-// discon_dev = known disconnected USB device, -1 for unknown
+// the device is not looked for again until the next survey
 //--------------------------------------------------------------------
-void usb_discover_devs (int discon_dev);
+void usb_release_dev (int dev);
 //--------------------------------------------------------------------
 
 
@@ -194,7 +396,10 @@ void usb_discover_devs (int discon_dev);
 // survey USB devices
 // called at start up and on USB device connection and disconnection
 //
-// data = known disconnected USB device, -1 for unknown
+// only the pipes of connected or disconnected devices are affected,
+// the listeners of the other pipes keep running
+//
+// data = disconnected USB device, NULL or SPIFFER_USB_DISCOVER_CNT for unknown
 //
 // no return value
 //--------------------------------------------------------------------
@@ -246,6 +451,13 @@ int spif_pipes_init (void);
 //--------------------------------------------------------------------
 
 
+//--------------------------------------------------------------------
+// spif API used outside spiffer.cpp - defined in spif_remote.h
+//--------------------------------------------------------------------
+uint spif_get_buffer_size (uint pipe);
+//--------------------------------------------------------------------
+
+
 //--------------------------------------------------------------------
 // initialise system signal services
 //
@@ -269,7 +481,9 @@ void sig_term (int signum);
 //--------------------------------------------------------------------
 // service USR1 signal
 //
-// SIGUSR1 indicates that a USB device has been connected
+// SIGUSR1 requests a USB device survey
+//NOTE: USB camera connections are detected by the udev monitor,
+//      the signal is kept to force a survey by hand
 //
 // no return value
 //--------------------------------------------------------------------
@@ -277,4 +491,28 @@ void sig_usr1 (int signum);
 //--------------------------------------------------------------------
 
 
+//--------------------------------------------------------------------
+// service USR2 signal
+//
+// SIGUSR2 requests a statistics report
+//
+// no return value
+//--------------------------------------------------------------------
+void sig_usr2 (int signum);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// service HUP signal
+//
+// SIGHUP requests camera sensor settings to be re-read from the
+// configuration file - applied to cameras while they run
+//NOTE: the file is read by the main thread, not in the signal handler
+//
+// no return value
+//--------------------------------------------------------------------
+void sig_hup (int signum);
+//--------------------------------------------------------------------
+
+
 #endif /* __SPIFFER_H__ */
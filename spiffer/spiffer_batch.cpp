@@ -0,0 +1,295 @@
+//************************************************//
+//*                                              *//
+//*       spiffer deadline-bounded batching      *//
+//*                                              *//
+//* events are sent to spif when a batch reaches *//
+//* its size threshold or its deadline expires,  *//
+//* whichever comes first                        *//
+//*                                              *//
+//************************************************//
+
+#include <cstdio>
+#include <cstring>
+
+#include "spiffer_batch.h"
+#include "spiffer_config.h"
+#include "spiffer_filter.h"
+#include "spiffer_rate.h"
+#include "spiffer_route.h"
+
+// global variables
+// spif pipes
+extern pipe_ctx_t * pipe_ctx;
+
+// spiffer configuration
+extern spiffer_cfg_t cfg;
+
+// log file
+extern FILE * lf;
+
+// per-pipe batch state
+batch_t batch[SPIFFER_PIPES_MAX];
+
+
+//--------------------------------------------------------------------
+// start batching on a single pipe
+//--------------------------------------------------------------------
+static void batch_start (int pipe) {
+  batch_t * bt = &batch[pipe];
+
+  bt->slot = 0;
+  bt->buf  = spiffer_in_slot (pipe, 0);
+  bt->cnt  = 0;
+  bt->cap  = pipe_ctx[pipe].in_slot_size / sizeof (uint);
+
+  // a size threshold of 0 (or too large) means "send when slot full"
+  bt->size = cfg.pipe[pipe].batch_size;
+  if ((bt->size == 0) || (bt->size > bt->cap)) {
+    bt->size = bt->cap;
+  }
+
+  bt->delay = (uint64_t) cfg.pipe[pipe].batch_delay * 1000;
+
+  spiffer_filter_start (pipe);
+  spiffer_rate_start (pipe);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// send the current batch of a single pipe to spif - if not empty
+//--------------------------------------------------------------------
+static void batch_send (int pipe) {
+  batch_t * bt = &batch[pipe];
+
+  if (bt->cnt == 0) {
+    return;
+  }
+
+  // trigger a transfer to SpiNNaker,
+  spiffer_in_transfer (pipe, bt->slot, bt->cnt * sizeof (uint));
+
+  // update statistics,
+  int bin = 31 - __builtin_clz (bt->cnt);
+  if (bin >= SPIFFER_BATCH_HIST_BINS) {
+    bin = SPIFFER_BATCH_HIST_BINS - 1;
+  }
+  bt->hist[bin]++;
+  bt->evts += bt->cnt;
+
+  // and move on to the next slot
+  bt->slot = (bt->slot + 1) % pipe_ctx[pipe].in_slot_num;
+  bt->buf  = spiffer_in_slot (pipe, bt->slot);
+  bt->cnt  = 0;
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// start batching on a pipe - and on the pipes it routes events to
+// batch thresholds are taken from the pipe configuration
+//
+// called by every input listener before it produces events
+//--------------------------------------------------------------------
+void spiffer_batch_start (int pipe) {
+  uint pipes = spiffer_route_pipes (pipe);
+  for (int p = 0; p < SPIFFER_PIPES_MAX; p++) {
+    if (pipes & (1u << p)) {
+      batch_start (p);
+    }
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// add events already copied to the current batch
+//
+// sends the batch if the size threshold is reached
+//--------------------------------------------------------------------
+void spiffer_batch_commit (int pipe, uint evts) {
+  batch_t * bt = &batch[pipe];
+
+  if (evts == 0) {
+    return;
+  }
+
+  // the first event in a batch sets the deadline
+  if (bt->cnt == 0) {
+    bt->deadline = spiffer_batch_now () + bt->delay;
+  }
+
+  bt->cnt += evts;
+
+  if (bt->cnt >= bt->size) {
+    bt->sent_size++;
+    batch_send (pipe);
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// copy events to the current batch of the pipe they are routed to
+//
+// events are spread across pipes first - if routed - and then go
+// through the processing stages (e.g., filters) of their pipe,
+// which may drop and compact them in place
+//
+// sends batches as they reach the size threshold
+//--------------------------------------------------------------------
+void spiffer_batch_add (int pipe, uint * evts, uint num) {
+  if (spiffer_route_active (pipe)) {
+    spiffer_route_apply (pipe, evts, num);
+  } else {
+    spiffer_batch_put (pipe, evts, num);
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// copy events to the current batch of a pipe - no routing
+//
+// events go through the processing stages (e.g., filters) first,
+// which may drop and compact them in place
+//
+// sends batches as they reach the size threshold
+//--------------------------------------------------------------------
+void spiffer_batch_put (int pipe, uint * evts, uint num) {
+  batch_t * bt = &batch[pipe];
+
+  // drop unwanted events before they use DMA and link bandwidth,
+  num = spiffer_filter_apply (pipe, evts, num);
+
+  // and shed events over the rate limit
+  num = spiffer_rate_apply (pipe, evts, num);
+
+  while (num != 0) {
+    // fill the batch up to its size threshold,
+    uint room = bt->size - bt->cnt;
+    uint cn   = (num < room) ? num : room;
+
+    memcpy (bt->buf + bt->cnt, evts, cn * sizeof (uint));
+
+    // and let commit send it when full
+    spiffer_batch_commit (pipe, cn);
+
+    evts += cn;
+    num  -= cn;
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// send the current batches of a pipe and its routed pipes to spif
+// - if not empty
+//--------------------------------------------------------------------
+void spiffer_batch_send (int pipe) {
+  uint pipes = spiffer_route_pipes (pipe);
+  for (int p = 0; p < SPIFFER_PIPES_MAX; p++) {
+    if (pipes & (1u << p)) {
+      batch_send (p);
+    }
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// send the current batches of a pipe and its routed pipes
+// if their deadline has expired
+//
+// called by input listeners after every read from their source
+//--------------------------------------------------------------------
+void spiffer_batch_poll (int pipe) {
+  uint     pipes = spiffer_route_pipes (pipe);
+  uint64_t now   = 0;
+
+  for (int p = 0; p < SPIFFER_PIPES_MAX; p++) {
+    batch_t * bt = &batch[p];
+
+    if (!(pipes & (1u << p)) || (bt->cnt == 0)) {
+      continue;
+    }
+
+    // read the clock only if needed - and only once
+    if ((bt->delay != 0) && (now == 0)) {
+      now = spiffer_batch_now ();
+    }
+
+    if ((bt->delay == 0) || (now >= bt->deadline)) {
+      bt->sent_time++;
+      batch_send (p);
+    }
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// get time left until the earliest deadline of the current batches
+// of a pipe and its routed pipes
+//
+// returns NULL if all batches are empty - no deadline
+//--------------------------------------------------------------------
+struct timespec * spiffer_batch_timeout (int pipe, struct timespec * ts) {
+  uint     pipes    = spiffer_route_pipes (pipe);
+  bool     pending  = false;
+  uint64_t deadline = UINT64_MAX;
+
+  for (int p = 0; p < SPIFFER_PIPES_MAX; p++) {
+    batch_t * bt = &batch[p];
+
+    if ((pipes & (1u << p)) && (bt->cnt != 0)) {
+      pending  = true;
+      deadline = (bt->deadline < deadline) ? bt->deadline : deadline;
+    }
+  }
+
+  if (!pending) {
+    return (NULL);
+  }
+
+  uint64_t now  = spiffer_batch_now ();
+  uint64_t left = (deadline > now) ? deadline - now : 0;
+
+  ts->tv_sec  = left / 1000000000;
+  ts->tv_nsec = left % 1000000000;
+
+  return (ts);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// report batch statistics to the log file
+//--------------------------------------------------------------------
+void spiffer_batch_report (int pipe) {
+  batch_t * bt = &batch[pipe];
+
+  uint64_t sent = bt->sent_size + bt->sent_time;
+
+  log_time ();
+  fprintf (lf, "pipe%i batches: %llu (size %llu / deadline %llu) events: %llu mean: %.1f\n",
+           pipe,
+           (unsigned long long) sent,
+           (unsigned long long) bt->sent_size,
+           (unsigned long long) bt->sent_time,
+           (unsigned long long) bt->evts,
+           sent ? (double) bt->evts / sent : 0.0
+           );
+
+  // batch size distribution - skip empty bins
+  log_time ();
+  fprintf (lf, "pipe%i batch sizes:", pipe);
+  for (int i = 0; i < SPIFFER_BATCH_HIST_BINS; i++) {
+    if (bt->hist[i] != 0) {
+      fprintf (lf, " [%u-%u]: %llu", 1u << i, (2u << i) - 1,
+               (unsigned long long) bt->hist[i]);
+    }
+  }
+  fprintf (lf, "\n");
+}
+//--------------------------------------------------------------------
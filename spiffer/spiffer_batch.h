@@ -0,0 +1,131 @@
+//************************************************//
+//*                                              *//
+//*       spiffer deadline-bounded batching      *//
+//*                                              *//
+//************************************************//
+
+#ifndef __SPIFFER_BATCH_H__
+#define __SPIFFER_BATCH_H__
+
+
+#include <cstdint>
+#include <ctime>
+
+#include <sys/types.h>
+
+// spif and spiffer constants and function prototypes
+#include "spif.h"
+#include "spiffer.h"
+
+// batch size distribution - one bin per power of 2
+#define SPIFFER_BATCH_HIST_BINS  20
+
+// per-pipe batch state
+typedef struct alignas (SPIFFER_CACHE_LINE) batch {
+  int      slot;                                // input slot being filled
+  uint *   buf;                                 // input slot address
+  uint     cnt;                                 // events in batch
+  uint     cap;                                 // slot capacity (events)
+  uint     size;                                // send when reached (events)
+  uint64_t delay;                               // send when batch this old (ns)
+  uint64_t deadline;                            // send batch at this time (ns)
+
+  // statistics
+  uint64_t sent_size;                           // batches sent on size
+  uint64_t sent_time;                           // batches sent on deadline
+  uint64_t evts;                                // events sent
+  uint64_t hist[SPIFFER_BATCH_HIST_BINS];       // batch size distribution
+} batch_t;
+
+
+//--------------------------------------------------------------------
+// get current time (in ns) from the monotonic clock
+//--------------------------------------------------------------------
+inline uint64_t spiffer_batch_now (void) {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ((uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// start batching on a pipe - and on the pipes it routes events to
+// batch thresholds are taken from the pipe configuration
+//
+// called by every input listener before it produces events
+//--------------------------------------------------------------------
+void spiffer_batch_start (int pipe);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// add events already copied to the current batch
+//
+// sends the batch if the size threshold is reached
+//--------------------------------------------------------------------
+void spiffer_batch_commit (int pipe, uint evts);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// copy events to the current batch of the pipe they are routed to
+//
+// events are spread across pipes first - if routed - and then go
+// through the processing stages (e.g., filters) of their pipe,
+// which may drop and compact them in place
+//
+// sends batches as they reach the size threshold
+//--------------------------------------------------------------------
+void spiffer_batch_add (int pipe, uint * evts, uint num);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// copy events to the current batch of a pipe - no routing
+//
+// events go through the processing stages (e.g., filters) first,
+// which may drop and compact them in place
+//
+// sends batches as they reach the size threshold
+//--------------------------------------------------------------------
+void spiffer_batch_put (int pipe, uint * evts, uint num);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// send the current batches of a pipe and its routed pipes to spif
+// - if not empty
+//--------------------------------------------------------------------
+void spiffer_batch_send (int pipe);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// send the current batches of a pipe and its routed pipes
+// if their deadline has expired
+//
+// called by input listeners after every read from their source
+//--------------------------------------------------------------------
+void spiffer_batch_poll (int pipe);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// get time left until the earliest deadline of the current batches
+// of a pipe and its routed pipes
+//
+// returns NULL if all batches are empty - no deadline
+//--------------------------------------------------------------------
+struct timespec * spiffer_batch_timeout (int pipe, struct timespec * ts);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// report batch statistics to the log file
+//--------------------------------------------------------------------
+void spiffer_batch_report (int pipe);
+//--------------------------------------------------------------------
+
+
+#endif /* __SPIFFER_BATCH_H__ */
@@ -4,30 +4,38 @@
 //*                                              *//
 //* lap - 11/08/2023                             *//
 //*                                              *//
+//* built as a camera plugin - spiffer_caer.so   *//
+//*                                              *//
 //************************************************//
 
-#include <pthread.h>
-#include "spiffer_caer_support.h"
+#include <unistd.h>
 
-// global variables
-// spif pipes
-extern uint * pipe_buf[SPIF_HW_PIPES_NUM];
+#include "spiffer_caer_support.h"
 
-// used to pass integers as (void *)
-extern int dev_to_ptr[SPIFFER_USB_DISCOVER_CNT + 1];
+// spiffer services
+static const plugin_host_t * host;
 
-// USB devices
-extern usb_devs_t      usb_devs;
-extern pthread_mutex_t usb_mtx;
+// cameras opened by discovery - not yet taken by spiffer
+static caer_dev_t * pending[SPIFFER_CAER_PENDING_MAX];
 
-// log file
-extern FILE * lf;
+// DAVIS sensor biases that control the event rate
+static const caer_bias_t caer_biases[] = {
+  {"diff", DAVIS240_CONFIG_BIAS_DIFFBN, DAVIS346_CONFIG_BIAS_DIFFBN},   // threshold reference
+  {"on",   DAVIS240_CONFIG_BIAS_ONBN,   DAVIS346_CONFIG_BIAS_ONBN},     // ON threshold
+  {"off",  DAVIS240_CONFIG_BIAS_OFFBN,  DAVIS346_CONFIG_BIAS_OFFBN},    // OFF threshold
+  {"refr", DAVIS240_CONFIG_BIAS_REFRBP, DAVIS346_CONFIG_BIAS_REFRBP},   // refractory period
+  {"pr",   DAVIS240_CONFIG_BIAS_PRBP,   DAVIS346_CONFIG_BIAS_PRBP},     // photoreceptor
+  {"prsf", DAVIS240_CONFIG_BIAS_PRSFBP, DAVIS346_CONFIG_BIAS_PRSFBP}    // photoreceptor follower
+};
 
 
 //--------------------------------------------------------------------
 // include here any libcaer initialisation
 //--------------------------------------------------------------------
-void spiffer_caer_init (void) {
+static int caer_init (const plugin_host_t * hst) {
+  host = hst;
+
+  return (SPIFFER_OK);
 }
 //--------------------------------------------------------------------
 
@@ -37,13 +45,11 @@ void spiffer_caer_init (void) {
 //
 // returns SPIFFER_OK on success or SPIFFER_ERROR on error
 //--------------------------------------------------------------------
-int spiffer_caer_config_dev (caerDeviceHandle dh) {
+static int caer_config_dev (caerDeviceHandle dh) {
   // send the default configuration before using the device
   bool rc = caerDeviceSendDefaultConfig (dh);
   if (!rc) {
-    log_time ();
-    fprintf (lf, "error: failed to send camera default configuration\n");
-    (void) fflush (lf);
+    host->log ("error: failed to send camera default configuration");
     return (SPIFFER_ERROR);
   }
 
@@ -53,18 +59,14 @@ int spiffer_caer_config_dev (caerDeviceHandle dh) {
                             SPIFFER_USB_EVTS_PER_PKT
                             );
   if (!rc) {
-    log_time ();
-    fprintf (lf, "error: failed to set camera container packet size\n");
-    (void) fflush (lf);
+    host->log ("error: failed to set camera container packet size");
     return (SPIFFER_ERROR);
   }
 
-  // set event reception to blocking mode
-  rc = caerDeviceConfigSet (dh, CAER_HOST_CONFIG_DATAEXCHANGE, CAER_HOST_CONFIG_DATAEXCHANGE_BLOCKING, true);
+  // set event reception to non-blocking mode - batches must return regularly
+  rc = caerDeviceConfigSet (dh, CAER_HOST_CONFIG_DATAEXCHANGE, CAER_HOST_CONFIG_DATAEXCHANGE_BLOCKING, false);
   if (!rc) {
-    log_time ();
-    fprintf (lf, "error: failed to set blocking mode\n");
-    (void) fflush (lf);
+    host->log ("error: failed to set non-blocking mode");
     return (SPIFFER_ERROR);
   }
 
@@ -74,25 +76,52 @@ int spiffer_caer_config_dev (caerDeviceHandle dh) {
 
 
 //--------------------------------------------------------------------
-// attempt to discover, open and configure cameras supported by libcaer
+// stop and close a camera
+//--------------------------------------------------------------------
+static void caer_close (void * dev) {
+  caer_dev_t * cd = (caer_dev_t *) dev;
+
+  if (cd->started) {
+    (void) caerDeviceDataStop (cd->dh);
+  }
+
+  if (cd->pc != NULL) {
+    caerEventPacketContainerFree (cd->pc);
+  }
+
+  (void) caerDeviceClose (&cd->dh);
+  delete cd;
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// find cameras supported by libcaer
+// cameras are opened and configured here and handed over by caer_open
+//
+// returns the number of ids
 //--------------------------------------------------------------------
-void spiffer_caer_discover_devs (void) {
-  if (!SPIFFER_USB_MIX_CAMERAS && (usb_devs.cnt != 0)) {
-    log_time ();
-    fprintf (lf, "warning: Inivation discovery cancelled - camera mixing disallowed\n");
-    (void) fflush (lf);
-    return;
+static int caer_discover (char (* ids)[SPIFFER_PLUGIN_ID_SIZE], int max) {
+  // cameras not taken by spiffer last time are closed,
+  for (int i = 0; i < SPIFFER_CAER_PENDING_MAX; i++) {
+    if (pending[i] != NULL) {
+      caer_close (pending[i]);
+      pending[i] = NULL;
+    }
   }
 
-  // number of discovered devices
-  int ndd = 0;
+  if (max > SPIFFER_CAER_PENDING_MAX) {
+    max = SPIFFER_CAER_PENDING_MAX;
+  }
 
   // discover devices by trying to open them
-  //NOTE: caerDeviceDiscover causes problems when camerasare connected/disconnected.
-  while (usb_devs.cnt < SPIFFER_CAER_DISCOVER_CNT) {
+  //NOTE: caerDeviceDiscover causes problems when cameras are connected/disconnected.
+  //NOTE: cameras already open are not found again
+  int num = 0;
+  for (int tries = 0; (num < max) && (tries < max); tries++) {
     // try to open a new device and give it a device ID,
     //TODO: update for other device types
-    caerDeviceHandle dh = caerDeviceOpen (ndd + 1, CAER_DEVICE_DAVIS, 0, 0, NULL);
+    caerDeviceHandle dh = caerDeviceOpen (tries + 1, CAER_DEVICE_DAVIS, 0, 0, NULL);
     if (dh == NULL) {
       // no more devices available
       break;
@@ -102,40 +131,98 @@ void spiffer_caer_discover_devs (void) {
     struct caer_davis_info davis_info = caerDavisInfoGet (dh);
 
     // configure device
-    if (spiffer_caer_config_dev (dh) == SPIFFER_ERROR) {
+    if (caer_config_dev (dh) == SPIFFER_ERROR) {
       // on error close device
       (void) caerDeviceClose (&dh);
 
-      log_time ();
-      fprintf (lf, "warning: cannot configure device: %s\n", davis_info.deviceString);
+      host->log ("warning: cannot configure device: %s", davis_info.deviceString);
 
       // and move on to the next one
       continue;
     }
 
-    // report camera info
-    log_time ();
-    fprintf (lf, "%s\n", davis_info.deviceString);
+    caer_dev_t * cd = new caer_dev_t ();
+    cd->dh   = dh;
+    cd->info = davis_info;
+    (void) snprintf (cd->id, sizeof (cd->id), "%s", davis_info.deviceString);
 
-    // remember device type
-    usb_devs.params[usb_devs.cnt].type = CAER;
+    // the id names the camera - it contains its serial number
+    (void) snprintf (ids[num], SPIFFER_PLUGIN_ID_SIZE, "%s", cd->id);
+    pending[num++] = cd;
+  }
 
-    // remember device serial number
-    (void) strcpy (usb_devs.params[usb_devs.cnt].sn, davis_info.deviceSerialNumber);
+  return (num);
+}
+//--------------------------------------------------------------------
 
-    // remember device handle
-    usb_devs.params[usb_devs.cnt].caer_hdl = dh;
 
-    // update device count
-    usb_devs.cnt++;
-    ndd++;
+//--------------------------------------------------------------------
+// take a camera opened by discovery
+//
+// returns the camera or NULL if not found
+//--------------------------------------------------------------------
+static void * caer_open (const char * id) {
+  for (int i = 0; i < SPIFFER_CAER_PENDING_MAX; i++) {
+    if ((pending[i] != NULL) && (strcmp (pending[i]->id, id) == 0)) {
+      caer_dev_t * cd = pending[i];
+      pending[i] = NULL;
+      return (cd);
+    }
   }
 
-  log_time ();
-  fprintf (lf, "discovered %i Inivation device%c\n", ndd, ndd == 1 ? ' ' : 's');
-  (void) fflush (lf);
+  return (NULL);
+}
+//--------------------------------------------------------------------
 
-  return;
+
+//--------------------------------------------------------------------
+// get the serial number of a camera
+//--------------------------------------------------------------------
+static int caer_serial (void * dev, char * sn, size_t size) {
+  (void) snprintf (sn, size, "%s", ((caer_dev_t *) dev)->info.deviceSerialNumber);
+
+  return (SPIFFER_OK);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// called by libcaer when a camera is disconnected
+//--------------------------------------------------------------------
+static void caer_gone (void * data) {
+  ((caer_dev_t *) data)->gone = true;
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// start camera event transmission
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+static int caer_start (void * dev, const plugin_start_t * ps, uint * width, uint * height,
+                       char * info, size_t size) {
+  caer_dev_t * cd = (caer_dev_t *) dev;
+
+  // deliver event containers at least as often as the batch deadline
+  if (ps->batch_delay != 0) {
+    (void) caerDeviceConfigSet (cd->dh, CAER_HOST_CONFIG_PACKETS,
+                                CAER_HOST_CONFIG_PACKETS_MAX_CONTAINER_INTERVAL,
+                                ps->batch_delay
+                                );
+  }
+
+  // turn on camera event transmission
+  if (!caerDeviceDataStart (cd->dh, NULL, NULL, NULL, &caer_gone, cd)) {
+    return (SPIFFER_ERROR);
+  }
+  cd->started = true;
+
+  *width  = cd->info.dvsSizeX;
+  *height = cd->info.dvsSizeY;
+  (void) snprintf (info, size, "libcaer");
+
+  return (SPIFFER_OK);
 }
 //--------------------------------------------------------------------
 
@@ -149,123 +236,155 @@ void spiffer_caer_discover_devs (void) {
 //    [15] polarity
 //  [14:0] 15-bit y coordinate
 //
-// timestamps are ignored - time models itself
+// timestamps are only used to process events (e.g., denoising)
+// and are not forwarded - time models itself
+//
+// a camera read (event packet container) may take several batches
 //
-// returns the number of events in the batch
+// returns SPIFFER_OK on success or SPIFFER_ERROR if disconnected
 //--------------------------------------------------------------------
-int spiffer_caer_get_events (caerDeviceHandle dev, uint * buf) {
-  // keep track of the number of valid events received
-  uint evt_num = 0;
-
-  while (1) {
-    // this is a safe place to cancel this thread
-    pthread_testcancel ();
+static int caer_fill_batch (void * dev, plugin_batch_t * batch) {
+  caer_dev_t * cd = (caer_dev_t *) dev;
+
+  // get events from USB device - if none left from the last read,
+  if (cd->pc == NULL) {
+    cd->pc = caerDeviceDataGet (cd->dh);
+    if (cd->pc == NULL) {
+      if (cd->gone) {
+        return (SPIFFER_ERROR);
+      }
 
-    // get events from USB device
-    caerEventPacketContainer packetContainer = caerDeviceDataGet (dev);
-    if (packetContainer == NULL) {
-      continue;
+      // camera idle - send queued events and wait a little
+      batch->end = true;
+      usleep (SPIFFER_CAER_IDLE_WAIT);
+      return (SPIFFER_OK);
     }
 
     // only interested in 'polarity' events
-    caerPolarityEventPacket polarity_packet = (caerPolarityEventPacket)
-      caerEventPacketContainerGetEventPacket (packetContainer, POLARITY_EVENT);
-
-    if (polarity_packet == NULL) {
-      // release packet container
-      caerEventPacketContainerFree (packetContainer);
-      continue;
-    }
-
-    // process all events in the packet
-    uint evts_in_pkt = caerEventPacketHeaderGetEventNumber(&(polarity_packet)->packetHeader);
-    for (uint i = 0; i < evts_in_pkt; i++) {
-      // get event polarity and coordinates
-      caerPolarityEventConst event = caerPolarityEventPacketGetEventConst (polarity_packet, i);
-      if (!caerPolarityEventIsValid (event)) {
-        continue;
-      }
+    cd->pp = (caerPolarityEventPacket)
+      caerEventPacketContainerGetEventPacket (cd->pc, POLARITY_EVENT);
+    cd->next = 0;
+  }
 
-      bool     pol = caerPolarityEventGetPolarity (event);
-      uint16_t x   = caerPolarityEventGetX (event);
-      uint16_t y   = caerPolarityEventGetY (event);
+  // convert events straight into the batch,
+  uint evts_in_pkt = 0;
+  if (cd->pp != NULL) {
+    evts_in_pkt = caerEventPacketHeaderGetEventNumber (&(cd->pp)->packetHeader);
 
-      // format event and store in buffer
-      buf[evt_num++] = SPIFFER_EVT_NO_TS | (x << SPIFFER_EVT_X_SHIFT) | (pol << SPIFFER_EVT_P_SHIFT) | (y << SPIFFER_EVT_Y_SHIFT);
+    uint num = evts_in_pkt - cd->next;
+    if (num > batch->cap) {
+      num = batch->cap;
     }
 
-    // release packet container
-    caerEventPacketContainerFree (packetContainer);
+    batch->num = spiffer_caer_convert (&cd->pp->events[cd->next], num, batch->evts, batch->ts);
+    cd->next += num;
+  }
 
-    if (evt_num) {
-      return (evt_num);
-    }
+  // and release the packet container once done - the container is the camera read
+  if (cd->next >= evts_in_pkt) {
+    caerEventPacketContainerFree (cd->pc);
+    cd->pc     = NULL;
+    batch->end = true;
   }
+
+  return (SPIFFER_OK);
 }
 //--------------------------------------------------------------------
 
 
 //--------------------------------------------------------------------
-// receive events from a USB device and forward them to spif
-//
-// terminated as a result of signal servicing
+// apply sensor settings to a camera - region of interest and biases
+// settings the camera does not support are reported and skipped
 //--------------------------------------------------------------------
-void * spiffer_caer_usb_listener (void * data) {
-  int dev  = *((int *) data);
-  int pipe = usb_devs.params[dev].pipe;
+static void caer_sensor (void * dev, int pipe, const sensor_cfg_t * sc) {
+  caerDeviceHandle       ud         = ((caer_dev_t *) dev)->dh;
+  struct caer_davis_info davis_info = ((caer_dev_t *) dev)->info;
 
-  // block signals - should be handled in a different thread
-  sigset_t set;
-  sigfillset (&set);
-  sigprocmask (SIG_BLOCK, &set, NULL);
+  // Prophesee-only settings,
+  if (sc->erc_set || sc->flicker_set) {
+    host->log ("warning: pipe%i camera has no event rate controller or anti-flicker filter", pipe);
+  }
 
-  uint *           sb = pipe_buf[pipe];
-  caerDeviceHandle ud = usb_devs.params[dev].caer_hdl;
+  // region of interest - whole sensor if off,
+  if (sc->roi_set) {
+    uint x0 = 0;
+    uint y0 = 0;
+    uint x1 = davis_info.dvsSizeX - 1;
+    uint y1 = davis_info.dvsSizeY - 1;
+    if ((sc->roi_w != 0) && (sc->roi_h != 0)) {
+      x0 = sc->roi_x;
+      y0 = sc->roi_y;
+      x1 = sc->roi_x + sc->roi_w - 1;
+      y1 = sc->roi_y + sc->roi_h - 1;
+    }
 
-  // turn on camera event transmission
-  bool rc = caerDeviceDataStart (ud, NULL, NULL, NULL, &usb_survey_devs, data);
-  if (!rc) {
-    log_time ();
-    fprintf (lf, "error: failed to start camera event transmission\n");
-    (void) fflush (lf);
+    bool rc = caerDeviceConfigSet (ud, DAVIS_CONFIG_DVS, DAVIS_CONFIG_DVS_FILTER_ROI_START_COLUMN, x0) &&
+              caerDeviceConfigSet (ud, DAVIS_CONFIG_DVS, DAVIS_CONFIG_DVS_FILTER_ROI_START_ROW, y0) &&
+              caerDeviceConfigSet (ud, DAVIS_CONFIG_DVS, DAVIS_CONFIG_DVS_FILTER_ROI_END_COLUMN, x1) &&
+              caerDeviceConfigSet (ud, DAVIS_CONFIG_DVS, DAVIS_CONFIG_DVS_FILTER_ROI_END_ROW, y1);
 
-    return (nullptr);
+    if (!rc) {
+      host->log ("warning: pipe%i sensor region of interest rejected", pipe);
+    } else {
+      host->log ("pipe%i sensor: region of interest (%u, %u) to (%u, %u)", pipe, x0, y0, x1, y1);
+    }
   }
 
-  log_time ();
-  fprintf (lf, "listening USB %s -> pipe%i\n", usb_devs.params[dev].sn, pipe);
-  (void) fflush (lf);
-
-  while (1) {
-    // get next batch of events
-    //NOTE: blocks until events are available
-    int rcv_bytes = spiffer_caer_get_events (ud, sb);
-
-    // trigger a transfer to SpiNNaker
-    spif_transfer (pipe, rcv_bytes);
-
-    // wait until spif finishes the current transfer
-    //NOTE: report when waiting too long!
-    int wc = 0;
-    while (spif_busy (pipe)) {
-      wc++;
-      if (wc < 0) {
-        log_time ();
-        fprintf (lf, "warning: spif not responding\n");
-        (void) fflush (lf);
-        wc = 0;
+  // and biases - coarse and fine values, the rest as they are
+  for (uint b = 0; b < sc->bias_num; b++) {
+    const sensor_bias_t * sb = &sc->bias[b];
+
+    const caer_bias_t * cb = NULL;
+    for (size_t i = 0; i < (sizeof (caer_biases) / sizeof (caer_biases[0])); i++) {
+      if (strcmp (caer_biases[i].name, sb->name) == 0) {
+        cb = &caer_biases[i];
+        break;
       }
     }
+
+    if ((cb == NULL) || (sb->fine < 0)) {
+      host->log ("warning: pipe%i sensor bias %s needs a known name and coarse and fine values", pipe, sb->name);
+      continue;
+    }
+
+    uint8_t  addr = IS_DAVIS240 (davis_info.chipID) ? cb->davis240 : cb->davis346;
+    uint32_t val;
+    bool     rc   = caerDeviceConfigGet (ud, DAVIS_CONFIG_BIAS, addr, &val);
+    if (rc) {
+      struct caer_bias_coarsefine cf = caerBiasCoarseFineParse ((uint16_t) val);
+      cf.coarseValue = (uint8_t) sb->value;
+      cf.fineValue   = (uint8_t) sb->fine;
+      rc = caerDeviceConfigSet (ud, DAVIS_CONFIG_BIAS, addr, caerBiasCoarseFineGenerate (cf));
+    }
+
+    if (!rc) {
+      host->log ("warning: pipe%i sensor bias %s rejected", pipe, sb->name);
+    } else {
+      host->log ("pipe%i sensor: bias %s coarse %i fine %i", pipe, sb->name, sb->value, sb->fine);
+    }
   }
 }
 //--------------------------------------------------------------------
 
 
+// libcaer camera plugin
+static const spiffer_plugin_t caer_plugin = {
+  SPIFFER_PLUGIN_ABI,
+  caer_init,
+  caer_discover,
+  caer_open,
+  caer_serial,
+  caer_start,
+  caer_fill_batch,
+  caer_sensor,
+  caer_close
+};
+
+
 //--------------------------------------------------------------------
-// shutdown device
+// plugin entry point
 //--------------------------------------------------------------------
-void spiffer_caer_shutdown_dev (int dev) {
-  (void) caerDeviceDataStop (usb_devs.params[dev].caer_hdl);
-  (void) caerDeviceClose (&usb_devs.params[dev].caer_hdl);
+extern "C" const spiffer_plugin_t * spiffer_plugin_get (void) {
+  return (&caer_plugin);
 }
 //--------------------------------------------------------------------
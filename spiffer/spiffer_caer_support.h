@@ -12,74 +12,113 @@
 
 #include <libcaer/libcaer.h>
 #include <libcaer/devices/davis.h>
-#include <libcaer/devices/device_discover.h>
 
-#include <unistd.h>
-#include <signal.h>
+#include <atomic>
+#include <cstring>
 
 // spif and spiffer constants and function prototypes
 #include "spif.h"
 #include "spiffer.h"
 
-#define SPIFFER_CAER_DISCOVER_CNT  SPIFFER_USB_DISCOVER_CNT
+// spiffer camera plugin interface
+#include "spiffer_plugin.h"
 
-int spif_busy (uint pipe);
-int spif_transfer (uint pipe, int length);
+// cameras opened by discovery and waiting for spiffer to take them
+#define SPIFFER_CAER_PENDING_MAX  SPIFFER_PLUGIN_IDS_MAX
 
+// wait for events when the camera is idle (us)
+#define SPIFFER_CAER_IDLE_WAIT    1000
 
-//--------------------------------------------------------------------
-// include here any libcaer initialisation
-//--------------------------------------------------------------------
-void spiffer_caer_init (void);
-//--------------------------------------------------------------------
+// events are converted 4 at a time
+//NOTE: maps to NEON on ARM and SSE on x86
+typedef uint caer_v4u __attribute__ ((vector_size (16)));
 
+// DAVIS sensor biases that can be set - by name
+typedef struct caer_bias {
+  const char * name;
+  uint8_t      davis240;        // bias address on DAVIS240 chips
+  uint8_t      davis346;        // bias address on DAVIS346 and later chips
+} caer_bias_t;
 
-//--------------------------------------------------------------------
-// attempt to configure a camera supported by libcaer
-//
-// returns SPIFFER_OK on success or SPIFFER_ERROR on error
-//--------------------------------------------------------------------
-int spiffer_caer_config_dev (int pipe, caerDeviceHandle dh);
-//--------------------------------------------------------------------
+// camera state
+typedef struct caer_dev {
+  caerDeviceHandle         dh;
+  struct caer_davis_info   info;
+  char                     id[SPIFFER_PLUGIN_ID_SIZE];
+  std::atomic<bool>        gone;      // camera disconnected
+  bool                     started;   // event transmission on
+  caerEventPacketContainer pc;        // camera read being converted - NULL: none
+  caerPolarityEventPacket  pp;
+  uint                     next;      // next event to convert
+} caer_dev_t;
 
 
 //--------------------------------------------------------------------
-// attempt to discover, open and configure cameras supported by libcaer
-//--------------------------------------------------------------------
-void spiffer_caer_discover_devs (void);
-//--------------------------------------------------------------------
-
-
-//--------------------------------------------------------------------
-// get a batch of events from USB device
-// map them to spif events with format:
-//
-//    [31] timestamp (0: present, 1: absent)
-// [30:16] 15-bit x coordinate
-//    [15] polarity
-//  [14:0] 15-bit y coordinate
+// convert libcaer polarity events to spif events - and timestamps
+// works directly on the packed event array, without the per-event
+// accessors, and drops invalid events
 //
-// timestamps are ignored - time models itself
+// buf and ts must have room for num entries
 //
-// returns the number of events in the batch
-//--------------------------------------------------------------------
-int spiffer_caer_get_events (caerDeviceHandle dev, uint * buf);
-//--------------------------------------------------------------------
-
-
-//--------------------------------------------------------------------
-// receive events from a USB device and forward them to spif
-//
-// terminated as a result of signal servicing
-//--------------------------------------------------------------------
-void * spiffer_caer_usb_listener (void * data);
-//--------------------------------------------------------------------
-
-
-//--------------------------------------------------------------------
-// shutdown device
-//--------------------------------------------------------------------
-void spiffer_caer_shutdown_dev (int dev);
+// returns the number of valid events
+//--------------------------------------------------------------------
+inline uint spiffer_caer_convert (const struct caer_polarity_event * evts, uint num,
+                                  uint * buf, uint * ts) {
+  //NOTE: events are (data, timestamp) pairs of little-endian words
+  const uint * src  = (const uint *) evts;
+  uint         kept = 0;
+  uint         i    = 0;
+
+  // convert 4 events at a time,
+  //NOTE: valid events are written back before being overwritten
+  for (; (i + 4) <= num; i += 4) {
+    caer_v4u lo;
+    caer_v4u hi;
+    memcpy (&lo, src + 2 * i, sizeof (lo));
+    memcpy (&hi, src + 2 * i + 4, sizeof (hi));
+
+    // separate event data from timestamps,
+    caer_v4u d = __builtin_shuffle (lo, hi, (caer_v4u) {0, 2, 4, 6});
+    caer_v4u t = __builtin_shuffle (lo, hi, (caer_v4u) {1, 3, 5, 7});
+
+    // map fields to spif format,
+    caer_v4u e = SPIFFER_EVT_NO_TS |
+      (((d >> POLARITY_X_ADDR_SHIFT) & POLARITY_X_ADDR_MASK) << SPIFFER_EVT_X_SHIFT) |
+      (((d >> POLARITY_SHIFT) & POLARITY_MASK) << SPIFFER_EVT_P_SHIFT) |
+      (((d >> POLARITY_Y_ADDR_SHIFT) & POLARITY_Y_ADDR_MASK) << SPIFFER_EVT_Y_SHIFT);
+
+    caer_v4u v = (d >> VALID_MARK_SHIFT) & VALID_MARK_MASK;
+
+    // store them all at once - the common case,
+    if (v[0] & v[1] & v[2] & v[3]) {
+      memcpy (buf + kept, &e, sizeof (e));
+      memcpy (ts + kept, &t, sizeof (t));
+      kept += 4;
+      continue;
+    }
+
+    // or compact valid events without branches
+    for (int k = 0; k < 4; k++) {
+      buf[kept] = e[k];
+      ts[kept]  = t[k];
+      kept += v[k];
+    }
+  }
+
+  // and then the remaining events one at a time
+  for (; i < num; i++) {
+    uint d = src[2 * i];
+
+    buf[kept] = SPIFFER_EVT_NO_TS |
+      (((d >> POLARITY_X_ADDR_SHIFT) & POLARITY_X_ADDR_MASK) << SPIFFER_EVT_X_SHIFT) |
+      (((d >> POLARITY_SHIFT) & POLARITY_MASK) << SPIFFER_EVT_P_SHIFT) |
+      (((d >> POLARITY_Y_ADDR_SHIFT) & POLARITY_Y_ADDR_MASK) << SPIFFER_EVT_Y_SHIFT);
+    ts[kept]  = src[2 * i + 1];
+    kept += (d >> VALID_MARK_SHIFT) & VALID_MARK_MASK;
+  }
+
+  return (kept);
+}
 //--------------------------------------------------------------------
 
 
@@ -0,0 +1,649 @@
+//************************************************//
+//*                                              *//
+//*      spiffer camera event processing         *//
+//*                                              *//
+//* camera events can be cropped to a region of  *//
+//* interest, filtered (hot pixels, refractory   *//
+//* period, background activity) and downsampled *//
+//* by 2^n - optionally pooling events in every  *//
+//* cell - before they are sent to spif          *//
+//*                                              *//
+//************************************************//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sched.h>
+
+#include "spiffer_camera.h"
+#include "spiffer_batch.h"
+#include "spiffer_config.h"
+
+// global variables
+// spiffer configuration
+extern spiffer_cfg_t cfg;
+
+// log file
+extern FILE * lf;
+
+// per-pipe camera event processing state
+camera_t camera[SPIFFER_PIPES_MAX];
+
+
+//--------------------------------------------------------------------
+// set the region of interest of the camera on a pipe
+// arg has the form: <x> <y> <width> <height>
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_camera_crop (int pipe, const char * arg) {
+  uint val[4];
+
+  for (int i = 0; i < 4; i++) {
+    char * end;
+    val[i] = (uint) strtoul (arg, &end, 0);
+    if (end == arg) {
+      return (SPIFFER_ERROR);
+    }
+    arg = end;
+  }
+
+  if (*arg != '\0') {
+    return (SPIFFER_ERROR);
+  }
+
+  pipe_cfg_t * pc = &cfg.pipe[pipe];
+  pc->crop_x = val[0];
+  pc->crop_y = val[1];
+  pc->crop_w = val[2];
+  pc->crop_h = val[3];
+
+  return (SPIFFER_OK);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// set the hot pixel mask file of the camera on a pipe
+// the mask is loaded when the camera starts and saved when it is
+// replaced or spiffer stops
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_camera_mask_file (int pipe, const char * arg) {
+  if (*arg == '\0') {
+    return (SPIFFER_ERROR);
+  }
+
+  char * name = strdup (arg);
+  if (name == NULL) {
+    return (SPIFFER_ERROR);
+  }
+
+  free (cfg.pipe[pipe].hot_mask);
+  cfg.pipe[pipe].hot_mask = name;
+
+  return (SPIFFER_OK);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// load a hot pixel mask file
+// lines have the form: <x> <y>
+//
+// returns the number of masked pixels
+//--------------------------------------------------------------------
+static uint camera_mask_load (camera_t * cm, const char * name) {
+  FILE * mf = fopen (name, "r");
+  if (mf == NULL) {
+    return (0);
+  }
+
+  char line[SPIFFER_CFG_LINE_MAX];
+  uint num = 0;
+  while (fgets (line, sizeof (line), mf) != NULL) {
+    uint x, y;
+    if ((line[0] == '#') || (sscanf (line, "%u %u", &x, &y) != 2)) {
+      continue;
+    }
+
+    if ((x < cm->width) && (y < cm->height) && !cm->mask[y * cm->width + x]) {
+      cm->mask[y * cm->width + x] = 1;
+      num++;
+    }
+  }
+
+  fclose (mf);
+  return (num);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// save a hot pixel mask file
+// lines have the form: <x> <y>
+//--------------------------------------------------------------------
+static void camera_mask_save (camera_t * cm, const char * name) {
+  FILE * mf = fopen (name, "w");
+  if (mf == NULL) {
+    log_time ();
+    fprintf (lf, "warning: failed to save hot pixel mask %s\n", name);
+    return;
+  }
+
+  fprintf (mf, "# spiffer hot pixel mask - %ux%u sensor\n", cm->width, cm->height);
+  for (uint y = 0; y < cm->height; y++) {
+    for (uint x = 0; x < cm->width; x++) {
+      if (cm->mask[y * cm->width + x]) {
+        fprintf (mf, "%u %u\n", x, y);
+      }
+    }
+  }
+
+  fclose (mf);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// update pixel rates at the end of a learning window
+// and mask pixels that fire much more often than the rest
+//--------------------------------------------------------------------
+static void camera_hot_update (camera_t * cm) {
+  uint     px  = cm->width * cm->height;
+  uint64_t sum = 0;
+  uint     act = 0;
+
+  // rates decay by half every window - approximates a sliding window,
+  for (uint i = 0; i < px; i++) {
+    cm->hot_rate[i] = (cm->hot_rate[i] + cm->hot_cnt[i]) / 2;
+    cm->hot_cnt[i]  = 0;
+
+    // masked pixels do not count towards the mean
+    if ((cm->hot_rate[i] != 0) && !cm->mask[i]) {
+      sum += cm->hot_rate[i];
+      act++;
+    }
+  }
+
+  if (act == 0) {
+    cm->hot_mean = 0;
+    return;
+  }
+
+  // and mask outliers
+  cm->hot_mean = sum / act;
+  uint64_t thr = (uint64_t) cm->hot_mean * cm->hot_factor;
+  if (thr < SPIFFER_CAM_HOT_MIN) {
+    thr = SPIFFER_CAM_HOT_MIN;
+  }
+
+  for (uint i = 0; i < px; i++) {
+    if (!cm->mask[i] && (cm->hot_rate[i] >= thr)) {
+      cm->mask[i] = 1;
+      cm->masked++;
+      cm->learnt++;
+    }
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// start camera event processing on a pipe
+// processing is taken from the pipe configuration
+//
+// called by camera listeners once the sensor size is known
+//--------------------------------------------------------------------
+void spiffer_camera_start (int pipe, uint width, uint height) {
+  camera_t *   cm = &camera[pipe];
+  pipe_cfg_t * pc = &cfg.pipe[pipe];
+
+  // keep the mask learnt from the previous camera,
+  spiffer_camera_save (pipe);
+
+  // and keep statistics reports away while maps are reallocated
+  //NOTE: reports run in a signal handler - they never wait for this
+  while (cm->busy.exchange (true)) {
+    sched_yield ();
+  }
+
+  cm->width  = width;
+  cm->height = height;
+
+  // region of interest must be inside the sensor,
+  //NOTE: a width or height of 0 means "up to the sensor edge"
+  cm->x0 = (pc->crop_x < width)  ? pc->crop_x : 0;
+  cm->y0 = (pc->crop_y < height) ? pc->crop_y : 0;
+  cm->w  = width  - cm->x0;
+  cm->h  = height - cm->y0;
+  if ((pc->crop_w != 0) && (pc->crop_w < cm->w)) {
+    cm->w = pc->crop_w;
+  }
+  if ((pc->crop_h != 0) && (pc->crop_h < cm->h)) {
+    cm->h = pc->crop_h;
+  }
+
+  // cells cover the region of interest,
+  cm->shift = (pc->downsample > SPIFFER_CAM_SHIFT_MAX) ? SPIFFER_CAM_SHIFT_MAX : pc->downsample;
+  cm->cw    = ((cm->w - 1) >> cm->shift) + 1;
+  cm->ch    = ((cm->h - 1) >> cm->shift) + 1;
+
+  // pooling needs a counter per cell and polarity,
+  cm->pool = (pc->pool > SPIFFER_CAM_POOL_MAX) ? SPIFFER_CAM_POOL_MAX : pc->pool;
+  free (cm->cnt);
+  cm->cnt = NULL;
+  if (cm->pool > 1) {
+    cm->cnt = (uint8_t *) calloc (cm->cw * cm->ch * 2, sizeof (uint8_t));
+    if (cm->cnt == NULL) {
+      log_time ();
+      fprintf (lf, "warning: no memory for event pooling on pipe%i - pooling disabled\n", pipe);
+      cm->pool = 0;
+    }
+  }
+
+  // denoising needs a timestamp map the size of the sensor,
+  //NOTE: the map has a border so that neighbours always exist
+  cm->dn_window = pc->denoise;
+  cm->dn_shift  = (pc->denoise_cell > SPIFFER_CAM_SHIFT_MAX) ? SPIFFER_CAM_SHIFT_MAX : pc->denoise_cell;
+  cm->dn_stride = ((width - 1) >> cm->dn_shift) + 3;
+  free (cm->dn_map);
+  cm->dn_map = NULL;
+  if (cm->dn_window != 0) {
+    uint rows = ((height - 1) >> cm->dn_shift) + 3;
+    cm->dn_map = (uint *) calloc (cm->dn_stride * rows, sizeof (uint));
+    if (cm->dn_map == NULL) {
+      log_time ();
+      fprintf (lf, "warning: no memory for denoising on pipe%i - denoising disabled\n", pipe);
+      cm->dn_window = 0;
+    }
+  }
+
+  // refractory period needs a timestamp per pixel,
+  uint px = width * height;
+  cm->rf_period = pc->refractory;
+  free (cm->rf_map);
+  cm->rf_map = NULL;
+  if (cm->rf_period != 0) {
+    cm->rf_map = (uint *) calloc (px, sizeof (uint));
+    if (cm->rf_map == NULL) {
+      log_time ();
+      fprintf (lf, "warning: no memory for refractory period on pipe%i - disabled\n", pipe);
+      cm->rf_period = 0;
+    }
+  }
+
+  // hot pixel masking needs a mask - and rates to learn it,
+  cm->hot_window = pc->hot_window * 1000;
+  cm->hot_factor = (pc->hot_factor != 0) ? pc->hot_factor : SPIFFER_CAM_HOT_FACTOR;
+  cm->hot_run    = false;
+  cm->hot_mean   = 0;
+  cm->masked     = 0;
+  cm->learnt     = 0;
+  free (cm->mask);
+  free (cm->hot_cnt);
+  free (cm->hot_rate);
+  cm->mask     = NULL;
+  cm->hot_cnt  = NULL;
+  cm->hot_rate = NULL;
+  if ((cm->hot_window != 0) || (pc->hot_mask != NULL)) {
+    cm->mask = (uint8_t *) calloc (px, sizeof (uint8_t));
+    if (cm->hot_window != 0) {
+      cm->hot_cnt  = (uint16_t *) calloc (px, sizeof (uint16_t));
+      cm->hot_rate = (uint *) calloc (px, sizeof (uint));
+    }
+
+    if ((cm->mask == NULL) ||
+        ((cm->hot_window != 0) && ((cm->hot_cnt == NULL) || (cm->hot_rate == NULL)))) {
+      log_time ();
+      fprintf (lf, "warning: no memory for hot pixel masking on pipe%i - disabled\n", pipe);
+      free (cm->mask);
+      free (cm->hot_cnt);
+      free (cm->hot_rate);
+      cm->mask       = NULL;
+      cm->hot_cnt    = NULL;
+      cm->hot_rate   = NULL;
+      cm->hot_window = 0;
+    } else if (pc->hot_mask != NULL) {
+      cm->masked = camera_mask_load (cm, pc->hot_mask);
+    }
+  }
+
+  cm->active = (cm->w != width) || (cm->h != height) ||
+    (cm->shift != 0) || (cm->pool > 1) || (cm->dn_window != 0) ||
+    (cm->rf_period != 0) || (cm->mask != NULL);
+
+  cm->busy.store (false);
+
+  // and report it
+  if (cm->active) {
+    log_time ();
+    fprintf (lf, "pipe%i camera: %ux%u crop %ux%u at (%u, %u) downsample 1/%u -> %ux%u",
+             pipe, width, height, cm->w, cm->h, cm->x0, cm->y0,
+             1u << cm->shift, cm->cw, cm->ch);
+    if (cm->pool > 1) {
+      fprintf (lf, " pool %u", cm->pool);
+    }
+    if (cm->dn_window != 0) {
+      fprintf (lf, " denoise %u us (cells 1/%u)", cm->dn_window, 1u << cm->dn_shift);
+    }
+    if (cm->rf_period != 0) {
+      fprintf (lf, " refractory %u us", cm->rf_period);
+    }
+    if (cm->mask != NULL) {
+      fprintf (lf, " hot pixels %u masked", cm->masked);
+    }
+    if (cm->hot_window != 0) {
+      fprintf (lf, " (learning over %u ms)", cm->hot_window / 1000);
+    }
+    fprintf (lf, "\n");
+    (void) fflush (lf);
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// save the hot pixel mask of the camera on a pipe - if configured
+//
+// called when the camera on the pipe is replaced and when spiffer
+// stops - the camera listener must not be running
+//--------------------------------------------------------------------
+void spiffer_camera_save (int pipe) {
+  camera_t * cm = &camera[pipe];
+
+  if ((cm->mask == NULL) || (cfg.pipe[pipe].hot_mask == NULL)) {
+    return;
+  }
+
+  camera_mask_save (cm, cfg.pipe[pipe].hot_mask);
+
+  log_time ();
+  fprintf (lf, "pipe%i hot pixel mask saved to %s\n", pipe, cfg.pipe[pipe].hot_mask);
+  (void) fflush (lf);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// stop camera event processing on a pipe
+// the hot pixel mask is saved and the processing maps are freed
+//
+// called when a camera listener fails to start - the pipe is left as
+// if no camera had been on it
+//--------------------------------------------------------------------
+void spiffer_camera_stop (int pipe) {
+  camera_t * cm = &camera[pipe];
+
+  // keep the mask,
+  spiffer_camera_save (pipe);
+
+  // and keep statistics reports away while maps are freed
+  while (cm->busy.exchange (true)) {
+    sched_yield ();
+  }
+
+  free (cm->cnt);
+  free (cm->dn_map);
+  free (cm->rf_map);
+  free (cm->mask);
+  free (cm->hot_cnt);
+  free (cm->hot_rate);
+  cm->cnt      = NULL;
+  cm->dn_map   = NULL;
+  cm->rf_map   = NULL;
+  cm->mask     = NULL;
+  cm->hot_cnt  = NULL;
+  cm->hot_rate = NULL;
+  cm->active   = false;
+
+  cm->busy.store (false);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// check if an event is supported by recent activity around it
+// and record its timestamp
+//
+// events are supported if a neighbour fired within the window
+//NOTE: with cells larger than a pixel, the own cell also counts
+//--------------------------------------------------------------------
+static inline bool camera_supported (camera_t * cm, uint x, uint y, uint t) {
+  // timestamp 0 marks cells that never fired
+  if (t == 0) {
+    t = 1;
+  }
+
+  uint * c = &cm->dn_map[((y >> cm->dn_shift) + 1) * cm->dn_stride + (x >> cm->dn_shift) + 1];
+  uint * u = c - cm->dn_stride;
+  uint * d = c + cm->dn_stride;
+  uint   w = cm->dn_window;
+
+  //NOTE: timestamps wrap around - use differences
+  bool sup = ((u[-1] != 0) && ((t - u[-1]) <= w)) ||
+    ((u[0] != 0) && ((t - u[0]) <= w)) ||
+    ((u[1] != 0) && ((t - u[1]) <= w)) ||
+    ((c[-1] != 0) && ((t - c[-1]) <= w)) ||
+    ((c[1] != 0) && ((t - c[1]) <= w)) ||
+    ((d[-1] != 0) && ((t - d[-1]) <= w)) ||
+    ((d[0] != 0) && ((t - d[0]) <= w)) ||
+    ((d[1] != 0) && ((t - d[1]) <= w)) ||
+    ((cm->dn_shift != 0) && (c[0] != 0) && ((t - c[0]) <= w));
+
+  c[0] = t;
+
+  return (sup);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// crop, denoise, downsample and pool camera events
+// kept events are compacted in place
+//
+// events outside the region of interest are dropped first - they
+// neither train nor support the per-pixel stages
+//
+// returns the number of kept events
+//--------------------------------------------------------------------
+static uint camera_apply (camera_t * cm, uint * evts, const uint * ts, uint num) {
+  uint kept    = 0;
+  uint cropped = 0;
+  uint hot     = 0;
+  uint refract = 0;
+  uint noise   = 0;
+  uint pooled  = 0;
+
+  for (uint i = 0; i < num; i++) {
+    uint e = evts[i];
+    uint x = (e >> SPIFFER_EVT_X_SHIFT) & SPIFFER_EVT_X_MASK;
+    uint y = (e >> SPIFFER_EVT_Y_SHIFT) & SPIFFER_EVT_Y_MASK;
+    uint p = (e >> SPIFFER_EVT_P_SHIFT) & SPIFFER_EVT_P_MASK;
+
+    // guard against events from outside the sensor,
+    if ((x >= cm->width) || (y >= cm->height)) {
+      cropped++;
+      continue;
+    }
+
+    // drop events outside the region of interest - before they
+    // reach the per-pixel stages and their statistics,
+    //NOTE: coordinates left of or above it wrap around
+    uint rx = x - cm->x0;
+    uint ry = y - cm->y0;
+    if ((rx >= cm->w) || (ry >= cm->h)) {
+      cropped++;
+      continue;
+    }
+
+    uint px = y * cm->width + x;
+    uint t  = ts[i];
+
+    // learn pixel rates,
+    //NOTE: timestamps wrap around - use differences
+    if (cm->hot_window != 0) {
+      if (!cm->hot_run) {
+        cm->hot_run   = true;
+        cm->hot_start = t;
+      } else if ((t - cm->hot_start) >= cm->hot_window) {
+        camera_hot_update (cm);
+        cm->hot_start = t;
+      }
+
+      if (cm->hot_cnt[px] != UINT16_MAX) {
+        cm->hot_cnt[px]++;
+      }
+    }
+
+    // drop events from hot pixels,
+    if ((cm->mask != NULL) && cm->mask[px]) {
+      hot++;
+      continue;
+    }
+
+    // drop events inside the pixel refractory period,
+    //NOTE: timestamp 0 marks pixels that never fired
+    if (cm->rf_period != 0) {
+      uint * lt = &cm->rf_map[px];
+      if ((*lt != 0) && ((t - *lt) < cm->rf_period)) {
+        refract++;
+        continue;
+      }
+      *lt = (t != 0) ? t : 1;
+    }
+
+    // drop uncorrelated (background activity) events,
+    if ((cm->dn_window != 0) && !camera_supported (cm, x, y, t)) {
+      noise++;
+      continue;
+    }
+
+    // map them to their cell,
+    x = rx >> cm->shift;
+    y = ry >> cm->shift;
+
+    // forward one of every pool events in the cell,
+    if (cm->pool > 1) {
+      uint8_t * c = &cm->cnt[((y * cm->cw) + x) * 2 + p];
+      if (++(*c) < cm->pool) {
+        pooled++;
+        continue;
+      }
+      *c = 0;
+    }
+
+    // and put them back together
+    evts[kept++] = (e & SPIFFER_EVT_NO_TS) |
+      (x << SPIFFER_EVT_X_SHIFT) | (p << SPIFFER_EVT_P_SHIFT) | (y << SPIFFER_EVT_Y_SHIFT);
+  }
+
+  cm->cropped += cropped;
+  cm->hot     += hot;
+  cm->refract += refract;
+  cm->noise   += noise;
+  cm->pooled  += pooled;
+
+  return (kept);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// process camera events and add them to the current batch
+// ts are the event timestamps (us)
+// events are dropped, mapped and compacted in place
+//--------------------------------------------------------------------
+void spiffer_camera_add (int pipe, uint * evts, const uint * ts, uint num) {
+  camera_t * cm = &camera[pipe];
+
+  cm->evts += num;
+
+  if (cm->active) {
+    num = camera_apply (cm, evts, ts, num);
+  }
+
+  spiffer_batch_add (pipe, evts, num);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// report camera event processing statistics of a pipe
+//--------------------------------------------------------------------
+static void camera_report (int pipe, camera_t * cm) {
+  log_time ();
+  fprintf (lf, "pipe%i camera events: %llu cropped: %llu hot: %llu refractory: %llu noise: %llu pooled: %llu\n",
+           pipe,
+           (unsigned long long) cm->evts,
+           (unsigned long long) cm->cropped,
+           (unsigned long long) cm->hot,
+           (unsigned long long) cm->refract,
+           (unsigned long long) cm->noise,
+           (unsigned long long) cm->pooled
+           );
+
+  if (cm->mask == NULL) {
+    return;
+  }
+
+  // hot pixel mask - saved when the camera is replaced or spiffer stops,
+  log_time ();
+  fprintf (lf, "pipe%i hot pixels masked: %u (learnt: %u)\n", pipe, cm->masked, cm->learnt);
+
+  if (cm->hot_window == 0) {
+    return;
+  }
+
+  // and pixel rates - mean and hottest pixels
+  double ws = (double) cm->hot_window / 1000000;
+
+  log_time ();
+  fprintf (lf, "pipe%i pixel rates: mean %.1f ev/s hottest:", pipe, cm->hot_mean / ws);
+
+  uint px   = cm->width * cm->height;
+  uint last = UINT32_MAX;
+  for (int n = 0; n < SPIFFER_CAM_HOT_REPORT; n++) {
+    // find the next hottest rate - one pixel per rate
+    uint best = 0;
+    uint bi   = px;
+    for (uint i = 0; i < px; i++) {
+      if ((cm->hot_rate[i] < last) && (cm->hot_rate[i] > best)) {
+        best = cm->hot_rate[i];
+        bi   = i;
+      }
+    }
+
+    if (bi == px) {
+      break;
+    }
+
+    fprintf (lf, " (%u, %u) %.1f%s", bi % cm->width, bi / cm->width, best / ws,
+             cm->mask[bi] ? " [masked]" : "");
+    last = best;
+  }
+  fprintf (lf, "\n");
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// report camera event processing statistics to the log file
+//--------------------------------------------------------------------
+void spiffer_camera_report (int pipe) {
+  camera_t * cm = &camera[pipe];
+
+  // skip cameras being restarted - their maps may be going away
+  if (cm->busy.exchange (true)) {
+    return;
+  }
+
+  if (cm->active) {
+    camera_report (pipe, cm);
+  }
+
+  cm->busy.store (false);
+}
+//--------------------------------------------------------------------
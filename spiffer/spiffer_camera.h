@@ -0,0 +1,151 @@
+//************************************************//
+//*                                              *//
+//*      spiffer camera event processing         *//
+//*                                              *//
+//************************************************//
+
+#ifndef __SPIFFER_CAMERA_H__
+#define __SPIFFER_CAMERA_H__
+
+
+#include <atomic>
+#include <cstdint>
+
+#include <sys/types.h>
+
+// spif and spiffer constants and function prototypes
+#include "spif.h"
+#include "spiffer.h"
+
+// largest pooling count - fits cell counters
+#define SPIFFER_CAM_POOL_MAX  255
+
+// largest downsampling shift - coordinates have 15 bits
+#define SPIFFER_CAM_SHIFT_MAX 15
+
+// hot pixel detection defaults
+#define SPIFFER_CAM_HOT_FACTOR  10     // times the mean pixel rate
+#define SPIFFER_CAM_HOT_MIN     10     // events per window
+#define SPIFFER_CAM_HOT_REPORT  5      // hottest pixels reported
+
+// per-pipe camera event processing state
+typedef struct alignas (SPIFFER_CACHE_LINE) camera {
+  bool      active;     // any processing configured
+  std::atomic<bool> busy; // maps being reallocated - or reported
+  uint      width;      // sensor width
+  uint      height;     // sensor height
+
+  // region of interest - sensor coordinates
+  uint      x0;
+  uint      y0;
+  uint      w;
+  uint      h;
+
+  // spatial downsampling and pooling
+  uint      shift;      // cells are 2^shift x 2^shift pixels
+  uint      cw;         // cells per row
+  uint      ch;         // cells per column
+  uint      pool;       // events in a cell to forward one - 0: all
+  uint8_t * cnt;        // per cell and polarity event counters
+
+  // background-activity denoising
+  uint      dn_window;  // neighbour support window (us) - 0: no denoising
+  uint      dn_shift;   // map cells are 2^dn_shift x 2^dn_shift pixels
+  uint      dn_stride;  // map cells per row - including border
+  uint *    dn_map;     // last timestamp per cell - 0: never
+
+  // per-pixel refractory period
+  uint      rf_period;  // refractory period (us) - 0: none
+  uint *    rf_map;     // last forwarded timestamp per pixel - 0: never
+
+  // hot pixel masking
+  uint8_t * mask;       // masked pixels - NULL: no mask
+  uint      hot_window; // rate learning window (us) - 0: no learning
+  uint      hot_factor; // hot if rate is this times the mean
+  uint      hot_start;  // current window start (us)
+  bool      hot_run;    // current window started
+  uint16_t * hot_cnt;   // events per pixel in current window
+  uint *    hot_rate;   // events per window per pixel - decaying average
+  uint      hot_mean;   // mean rate of active pixels (events per window)
+  uint      masked;     // masked pixels
+  uint      learnt;     // masked pixels learnt online
+
+  // statistics
+  uint64_t  evts;       // events received
+  uint64_t  cropped;    // events outside region of interest
+  uint64_t  hot;        // events from masked (hot) pixels
+  uint64_t  refract;    // events inside refractory period
+  uint64_t  noise;      // events rejected as background activity
+  uint64_t  pooled;     // events absorbed by pooling
+} camera_t;
+
+
+//--------------------------------------------------------------------
+// set the region of interest of the camera on a pipe
+// arg has the form: <x> <y> <width> <height>
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_camera_crop (int pipe, const char * arg);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// set the hot pixel mask file of the camera on a pipe
+// the mask is loaded when the camera starts and saved when it is
+// replaced or spiffer stops
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_camera_mask_file (int pipe, const char * arg);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// start camera event processing on a pipe
+// processing is taken from the pipe configuration
+//
+// called by camera listeners once the sensor size is known
+//--------------------------------------------------------------------
+void spiffer_camera_start (int pipe, uint width, uint height);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// save the hot pixel mask of the camera on a pipe - if configured
+//
+// called when the camera on the pipe is replaced and when spiffer
+// stops - the camera listener must not be running
+//--------------------------------------------------------------------
+void spiffer_camera_save (int pipe);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// stop camera event processing on a pipe
+// the hot pixel mask is saved and the processing maps are freed
+//
+// called when a camera listener fails to start - the pipe is left as
+// if no camera had been on it
+//--------------------------------------------------------------------
+void spiffer_camera_stop (int pipe);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// process camera events and add them to the current batch
+// ts are the event timestamps (us)
+// events are dropped, mapped and compacted in place
+//--------------------------------------------------------------------
+void spiffer_camera_add (int pipe, uint * evts, const uint * ts, uint num);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// report camera event processing statistics to the log file
+//--------------------------------------------------------------------
+void spiffer_camera_report (int pipe);
+//--------------------------------------------------------------------
+
+
+#endif /* __SPIFFER_CAMERA_H__ */
@@ -0,0 +1,325 @@
+//************************************************//
+//*                                              *//
+//*          spiffer configuration file          *//
+//*                                              *//
+//************************************************//
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+#include "spiffer_config.h"
+#include "spiffer_filter.h"
+#include "spiffer_rate.h"
+#include "spiffer_pace.h"
+#include "spiffer_merge.h"
+#include "spiffer_rt.h"
+#include "spiffer_camera.h"
+#include "spiffer_route.h"
+#include "spiffer_replay.h"
+#include "spiffer_sensor.h"
+#include "spiffer_out.h"
+
+// global variables
+// configuration file
+const char * cfg_name = "/etc/spiffer.conf";
+
+// spiffer configuration
+spiffer_cfg_t cfg;
+
+// spif pipes
+extern int pipe_num_in;
+extern int pipe_num_out;
+
+// log file
+extern FILE * lf;
+
+// known configuration parameters
+static const cfg_param_t cfg_params[] = {
+  {"batch_size",     true, CFG_UINT, offsetof (pipe_cfg_t, batch_size),     NULL},
+  {"batch_delay",    true, CFG_UINT, offsetof (pipe_cfg_t, batch_delay),    NULL},
+  {"udp_dgram_size", true, CFG_UINT, offsetof (pipe_cfg_t, udp_dgram_size), NULL},
+  {"filter",         true, CFG_FUNC, 0, spiffer_filter_config},
+  {"rate_limit",     true, CFG_UINT, offsetof (pipe_cfg_t, rate_limit),     NULL},
+  {"rate_burst",     true, CFG_UINT, offsetof (pipe_cfg_t, rate_burst),     NULL},
+  {"rate_policy",    true, CFG_FUNC, 0, spiffer_rate_config},
+  {"pace",           true, CFG_FUNC, 0, spiffer_pace_config},
+  {"pace_depth",     true, CFG_UINT, offsetof (pipe_cfg_t, pace_depth),     NULL},
+  {"merge_port",     true, CFG_FUNC, 0, spiffer_merge_config},
+  {"merge_window",   true, CFG_UINT, offsetof (pipe_cfg_t, merge_window),   NULL},
+  {"input_cpus",     true, CFG_FUNC, 0, spiffer_rt_input_cpus},
+  {"input_priority", true, CFG_UINT, offsetof (pipe_cfg_t, input_prio),     NULL},
+  {"spinn_cpus",     true, CFG_FUNC, 0, spiffer_rt_spinn_cpus},
+  {"spinn_priority", true, CFG_UINT, offsetof (pipe_cfg_t, spinn_prio),     NULL},
+  {"command_cpus",   true, CFG_FUNC, 0, spiffer_rt_command_cpus},
+  {"command_priority", true, CFG_UINT, offsetof (pipe_cfg_t, command_prio), NULL},
+  {"mlock",          false, CFG_UINT, offsetof (spiffer_cfg_t, mlock),      NULL},
+  {"crop",           true, CFG_FUNC, 0, spiffer_camera_crop},
+  {"downsample",     true, CFG_UINT, offsetof (pipe_cfg_t, downsample),     NULL},
+  {"pool",           true, CFG_UINT, offsetof (pipe_cfg_t, pool),           NULL},
+  {"denoise",        true, CFG_UINT, offsetof (pipe_cfg_t, denoise),        NULL},
+  {"denoise_cell",   true, CFG_UINT, offsetof (pipe_cfg_t, denoise_cell),   NULL},
+  {"refractory",     true, CFG_UINT, offsetof (pipe_cfg_t, refractory),     NULL},
+  {"hot_window",     true, CFG_UINT, offsetof (pipe_cfg_t, hot_window),     NULL},
+  {"hot_factor",     true, CFG_UINT, offsetof (pipe_cfg_t, hot_factor),     NULL},
+  {"hot_mask",       true, CFG_FUNC, 0, spiffer_camera_mask_file},
+  {"route",          true, CFG_FUNC, 0, spiffer_route_config},
+  {"queue_depth",    true, CFG_UINT, offsetof (pipe_cfg_t, queue_depth),    NULL},
+  {"read_budget",    true, CFG_UINT, offsetof (pipe_cfg_t, read_budget),    NULL},
+  {"sdk_decoder",    true, CFG_UINT, offsetof (pipe_cfg_t, sdk_decoder),    NULL},
+  {"replay",         true, CFG_FUNC, 0, spiffer_replay_config},
+  {"sensor",         true, CFG_FUNC, 0, spiffer_sensor_config},
+  {"out_flush",      true, CFG_FUNC, 0, spiffer_out_config},
+  {"out_frames",     true, CFG_UINT, offsetof (pipe_cfg_t, out_frames),     NULL},
+  {"out_hold",       true, CFG_UINT, offsetof (pipe_cfg_t, out_hold),       NULL},
+};
+
+static const int cfg_params_num = sizeof (cfg_params) / sizeof (cfg_param_t);
+
+
+//--------------------------------------------------------------------
+// set all configuration parameters to their default values
+//--------------------------------------------------------------------
+void spiffer_config_init (void) {
+  for (int pipe = 0; pipe < SPIFFER_PIPES_MAX; pipe++) {
+    pipe_cfg_t * pc = &cfg.pipe[pipe];
+
+    pc->batch_size  = 0;
+    pc->batch_delay = 0;
+
+    pc->udp_dgram_size = 0;
+
+    pc->rate_limit  = 0;
+    pc->rate_burst  = 0;
+    pc->rate_policy = RATE_DROP_NEWEST;
+
+    pc->pace_speed = 0;
+    pc->pace_depth = 0;
+
+    pc->merge_num    = 0;
+    pc->merge_window = 0;
+
+    pc->input_cpus   = 0;
+    pc->input_prio   = 0;
+    pc->spinn_cpus   = 0;
+    pc->spinn_prio   = 0;
+    pc->command_cpus = 0;
+    pc->command_prio = 0;
+
+    pc->crop_x     = 0;
+    pc->crop_y     = 0;
+    pc->crop_w     = 0;
+    pc->crop_h     = 0;
+    pc->downsample = 0;
+    pc->pool       = 0;
+
+    pc->denoise      = 0;
+    pc->denoise_cell = 0;
+
+    pc->refractory = 0;
+    pc->hot_window = 0;
+    pc->hot_factor = 0;
+    pc->hot_mask   = NULL;
+
+    pc->queue_depth = 0;
+    pc->read_budget = 0;
+    pc->sdk_decoder = 0;
+
+    pc->replay_file  = NULL;
+    pc->replay_speed = 1.0;
+    pc->replay_loop  = 0;
+
+    pc->out_policy = OUT_FRAME;
+    pc->out_frames = 0;
+    pc->out_hold   = 0;
+  }
+
+  cfg.mlock = 0;
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// apply a configuration parameter value to a pipe or to all pipes
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+static int config_apply (const cfg_param_t * cp, int pipe, const char * arg) {
+  int pipe_max_num = (pipe_num_in >= pipe_num_out) ? pipe_num_in : pipe_num_out;
+
+  // global parameters apply once, per-pipe ones to the selected pipes
+  int first = 0;
+  int last  = 0;
+  if (cp->per_pipe) {
+    first = (pipe == SPIFFER_CFG_ALL_PIPES) ? 0 : pipe;
+    last  = (pipe == SPIFFER_CFG_ALL_PIPES) ? pipe_max_num - 1 : pipe;
+  }
+
+  for (int p = first; p <= last; p++) {
+    char * base = cp->per_pipe ? (char *) &cfg.pipe[p] : (char *) &cfg;
+
+    switch (cp->type) {
+    case CFG_UINT: {
+      char * end;
+      unsigned long val = strtoul (arg, &end, 0);
+      if ((end == arg) || (*end != '\0')) {
+        return (SPIFFER_ERROR);
+      }
+
+      *((uint *) (base + cp->offset)) = (uint) val;
+      break;
+    }
+    case CFG_FUNC:
+      if (cp->parse (cp->per_pipe ? p : SPIFFER_CFG_ALL_PIPES, arg) == SPIFFER_ERROR) {
+        return (SPIFFER_ERROR);
+      }
+      break;
+    }
+  }
+
+  return (SPIFFER_OK);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// read configuration file - all parameters or only one of them
+// lines have the form: <parameter> [<pipe> | *] <value>
+//
+// a missing file leaves the default configuration in place
+// wrong lines are reported and ignored
+//--------------------------------------------------------------------
+static void config_file (const char * name, const char * only) {
+  int pipe_max_num = (pipe_num_in >= pipe_num_out) ? pipe_num_in : pipe_num_out;
+
+  FILE * cf = fopen (name, "r");
+  if (cf == NULL) {
+    log_time ();
+    fprintf (lf, "no configuration file %s - using defaults\n", name);
+    (void) fflush (lf);
+    return;
+  }
+
+  char line[SPIFFER_CFG_LINE_MAX];
+  int  ln = 0;
+  while (fgets (line, sizeof (line), cf) != NULL) {
+    ln++;
+
+    // drop comments and trailing white space,
+    char * cmt = strchr (line, '#');
+    if (cmt != NULL) {
+      *cmt = '\0';
+    }
+
+    char * end = line + strlen (line);
+    while ((end > line) && isspace ((unsigned char) end[-1])) {
+      *--end = '\0';
+    }
+
+    // skip empty lines,
+    char * key = line;
+    while (isspace ((unsigned char) *key)) {
+      key++;
+    }
+
+    if (*key == '\0') {
+      continue;
+    }
+
+    // split parameter name from its arguments,
+    char * arg = key;
+    while ((*arg != '\0') && !isspace ((unsigned char) *arg)) {
+      arg++;
+    }
+
+    if (*arg != '\0') {
+      *arg++ = '\0';
+    }
+
+    while (isspace ((unsigned char) *arg)) {
+      arg++;
+    }
+
+    // skip other parameters - if reading only one,
+    if ((only != NULL) && (strcmp (key, only) != 0)) {
+      continue;
+    }
+
+    // find parameter,
+    const cfg_param_t * cp = NULL;
+    for (int i = 0; i < cfg_params_num; i++) {
+      if (strcmp (key, cfg_params[i].name) == 0) {
+        cp = &cfg_params[i];
+        break;
+      }
+    }
+
+    if (cp == NULL) {
+      log_time ();
+      fprintf (lf, "warning: %s:%i unknown parameter %s\n", name, ln, key);
+      continue;
+    }
+
+    // get pipe number - if required,
+    int pipe = SPIFFER_CFG_ALL_PIPES;
+    if (cp->per_pipe) {
+      if (*arg == '*') {
+        arg++;
+      } else {
+        char * pe;
+        pipe = (int) strtol (arg, &pe, 10);
+        if ((pe == arg) || (pipe < 0) || (pipe >= pipe_max_num)) {
+          log_time ();
+          fprintf (lf, "warning: %s:%i %s needs a valid pipe number\n", name, ln, key);
+          continue;
+        }
+        arg = pe;
+      }
+
+      while (isspace ((unsigned char) *arg)) {
+        arg++;
+      }
+    }
+
+    // and apply value
+    if (config_apply (cp, pipe, arg) == SPIFFER_ERROR) {
+      log_time ();
+      fprintf (lf, "warning: %s:%i invalid value for %s\n", name, ln, key);
+      continue;
+    }
+
+    log_time ();
+    if (pipe == SPIFFER_CFG_ALL_PIPES) {
+      fprintf (lf, "configuration: %s = %s\n", key, arg);
+    } else {
+      fprintf (lf, "configuration: %s pipe%i = %s\n", key, pipe, arg);
+    }
+  }
+
+  fclose (cf);
+  (void) fflush (lf);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// read configuration file
+// lines have the form: <parameter> [<pipe> | *] <value>
+//
+// a missing file leaves the default configuration in place
+// wrong lines are reported and ignored
+//--------------------------------------------------------------------
+void spiffer_config_read (const char * name) {
+  config_file (name, NULL);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// re-read the lines of one parameter from the configuration file
+// only for parameters that can be changed at runtime
+//--------------------------------------------------------------------
+void spiffer_config_reload (const char * name, const char * param) {
+  config_file (name, param);
+}
+//--------------------------------------------------------------------
@@ -0,0 +1,117 @@
+//************************************************//
+//*                                              *//
+//*          spiffer configuration file          *//
+//*                                              *//
+//************************************************//
+
+#ifndef __SPIFFER_CONFIG_H__
+#define __SPIFFER_CONFIG_H__
+
+
+#include <cstddef>
+#include <cstdio>
+
+#include <sys/types.h>
+
+// spif and spiffer constants and function prototypes
+#include "spif.h"
+#include "spiffer.h"
+
+#define SPIFFER_CFG_LINE_MAX  256
+#define SPIFFER_CFG_ALL_PIPES -1
+
+// configuration file
+extern const char * cfg_name;
+
+// per-pipe configuration
+typedef struct pipe_cfg {
+  uint batch_size;     // events - 0: send when slot full
+  uint batch_delay;    // microseconds - 0: send when source is drained
+  uint udp_dgram_size; // bytes - 0: pipe buffer size or jumbo frame
+  uint rate_limit;     // events per second - 0: no limit
+  uint rate_burst;     // events - 0: SPIFFER_RATE_BURST_MS at full rate
+  uint rate_policy;    // rate_policy_t
+  double pace_speed;   // replay speed factor - 0: no pacing
+  uint pace_depth;     // events - 0: SPIFFER_PACE_DEPTH
+  uint merge_port[SPIFFER_MERGE_SRC_MAX - 1];  // extra UDP sources
+  uint merge_num;      // number of extra UDP sources
+  uint merge_window;   // microseconds - 0: SPIFFER_MERGE_WINDOW
+  uint input_cpus;     // CPU mask - 0: any CPU
+  uint input_prio;     // SCHED_FIFO priority - 0: SCHED_OTHER
+  uint spinn_cpus;     // CPU mask - 0: any CPU
+  uint spinn_prio;     // SCHED_FIFO priority - 0: SCHED_OTHER
+  uint command_cpus;   // CPU mask - 0: any CPU
+  uint command_prio;   // SCHED_FIFO priority - 0: SCHED_OTHER
+  uint crop_x;         // camera region of interest - pixels
+  uint crop_y;
+  uint crop_w;         // 0: up to the sensor edge
+  uint crop_h;         // 0: up to the sensor edge
+  uint downsample;     // cells are 2^downsample pixels wide - 0: no downsampling
+  uint pool;           // events in a cell to forward one - 0: all
+  uint denoise;        // neighbour support window (us) - 0: no denoising
+  uint denoise_cell;   // map cells are 2^denoise_cell pixels wide
+  uint refractory;     // per-pixel refractory period (us) - 0: none
+  uint hot_window;     // hot pixel learning window (ms) - 0: no learning
+  uint hot_factor;     // hot if rate is this times the mean - 0: default
+  char * hot_mask;     // hot pixel mask file - NULL: none
+  uint queue_depth;    // camera event buffers queued - 0: SPIFFER_QUEUE_DEPTH
+  uint read_budget;    // camera bytes read per batch - 0: every read
+  uint sdk_decoder;    // decode Prophesee raw data - 0: natively, 1: with the SDK
+  char * replay_file;  // recording replayed as a camera - NULL: none
+  double replay_speed; // replay speed factor - 0: as fast as possible
+  uint replay_loop;    // replay the recording again when it ends
+  uint out_policy;     // out_policy_t
+  uint out_frames;     // output frames held - 0: SPIFFER_OUT_FRAMES
+  uint out_hold;       // output hold time (us) - 0: SPIFFER_OUT_HOLD
+} pipe_cfg_t;
+
+// spiffer configuration
+typedef struct spiffer_cfg {
+  pipe_cfg_t pipe[SPIFFER_PIPES_MAX];
+  uint       mlock;    // lock memory and prefault spif buffers
+} spiffer_cfg_t;
+
+// configuration parameter types
+typedef enum {
+  CFG_UINT,
+  CFG_FUNC
+} cfg_type_t;
+
+// configuration parameters
+//NOTE: per-pipe parameters are preceded by a pipe number or '*'
+typedef struct cfg_param {
+  const char * name;
+  bool         per_pipe;
+  cfg_type_t   type;
+  size_t       offset;                               // CFG_UINT field offset
+  int       (* parse) (int pipe, const char * arg);  // CFG_FUNC parser
+} cfg_param_t;
+
+
+//--------------------------------------------------------------------
+// set all configuration parameters to their default values
+//--------------------------------------------------------------------
+void spiffer_config_init (void);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// read configuration file
+// lines have the form: <parameter> [<pipe> | *] <value>
+//
+// a missing file leaves the default configuration in place
+// wrong lines are reported and ignored
+//--------------------------------------------------------------------
+void spiffer_config_read (const char * name);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// re-read the lines of one parameter from the configuration file
+// only for parameters that can be changed at runtime
+//--------------------------------------------------------------------
+void spiffer_config_reload (const char * name, const char * param);
+//--------------------------------------------------------------------
+
+
+#endif /* __SPIFFER_CONFIG_H__ */
@@ -0,0 +1,278 @@
+//************************************************//
+//*                                              *//
+//*     spiffer Prophesee raw stream decoder     *//
+//*                                              *//
+//* decodes EVT 2.0 and EVT 3.0 raw camera data  *//
+//* straight into spif events, without building  *//
+//* Metavision SDK event objects                 *//
+//*                                              *//
+//************************************************//
+
+#include <cctype>
+#include <cstring>
+#include <strings.h>
+
+#include "spiffer_evt.h"
+
+// EVT 2.0 word types - bits [31:28]
+#define EVT2_CD_OFF       0x0
+#define EVT2_CD_ON        0x1
+#define EVT2_TIME_HIGH    0x8
+
+// EVT 3.0 word types - bits [15:12]
+#define EVT3_ADDR_Y       0x0
+#define EVT3_ADDR_X       0x2
+#define EVT3_VECT_BASE_X  0x3
+#define EVT3_VECT_12      0x4
+#define EVT3_VECT_8       0x5
+#define EVT3_TIME_LOW     0x6
+#define EVT3_TIME_HIGH    0x8
+
+// raw words are decoded 4 at a time - if the format allows
+//NOTE: maps to NEON on ARM and SSE on x86
+typedef uint v4u __attribute__ ((vector_size (16)));
+
+
+//--------------------------------------------------------------------
+// find a raw stream format from its name
+// e.g., the camera data encoding format or a .raw file header
+//
+// returns EVT_NONE if the format is not supported
+//--------------------------------------------------------------------
+evt_format_t spiffer_evt_format (const char * name) {
+  // find the format name,
+  for (; *name != '\0'; name++) {
+    if (strncasecmp (name, "evt", 3) == 0) {
+      break;
+    }
+  }
+
+  if (*name == '\0') {
+    return (EVT_NONE);
+  }
+
+  name += 3;
+  while (*name == ' ') {
+    name++;
+  }
+
+  // and its version - 2.0 and 3.0 only
+  char ver = *name++;
+  if ((*name == '.') && (name[1] == '0')) {
+    name += 2;
+  }
+
+  if (isalnum ((unsigned char) *name) || (*name == '.')) {
+    return (EVT_NONE);
+  }
+
+  switch (ver) {
+  case '2':
+    return (EVT_2);
+  case '3':
+    return (EVT_3);
+  default:
+    return (EVT_NONE);
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// start decoding a raw stream
+//--------------------------------------------------------------------
+void spiffer_evt_init (evt_dec_t * dc, evt_format_t format) {
+  memset (dc, 0, sizeof (evt_dec_t));
+  dc->format = format;
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// build a spif event
+//--------------------------------------------------------------------
+static inline uint evt_spif (uint x, uint y, uint p) {
+  return (SPIFFER_EVT_NO_TS | (x << SPIFFER_EVT_X_SHIFT) | (p << SPIFFER_EVT_P_SHIFT) | (y << SPIFFER_EVT_Y_SHIFT));
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// decode a single EVT 2.0 word
+//
+// returns the number of events produced
+//--------------------------------------------------------------------
+static inline uint evt2_word (evt_dec_t * dc, uint w, uint * evts, uint * ts) {
+  uint type = w >> 28;
+
+  switch (type) {
+  case EVT2_CD_OFF:
+  case EVT2_CD_ON:
+    *evts = evt_spif ((w >> 11) & 0x7ff, w & 0x7ff, type);
+    *ts   = (dc->time_high << 6) | ((w >> 22) & 0x3f);
+    return (1);
+
+  case EVT2_TIME_HIGH:
+    dc->time_high = w & 0x0fffffff;
+    return (0);
+
+  // triggers and the rest are not forwarded
+  default:
+    return (0);
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// decode EVT 2.0 raw data
+//
+// returns the number of events produced
+//--------------------------------------------------------------------
+static uint evt2_decode (evt_dec_t * dc, const uint8_t * raw, size_t bytes,
+                         size_t * used, uint * evts, uint * ts, uint max) {
+  size_t num = bytes / sizeof (uint);
+  size_t i   = 0;
+  uint   cnt = 0;
+
+  // decode 4 words at a time,
+  for (; ((i + 4) <= num) && ((cnt + 4) <= max); i += 4) {
+    v4u w;
+    memcpy (&w, raw + i * sizeof (uint), sizeof (w));
+
+    // mixed words go one at a time - time changes in between,
+    v4u t = w >> 29;
+    if (t[0] | t[1] | t[2] | t[3]) {
+      for (int k = 0; k < 4; k++) {
+        cnt += evt2_word (dc, w[k], &evts[cnt], &ts[cnt]);
+      }
+      continue;
+    }
+
+    // and CD events - the common case - all at once
+    v4u e = SPIFFER_EVT_NO_TS |
+      (((w >> 11) & 0x7ff) << SPIFFER_EVT_X_SHIFT) |
+      (((w >> 28) & 1) << SPIFFER_EVT_P_SHIFT) |
+      ((w & 0x7ff) << SPIFFER_EVT_Y_SHIFT);
+    v4u s = (dc->time_high << 6) | ((w >> 22) & 0x3f);
+
+    memcpy (&evts[cnt], &e, sizeof (e));
+    memcpy (&ts[cnt], &s, sizeof (s));
+    cnt += 4;
+  }
+
+  // and then the remaining words one at a time
+  for (; (i < num) && (cnt < max); i++) {
+    uint w;
+    memcpy (&w, raw + i * sizeof (uint), sizeof (w));
+    cnt += evt2_word (dc, w, &evts[cnt], &ts[cnt]);
+  }
+
+  dc->words += i;
+  *used = i * sizeof (uint);
+  return (cnt);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// decode EVT 3.0 raw data
+//
+// returns the number of events produced
+//--------------------------------------------------------------------
+static uint evt3_decode (evt_dec_t * dc, const uint8_t * raw, size_t bytes,
+                         size_t * used, uint * evts, uint * ts, uint max) {
+  size_t num = bytes / sizeof (uint16_t);
+  size_t i   = 0;
+  uint   cnt = 0;
+
+  // the state machine is inherently sequential,
+  //NOTE: stop while a vector word could still overflow the buffer
+  for (; (i < num) && ((cnt + SPIFFER_EVT_WORD_EVTS) <= max); i++) {
+    uint16_t w;
+    memcpy (&w, raw + i * sizeof (uint16_t), sizeof (w));
+
+    uint t = dc->t_ovf + ((dc->t_high << 12) | dc->t_low);
+    uint m;
+
+    switch (w >> 12) {
+    case EVT3_ADDR_Y:
+      dc->y = w & 0x7ff;
+      break;
+
+    case EVT3_ADDR_X:
+      evts[cnt] = evt_spif (w & 0x7ff, dc->y, (w >> 11) & 1);
+      ts[cnt++] = t;
+      break;
+
+    case EVT3_VECT_BASE_X:
+      dc->x   = w & 0x7ff;
+      dc->pol = (w >> 11) & 1;
+      break;
+
+    // vectors - one event per valid bit,
+    case EVT3_VECT_12:
+    case EVT3_VECT_8:
+      m = ((w >> 12) == EVT3_VECT_12) ? (w & 0xfff) : (w & 0xff);
+      while (m != 0) {
+        evts[cnt] = evt_spif (dc->x + __builtin_ctz (m), dc->y, dc->pol);
+        ts[cnt++] = t;
+        m &= m - 1;
+      }
+      dc->x += ((w >> 12) == EVT3_VECT_12) ? 12 : 8;
+      break;
+
+    case EVT3_TIME_LOW:
+      dc->t_low = w & 0xfff;
+      break;
+
+    // timestamps have 24 bits - extend them when they wrap around,
+    case EVT3_TIME_HIGH:
+      if ((uint) (w & 0xfff) < dc->t_high) {
+        dc->t_ovf += 1u << 24;
+      }
+      dc->t_high = w & 0xfff;
+      break;
+
+    // and triggers and the rest are not forwarded
+    default:
+      break;
+    }
+  }
+
+  dc->words += i;
+  *used = i * sizeof (uint16_t);
+  return (cnt);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// decode raw camera data straight into spif events - and timestamps
+// decoding stops when max events cannot be guaranteed to fit,
+// used reports the number of raw bytes consumed
+//
+// max must be at least SPIFFER_EVT_WORD_EVTS
+//
+// returns the number of events produced
+//--------------------------------------------------------------------
+uint spiffer_evt_decode (evt_dec_t * dc, const uint8_t * raw, size_t bytes,
+                         size_t * used, uint * evts, uint * ts, uint max) {
+  uint cnt;
+
+  switch (dc->format) {
+  case EVT_2:
+    cnt = evt2_decode (dc, raw, bytes, used, evts, ts, max);
+    break;
+  case EVT_3:
+    cnt = evt3_decode (dc, raw, bytes, used, evts, ts, max);
+    break;
+  default:
+    *used = bytes;
+    return (0);
+  }
+
+  dc->evts += cnt;
+  return (cnt);
+}
+//--------------------------------------------------------------------
@@ -0,0 +1,82 @@
+//************************************************//
+//*                                              *//
+//*     spiffer Prophesee raw stream decoder     *//
+//*                                              *//
+//************************************************//
+
+#ifndef __SPIFFER_EVT_H__
+#define __SPIFFER_EVT_H__
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <sys/types.h>
+
+// spif and spiffer constants and function prototypes
+#include "spif.h"
+#include "spiffer.h"
+
+// most events produced by a single raw word (EVT 3.0 VECT_12)
+#define SPIFFER_EVT_WORD_EVTS  12
+
+// raw stream formats
+typedef enum {
+  EVT_NONE,     // not supported - use the Metavision SDK
+  EVT_2,        // EVT 2.0 - 32-bit words
+  EVT_3         // EVT 3.0 - 16-bit words
+} evt_format_t;
+
+// decoder state - carried across raw buffers
+typedef struct evt_dec {
+  evt_format_t format;
+
+  // EVT 2.0
+  uint     time_high;   // timestamp [33:6] - last EVT_TIME_HIGH
+
+  // EVT 3.0
+  uint     y;           // last EVT_ADDR_Y
+  uint     x;           // vector base x - advances with every vector
+  uint     pol;         // vector polarity
+  uint     t_high;      // timestamp [23:12]
+  uint     t_low;       // timestamp [11:0]
+  uint     t_ovf;       // timestamp wrap arounds (x 2^24)
+
+  // statistics
+  uint64_t words;       // raw words decoded
+  uint64_t evts;        // CD events produced
+} evt_dec_t;
+
+
+//--------------------------------------------------------------------
+// find a raw stream format from its name
+// e.g., the camera data encoding format or a .raw file header
+//
+// returns EVT_NONE if the format is not supported
+//--------------------------------------------------------------------
+evt_format_t spiffer_evt_format (const char * name);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// start decoding a raw stream
+//--------------------------------------------------------------------
+void spiffer_evt_init (evt_dec_t * dc, evt_format_t format);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// decode raw camera data straight into spif events - and timestamps
+// decoding stops when max events cannot be guaranteed to fit,
+// used reports the number of raw bytes consumed
+//
+// max must be at least SPIFFER_EVT_WORD_EVTS
+//
+// returns the number of events produced
+//--------------------------------------------------------------------
+uint spiffer_evt_decode (evt_dec_t * dc, const uint8_t * raw, size_t bytes,
+                         size_t * used, uint * evts, uint * ts, uint max);
+//--------------------------------------------------------------------
+
+
+#endif /* __SPIFFER_EVT_H__ */
@@ -0,0 +1,180 @@
+//************************************************//
+//*                                              *//
+//*          spiffer event pre-filtering         *//
+//*                                              *//
+//* mirrors the spif hardware filters but runs   *//
+//* before events are transferred to spif and    *//
+//* has no limit on the number of entries        *//
+//*                                              *//
+//************************************************//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "spiffer_filter.h"
+
+// global variables
+// log file
+extern FILE * lf;
+
+// per-pipe filter state
+filter_t filter[SPIFFER_PIPES_MAX];
+
+// events are checked 4 at a time
+//NOTE: maps to NEON on ARM and SSE on x86
+typedef uint v4u __attribute__ ((vector_size (16)));
+typedef int  v4i __attribute__ ((vector_size (16)));
+
+
+//--------------------------------------------------------------------
+// add a filter entry to a pipe
+// arg has the form: <value> <mask>
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_filter_config (int pipe, const char * arg) {
+  filter_t * fl = &filter[pipe];
+
+  char * end;
+  unsigned long val = strtoul (arg, &end, 0);
+  if (end == arg) {
+    return (SPIFFER_ERROR);
+  }
+
+  arg = end;
+  unsigned long msk = strtoul (arg, &end, 0);
+  if ((end == arg) || (*end != '\0')) {
+    return (SPIFFER_ERROR);
+  }
+
+  uint * nv = (uint *) realloc (fl->val, (fl->num + 1) * sizeof (uint));
+  if (nv == NULL) {
+    return (SPIFFER_ERROR);
+  }
+  fl->val = nv;
+
+  uint * nm = (uint *) realloc (fl->msk, (fl->num + 1) * sizeof (uint));
+  if (nm == NULL) {
+    return (SPIFFER_ERROR);
+  }
+  fl->msk = nm;
+
+  fl->val[fl->num] = (uint) val;
+  fl->msk[fl->num] = (uint) msk;
+  fl->num++;
+
+  return (SPIFFER_OK);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// start filtering on a pipe
+//--------------------------------------------------------------------
+void spiffer_filter_start (int pipe) {
+  filter_t * fl = &filter[pipe];
+
+  fl->ts_next = false;
+  fl->ts_drop = false;
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// keep or drop a word given the filter match of an event word
+// timestamps follow their event
+//
+// returns 1 if the word is kept, 0 otherwise
+//--------------------------------------------------------------------
+static inline uint filter_word (filter_t * fl, uint e, int match) {
+  // a timestamp goes wherever its event went,
+  //NOTE: events without the no-timestamp bit are followed by one
+  if (fl->ts_next) {
+    fl->ts_next = false;
+    return (!fl->ts_drop);
+  }
+
+  // and events are dropped if matched
+  fl->evts++;
+  fl->dropped += (match != 0);
+  fl->ts_next  = !(e & SPIFFER_EVT_NO_TS);
+  fl->ts_drop  = (match != 0);
+
+  return (match == 0);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// drop events that match any filter entry of a pipe
+// kept events are compacted in place
+//
+// only event words are checked - timestamps are kept or dropped
+// together with their event
+//
+// returns the number of kept words
+//--------------------------------------------------------------------
+uint spiffer_filter_apply (int pipe, uint * evts, uint num) {
+  filter_t * fl = &filter[pipe];
+
+  if (fl->num == 0) {
+    return (num);
+  }
+
+  uint kept = 0;
+  uint i    = 0;
+
+  // check 4 words against every filter entry at a time,
+  //NOTE: kept words are written back before being overwritten
+  for (; (i + 4) <= num; i += 4) {
+    v4u e;
+    memcpy (&e, &evts[i], sizeof (e));
+
+    v4i match = {0, 0, 0, 0};
+    for (uint f = 0; f < fl->num; f++) {
+      match |= (v4i) ((e & fl->msk[f]) == fl->val[f]);
+    }
+
+    // and only then tell events from timestamps
+    for (int k = 0; k < 4; k++) {
+      evts[kept] = e[k];
+      kept += filter_word (fl, e[k], match[k]);
+    }
+  }
+
+  // and then the remaining words one at a time
+  for (; i < num; i++) {
+    uint e     = evts[i];
+    int  match = 0;
+    for (uint f = 0; f < fl->num; f++) {
+      match |= ((e & fl->msk[f]) == fl->val[f]);
+    }
+
+    evts[kept] = e;
+    kept += filter_word (fl, e, match);
+  }
+
+  return (kept);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// report filter statistics to the log file
+//--------------------------------------------------------------------
+void spiffer_filter_report (int pipe) {
+  filter_t * fl = &filter[pipe];
+
+  if (fl->num == 0) {
+    return;
+  }
+
+  log_time ();
+  fprintf (lf, "pipe%i filter: %u entries - events checked: %llu dropped: %llu\n",
+           pipe, fl->num,
+           (unsigned long long) fl->evts,
+           (unsigned long long) fl->dropped
+           );
+}
+//--------------------------------------------------------------------
@@ -0,0 +1,72 @@
+//************************************************//
+//*                                              *//
+//*          spiffer event pre-filtering         *//
+//*                                              *//
+//************************************************//
+
+#ifndef __SPIFFER_FILTER_H__
+#define __SPIFFER_FILTER_H__
+
+
+#include <cstdint>
+
+#include <sys/types.h>
+
+// spif and spiffer constants and function prototypes
+#include "spif.h"
+#include "spiffer.h"
+
+// per-pipe filter state
+//NOTE: same semantics as the spif hardware filters -
+//      events that satisfy (event & mask) == value are dropped
+typedef struct alignas (SPIFFER_CACHE_LINE) filter {
+  uint     num;       // number of filter entries
+  uint *   val;       // filter values
+  uint *   msk;       // filter masks
+  bool     ts_next;   // next word is a timestamp - split across calls
+  bool     ts_drop;   // and its event was dropped
+
+  // statistics
+  uint64_t evts;      // events checked
+  uint64_t dropped;   // events dropped
+} filter_t;
+
+
+//--------------------------------------------------------------------
+// add a filter entry to a pipe
+// arg has the form: <value> <mask>
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_filter_config (int pipe, const char * arg);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// start filtering on a pipe
+//--------------------------------------------------------------------
+void spiffer_filter_start (int pipe);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// drop events that match any filter entry of a pipe
+// kept events are compacted in place
+//
+// only event words are checked - timestamps are kept or dropped
+// together with their event
+//
+// returns the number of kept words
+//--------------------------------------------------------------------
+uint spiffer_filter_apply (int pipe, uint * evts, uint num);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// report filter statistics to the log file
+//--------------------------------------------------------------------
+void spiffer_filter_report (int pipe);
+//--------------------------------------------------------------------
+
+
+#endif /* __SPIFFER_FILTER_H__ */
@@ -0,0 +1,566 @@
+//************************************************//
+//*                                              *//
+//*      spiffer time-ordered source merging     *//
+//*                                              *//
+//* events from several UDP ports are merged     *//
+//* into a single pipe in timestamp order, using *//
+//* a lock-free ring per source and a heap of    *//
+//* sources ordered by their next event          *//
+//*                                              *//
+//************************************************//
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "spiffer_merge.h"
+#include "spiffer_batch.h"
+#include "spiffer_config.h"
+#include "spiffer_pace.h"
+#include "spiffer_rt.h"
+
+// global variables
+// spif pipes
+extern pipe_ctx_t * pipe_ctx;
+
+// spiffer configuration
+extern spiffer_cfg_t cfg;
+
+// log file
+extern FILE * lf;
+
+// per-pipe merge state
+merge_t merge[SPIFFER_PIPES_MAX];
+
+
+//--------------------------------------------------------------------
+// add a UDP port to the sources merged into a pipe
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_merge_config (int pipe, const char * arg) {
+  pipe_cfg_t * pc = &cfg.pipe[pipe];
+
+  char * end;
+  unsigned long port = strtoul (arg, &end, 0);
+  if ((end == arg) || (*end != '\0') || (port == 0) || (port > 65535)) {
+    return (SPIFFER_ERROR);
+  }
+
+  // the pipe UDP port is always a source
+  if (pc->merge_num == (SPIFFER_MERGE_SRC_MAX - 1)) {
+    return (SPIFFER_ERROR);
+  }
+
+  pc->merge_port[pc->merge_num++] = (uint) port;
+
+  return (SPIFFER_OK);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// set up the sources merged into a pipe - if configured
+// the pipe UDP port is always the first source
+//
+// sources that cannot be set up are reported and skipped
+//--------------------------------------------------------------------
+void spiffer_merge_init (int pipe) {
+  merge_t *    mg = &merge[pipe];
+  pipe_cfg_t * pc = &cfg.pipe[pipe];
+
+  mg->num = 0;
+  if (pc->merge_num == 0) {
+    return;
+  }
+
+  mg->efd = eventfd (0, EFD_NONBLOCK);
+  if (mg->efd == SPIFFER_ERROR) {
+    log_time ();
+    fprintf (lf, "warning: failed to set up merging into pipe%i - ignoring extra sources\n", pipe);
+    return;
+  }
+
+  mg->window = (uint64_t) ((pc->merge_window != 0) ?
+                           pc->merge_window : SPIFFER_MERGE_WINDOW) * 1000;
+
+  // the pipe UDP port comes first - it is read by the pipe listener,
+  for (uint i = 0; i <= pc->merge_num; i++) {
+    merge_src_t * ms = &mg->src[mg->num];
+
+    ms->pipe = pipe;
+    if (i == 0) {
+      ms->port = SPIFFER_UDP_PORT_BASE + pipe;
+      ms->skt  = pipe_ctx[pipe].udp_skt;
+    } else {
+      // and every additional port has its own producer
+      ms->port = pc->merge_port[i - 1];
+      ms->skt  = udp_bind (ms->port);
+      if (ms->skt == SPIFFER_ERROR) {
+        log_time ();
+        fprintf (lf, "warning: ignoring UDP port %i as source for pipe%i\n", ms->port, pipe);
+        continue;
+      }
+
+      if (udp_rx_init (&ms->rx, pipe, ms->skt) == SPIFFER_ERROR) {
+        close (ms->skt);
+        log_time ();
+        fprintf (lf, "warning: ignoring UDP port %i as source for pipe%i\n", ms->port, pipe);
+        continue;
+      }
+    }
+
+    ms->ring = (merge_evt_t *) malloc (SPIFFER_MERGE_DEPTH * sizeof (merge_evt_t));
+    if (ms->ring == NULL) {
+      if (i != 0) {
+        close (ms->skt);
+      }
+      log_time ();
+      fprintf (lf, "warning: ignoring UDP port %i as source for pipe%i\n", ms->port, pipe);
+      continue;
+    }
+
+    mg->num++;
+  }
+
+  // a single source needs no merging
+  if (mg->num < 2) {
+    for (int s = 0; s < mg->num; s++) {
+      free (mg->src[s].ring);
+    }
+    close (mg->efd);
+    mg->num = 0;
+    return;
+  }
+
+  log_time ();
+  fprintf (lf, "merging %i UDP sources into pipe%i [reorder window %llu us]\n",
+           mg->num, pipe, (unsigned long long) (mg->window / 1000));
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// start the producer threads of the sources merged into a pipe
+//
+// called by the pipe listener before it produces events
+//--------------------------------------------------------------------
+void spiffer_merge_start (int pipe) {
+  merge_t * mg = &merge[pipe];
+
+  // listeners restart - drop events from the previous run,
+  for (int s = 0; s < mg->num; s++) {
+    merge_src_t * ms = &mg->src[s];
+
+    ms->head.store (0);
+    ms->tail.store (0);
+    ms->ts_next = false;
+    ms->started = false;
+
+    mg->in_heap[s] = false;
+  }
+
+  mg->heap_num    = 0;
+  mg->out_started = false;
+
+  // and start producers - the pipe listener reads its own port
+  for (int s = 1; s < mg->num; s++) {
+    mg->src[s].running = (spiffer_rt_create (&mg->src[s].thread,
+                                             spiffer_merge_listener, (void *) &mg->src[s], "merge source") == 0);
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// stop the producer threads of the sources merged into a pipe
+//
+// runs as a cleanup handler when the pipe listener is cancelled
+//--------------------------------------------------------------------
+void spiffer_merge_stop (void * data) {
+  merge_t * mg = &merge[*((int *) data)];
+
+  for (int s = 1; s < mg->num; s++) {
+    if (mg->src[s].running) {
+      (void) pthread_cancel (mg->src[s].thread);
+      pthread_join (mg->src[s].thread, NULL);
+      mg->src[s].running = false;
+    }
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// close the sockets of the sources merged into a pipe
+//--------------------------------------------------------------------
+void spiffer_merge_close (int pipe) {
+  merge_t * mg = &merge[pipe];
+
+  if (mg->num == 0) {
+    return;
+  }
+
+  // the pipe UDP port is closed with the rest
+  for (int s = 1; s < mg->num; s++) {
+    merge_src_t * ms = &mg->src[s];
+
+    close (ms->skt);
+
+    free (ms->rx.msgs);
+    free (ms->rx.iovs);
+    free (ms->rx.ctrl);
+    free (ms->rx.buf);
+  }
+
+  for (int s = 0; s < mg->num; s++) {
+    free (mg->src[s].ring);
+  }
+
+  close (mg->efd);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// receive events through an additional UDP port
+// and hold them to be merged into a pipe
+//
+// terminated when the pipe listener is cancelled
+//--------------------------------------------------------------------
+void * spiffer_merge_listener (void * data) {
+  merge_src_t * ms = (merge_src_t *) data;
+  merge_t *     mg = &merge[ms->pipe];
+  int           src = ms - mg->src;
+
+  // block signals - should be handled in a different thread
+  sigset_t set;
+  sigfillset (&set);
+  sigprocmask (SIG_BLOCK, &set, NULL);
+
+  // pin thread and set its priority - as the pipe listener
+  spiffer_rt_thread (RT_INPUT, ms->pipe, "merge");
+
+  log_time ();
+  fprintf (lf, "listening UDP %i -> pipe%i [merged]\n", ms->port, ms->pipe);
+  (void) fflush (lf);
+
+  uint64_t sig = 1;
+  while (1) {
+    // get all queued datagrams,
+    //NOTE: this is a thread cancellation point
+    int rcv_msgs = udp_rx_recv (&ms->rx, ms->skt);
+    if (rcv_msgs <= 0) {
+      continue;
+    }
+
+    // hold their events,
+    for (int m = 0; m < rcv_msgs; m++) {
+      udp_rx_add (&ms->rx, ms->pipe, src, &ms->rx.msgs[m]);
+    }
+
+    // and let the pipe listener know
+    (void) write (mg->efd, &sig, sizeof (sig));
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// hold an event in its source ring
+//
+// runs in the producer - no locks required
+//--------------------------------------------------------------------
+static void merge_hold (merge_src_t * ms, uint evt, bool has_ts, uint64_t arr) {
+  uint tl = ms->tail.load (std::memory_order_relaxed);
+
+  if ((tl - ms->head.load (std::memory_order_acquire)) == SPIFFER_MERGE_DEPTH) {
+    ms->overflow++;
+    return;
+  }
+
+  merge_evt_t * me = &ms->ring[tl & (SPIFFER_MERGE_DEPTH - 1)];
+  me->ts     = ms->ts_ext;
+  me->arr    = arr;
+  me->evt    = evt;
+  me->has_ts = has_ts;
+
+  ms->tail.store (tl + 1, std::memory_order_release);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// hold the events of a source to be merged into a pipe
+//
+// events go straight to pacing if the pipe has a single source
+//--------------------------------------------------------------------
+void spiffer_merge_add (int pipe, int src, uint * evts, uint num) {
+  merge_t * mg = &merge[pipe];
+
+  if (mg->num == 0) {
+    spiffer_pace_add (pipe, evts, num);
+    return;
+  }
+
+  merge_src_t * ms  = &mg->src[src];
+  uint64_t      arr = spiffer_batch_now ();
+
+  ms->evts += num;
+
+  for (uint i = 0; i < num; i++) {
+    uint w = evts[i];
+
+    // timestamps may arrive in a different datagram than their event,
+    if (ms->ts_next) {
+      ms->ts_next = false;
+
+      // extend timestamps to 64 bits - they wrap around
+      if (!ms->started) {
+        ms->started = true;
+        ms->ts_ext  = w;
+      } else {
+        ms->ts_ext += (int) (w - ms->ts_last);
+      }
+      ms->ts_last = w;
+
+      merge_hold (ms, ms->ts_evt, true, arr);
+      continue;
+    }
+
+    // events without timestamp go with the previous one,
+    if (w & SPIFFER_EVT_NO_TS) {
+      merge_hold (ms, w, false, arr);
+      continue;
+    }
+
+    // and timestamped events wait for their timestamp
+    ms->ts_next = true;
+    ms->ts_evt  = w;
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// get the next event held by a source - NULL if none
+//--------------------------------------------------------------------
+static merge_evt_t * merge_next (merge_src_t * ms) {
+  uint hd = ms->head.load (std::memory_order_relaxed);
+
+  if (hd == ms->tail.load (std::memory_order_acquire)) {
+    return (NULL);
+  }
+
+  return (&ms->ring[hd & (SPIFFER_MERGE_DEPTH - 1)]);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// check if the next event of source a goes before that of source b
+//--------------------------------------------------------------------
+static bool merge_before (merge_t * mg, int a, int b) {
+  uint64_t ta = merge_next (&mg->src[a])->ts;
+  uint64_t tb = merge_next (&mg->src[b])->ts;
+
+  return ((ta < tb) || ((ta == tb) && (a < b)));
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// move a heap entry towards the root while it goes first
+//--------------------------------------------------------------------
+static void merge_sift_up (merge_t * mg, int i) {
+  while (i > 0) {
+    int p = (i - 1) / 2;
+    if (!merge_before (mg, mg->heap[i], mg->heap[p])) {
+      break;
+    }
+
+    int t = mg->heap[i]; mg->heap[i] = mg->heap[p]; mg->heap[p] = t;
+    i = p;
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// move a heap entry towards the leaves while it does not go first
+//--------------------------------------------------------------------
+static void merge_sift_down (merge_t * mg, int i) {
+  while (1) {
+    int f = i;
+    int l = 2 * i + 1;
+    int r = l + 1;
+
+    if ((l < mg->heap_num) && merge_before (mg, mg->heap[l], mg->heap[f])) {
+      f = l;
+    }
+
+    if ((r < mg->heap_num) && merge_before (mg, mg->heap[r], mg->heap[f])) {
+      f = r;
+    }
+
+    if (f == i) {
+      break;
+    }
+
+    int t = mg->heap[i]; mg->heap[i] = mg->heap[f]; mg->heap[f] = t;
+    i = f;
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// forward held events in timestamp order
+//
+// an event is forwarded when every source has events held or
+// when it has been held for longer than the reorder window
+//--------------------------------------------------------------------
+void spiffer_merge_poll (int pipe) {
+  merge_t * mg = &merge[pipe];
+
+  if (mg->num == 0) {
+    return;
+  }
+
+  // clear producer signals,
+  uint64_t sig;
+  (void) read (mg->efd, &sig, sizeof (sig));
+
+  // add sources with new events to the heap,
+  for (int s = 0; s < mg->num; s++) {
+    if (!mg->in_heap[s] && (merge_next (&mg->src[s]) != NULL)) {
+      mg->in_heap[s] = true;
+      mg->heap[mg->heap_num++] = s;
+      merge_sift_up (mg, mg->heap_num - 1);
+    }
+  }
+
+  uint64_t now = spiffer_batch_now ();
+  uint     buf[SPIFFER_BATCH_SIZE];
+  uint     cnt = 0;
+
+  // and forward events while their order is known - or is overdue
+  while (mg->heap_num != 0) {
+    int           s  = mg->heap[0];
+    merge_src_t * ms = &mg->src[s];
+    merge_evt_t * me = merge_next (ms);
+
+    if ((mg->heap_num < mg->num) && (now < (me->arr + mg->window))) {
+      break;
+    }
+
+    // events that go after later ones make their source late,
+    if (mg->out_started && (me->ts < mg->out_ts)) {
+      ms->late++;
+      if ((mg->out_ts - me->ts) > ms->late_max) {
+        ms->late_max = mg->out_ts - me->ts;
+      }
+    } else {
+      mg->out_started = true;
+      mg->out_ts      = me->ts;
+    }
+
+    // forward event - with its timestamp,
+    if ((cnt + 2) > SPIFFER_BATCH_SIZE) {
+      spiffer_pace_add (pipe, buf, cnt);
+      cnt = 0;
+    }
+
+    buf[cnt++] = me->evt;
+    if (me->has_ts) {
+      buf[cnt++] = (uint) me->ts;
+    }
+
+    ms->head.store (ms->head.load (std::memory_order_relaxed) + 1,
+                    std::memory_order_release);
+
+    // and update the source position in the heap
+    if (merge_next (ms) != NULL) {
+      merge_sift_down (mg, 0);
+    } else {
+      mg->in_heap[s] = false;
+      mg->heap[0] = mg->heap[--mg->heap_num];
+      merge_sift_down (mg, 0);
+    }
+  }
+
+  spiffer_pace_add (pipe, buf, cnt);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// get the file descriptor signalled when producers hold new events
+//
+// returns -1 if the pipe has a single source
+//--------------------------------------------------------------------
+int spiffer_merge_fd (int pipe) {
+  merge_t * mg = &merge[pipe];
+
+  return ((mg->num == 0) ? -1 : mg->efd);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// get time left until the reorder window of the next event expires
+// or the given timeout, whichever comes first
+//
+// returns NULL if neither exists
+//--------------------------------------------------------------------
+struct timespec * spiffer_merge_timeout (int pipe,
+                                         struct timespec * to,
+                                         struct timespec * ts
+                                         ) {
+  merge_t * mg = &merge[pipe];
+
+  if ((mg->num == 0) || (mg->heap_num == 0)) {
+    return (to);
+  }
+
+  uint64_t now  = spiffer_batch_now ();
+  uint64_t exp  = merge_next (&mg->src[mg->heap[0]])->arr + mg->window;
+  uint64_t left = (exp > now) ? exp - now : 0;
+
+  if ((to != NULL) &&
+      (((uint64_t) to->tv_sec * 1000000000 + to->tv_nsec) <= left)) {
+    return (to);
+  }
+
+  ts->tv_sec  = left / 1000000000;
+  ts->tv_nsec = left % 1000000000;
+
+  return (ts);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// report merge statistics to the log file
+//--------------------------------------------------------------------
+void spiffer_merge_report (int pipe) {
+  merge_t * mg = &merge[pipe];
+
+  for (int s = 0; s < mg->num; s++) {
+    merge_src_t * ms = &mg->src[s];
+
+    log_time ();
+    fprintf (lf, "pipe%i merge UDP %i: events: %llu overflow: %llu late: %llu late max: %llu us\n",
+             pipe, ms->port,
+             (unsigned long long) ms->evts,
+             (unsigned long long) ms->overflow,
+             (unsigned long long) ms->late,
+             (unsigned long long) ms->late_max
+             );
+  }
+}
+//--------------------------------------------------------------------
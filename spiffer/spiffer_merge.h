@@ -0,0 +1,184 @@
+//************************************************//
+//*                                              *//
+//*      spiffer time-ordered source merging     *//
+//*                                              *//
+//************************************************//
+
+#ifndef __SPIFFER_MERGE_H__
+#define __SPIFFER_MERGE_H__
+
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+#include <pthread.h>
+#include <sys/types.h>
+
+// spif and spiffer constants and function prototypes
+#include "spif.h"
+#include "spiffer.h"
+
+// events held per source - must be a power of 2
+#define SPIFFER_MERGE_DEPTH   16384
+
+// reorder window (us) - default
+#define SPIFFER_MERGE_WINDOW  10000
+
+// held event
+typedef struct merge_evt {
+  uint64_t ts;          // timestamp - extended to 64 bits (us)
+  uint64_t arr;         // arrival time (ns)
+  uint     evt;         // event
+  bool     has_ts;      // event carried a timestamp
+} merge_evt_t;
+
+// merge source - a single-producer/single-consumer ring
+//NOTE: the producer owns tail and the parse state,
+//      the consumer (pipe listener) owns head
+typedef struct merge_src {
+  int                pipe;
+  int                port;       // UDP port
+  int                skt;        // UDP socket
+  udp_rx_t           rx;         // batched reception
+  pthread_t          thread;     // producer - not used by own source
+  bool               running;    // producer thread started
+
+  merge_evt_t *      ring;
+  std::atomic<uint>  head;
+  std::atomic<uint>  tail;
+
+  // producer parse state
+  bool               ts_next;    // next word is a timestamp
+  uint               ts_evt;     // event waiting for its timestamp
+  bool               started;    // first timestamp seen
+  uint               ts_last;    // last timestamp
+  uint64_t           ts_ext;     // last timestamp - extended
+
+  // statistics
+  uint64_t           evts;       // events received
+  uint64_t           overflow;   // events dropped - ring full
+  uint64_t           late;       // events merged out of order
+  uint64_t           late_max;   // largest time disorder (us)
+} merge_src_t;
+
+// per-pipe merge state
+typedef struct alignas (SPIFFER_CACHE_LINE) merge {
+  int          num;                            // sources - 0: no merging
+  merge_src_t  src[SPIFFER_MERGE_SRC_MAX];
+  int          efd;                            // producers signal new events
+  uint64_t     window;                         // reorder window (ns)
+
+  // sources ordered by their next event (binary heap)
+  int          heap[SPIFFER_MERGE_SRC_MAX];
+  int          heap_num;
+  bool         in_heap[SPIFFER_MERGE_SRC_MAX];
+
+  bool         out_started;
+  uint64_t     out_ts;                         // latest merged timestamp
+} merge_t;
+
+
+//--------------------------------------------------------------------
+// add a UDP port to the sources merged into a pipe
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_merge_config (int pipe, const char * arg);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// set up the sources merged into a pipe - if configured
+// the pipe UDP port is always the first source
+//
+// sources that cannot be set up are reported and skipped
+//--------------------------------------------------------------------
+void spiffer_merge_init (int pipe);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// start the producer threads of the sources merged into a pipe
+//
+// called by the pipe listener before it produces events
+//--------------------------------------------------------------------
+void spiffer_merge_start (int pipe);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// stop the producer threads of the sources merged into a pipe
+//
+// runs as a cleanup handler when the pipe listener is cancelled
+//--------------------------------------------------------------------
+void spiffer_merge_stop (void * data);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// close the sockets of the sources merged into a pipe
+//--------------------------------------------------------------------
+void spiffer_merge_close (int pipe);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// receive events through an additional UDP port
+// and hold them to be merged into a pipe
+//
+// terminated when the pipe listener is cancelled
+//--------------------------------------------------------------------
+void * spiffer_merge_listener (void * data);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// hold the events of a source to be merged into a pipe
+//
+// events go straight to pacing if the pipe has a single source
+//--------------------------------------------------------------------
+void spiffer_merge_add (int pipe, int src, uint * evts, uint num);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// forward held events in timestamp order
+//
+// an event is forwarded when every source has events held or
+// when it has been held for longer than the reorder window
+//--------------------------------------------------------------------
+void spiffer_merge_poll (int pipe);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// get the file descriptor signalled when producers hold new events
+//
+// returns -1 if the pipe has a single source
+//--------------------------------------------------------------------
+int spiffer_merge_fd (int pipe);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// get time left until the reorder window of the next event expires
+// or the given timeout, whichever comes first
+//
+// returns NULL if neither exists
+//--------------------------------------------------------------------
+struct timespec * spiffer_merge_timeout (int pipe,
+                                         struct timespec * to,
+                                         struct timespec * ts
+                                         );
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// report merge statistics to the log file
+//--------------------------------------------------------------------
+void spiffer_merge_report (int pipe);
+//--------------------------------------------------------------------
+
+
+#endif /* __SPIFFER_MERGE_H__ */
@@ -4,260 +4,397 @@
 //*                                              *//
 //* lap - 11/08/2023                             *//
 //*                                              *//
+//* built as a camera plugin - spiffer_meta.so   *//
+//*                                              *//
 //************************************************//
 
-#include "spiffer_meta_support.h"
-
-// global variables
-// spif pipes
-extern uint * pipe_buf[SPIF_HW_PIPES_NUM];
-
-// USB devices
-extern usb_devs_t      usb_devs;
-extern pthread_mutex_t usb_mtx;
+#include <cstdlib>
+#include <cstring>
 
-// log file
-extern FILE * lf;
+#include "spiffer_meta_support.h"
 
-// used to pass integers as (void *)
-extern int dev_to_ptr[SPIFFER_USB_DISCOVER_CNT + 1];
+// spiffer services
+static const plugin_host_t * host;
 
 
 //--------------------------------------------------------------------
 // include here any Metavision SDK initialisation
 //--------------------------------------------------------------------
-void spiffer_meta_init (void) {
+static int meta_init (const plugin_host_t * hst) {
+  host = hst;
+
   // do not show Metavision warnings
   setenv ("MV_LOG_LEVEL", "ERROR", 1);
+
+  return (SPIFFER_OK);
 }
 //--------------------------------------------------------------------
 
 
 //--------------------------------------------------------------------
-// attempt to discover and open cameras supported by Metavision SDK
+// find cameras supported by Metavision SDK
+//
+// returns the number of ids
 //--------------------------------------------------------------------
-void spiffer_meta_discover_devs (void) {
-  if (!SPIFFER_USB_MIX_CAMERAS && (usb_devs.cnt != 0)) {
-    log_time ();
-    fprintf (lf, "warning: Prophesee discovery cancelled - camera mixing disallowed\n");
-    (void) fflush (lf);
-    return;
-  }
-
-  // number of discovered devices
-  int ndd = 0;
-
-  // Prophesee devices take a bit of time to start up
-  sleep (SPIFFER_META_DISCOVER_DLY);
+static int meta_discover (char (* ids)[SPIFFER_PLUGIN_ID_SIZE], int max) {
+  int num = 0;
 
   // find prophesee devices
   auto v = Metavision::DeviceDiscovery::list();
 
-  // identify each device found
-  std::unique_ptr<Metavision::Device> device;
-  if (v.size ()) {
-    for (auto s : v) {
-      try {
-        // open device
-        device = Metavision::DeviceDiscovery::open(s);
-      } catch (int err) {
-        log_time ();
-        fprintf (lf, "error %i: cannot open device: %s\n", err, s.c_str ());
-        continue;
-      }
-
-      // get camera info
-      Metavision::I_HW_Identification *hw_identification = device->get_facility<Metavision::I_HW_Identification>();
+  for (auto s : v) {
+    if (num >= max) {
+      break;
+    }
 
-      // report camera info
-      log_time ();
-      fprintf (lf, "%s\n", s.c_str ());
+    (void) snprintf (ids[num++], SPIFFER_PLUGIN_ID_SIZE, "%s", s.c_str ());
+  }
 
-      // remember device type
-      usb_devs.params[usb_devs.cnt].type = META;
+  return (num);
+}
+//--------------------------------------------------------------------
 
-      // remember device serial number
-      (void) strcpy (usb_devs.params[usb_devs.cnt].sn, hw_identification->get_system_info()["Serial"].c_str ());
 
-      // remember device handle
-      usb_devs.params[usb_devs.cnt].meta_hdl = std::move (device);
+//--------------------------------------------------------------------
+// open a camera found by discovery
+//
+// returns the camera or NULL on error
+//--------------------------------------------------------------------
+static void * meta_open (const char * id) {
+  std::unique_ptr<Metavision::Device> device;
 
-      // update device count
-      usb_devs.cnt++;
-      ndd++;
+  try {
+    // open device
+    device = Metavision::DeviceDiscovery::open(id);
+  } catch (const std::exception & e) {
+    host->log ("error: cannot open device: %s", e.what ());
+    return (NULL);
+  }
 
-      if (usb_devs.cnt >= SPIFFER_META_DISCOVER_CNT) {
-        break;
-      }
-    }
+  if (!device) {
+    return (NULL);
   }
 
-  log_time ();
-  fprintf (lf, "discovered %i Prophesee device%c\n", ndd, ndd == 1 ? ' ' : 's');
-  (void) fflush (lf);
+  meta_dev_t * md = new meta_dev_t ();
+  md->dev = std::move (device);
 
-  return;
+  return (md);
 }
 //--------------------------------------------------------------------
 
 
 //--------------------------------------------------------------------
-// receive events from a USB device and forward them to spif
-// map them to spif events with format:
+// get the serial number of a camera
 //
-//    [31] timestamp (0: present, 1: absent)
-// [30:16] 15-bit x coordinate
-//    [15] polarity
-//  [14:0] 15-bit y coordinate
-//
-// timestamps are ignored - time models itself
-//
-// terminated as a result of signal servicing
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
 //--------------------------------------------------------------------
-void * spiffer_meta_usb_listener (void * data) {
-  int dev  = *((int *) data);
-  int pipe = usb_devs.params[dev].pipe;
-
-  // block signals - should be handled in a different thread
-  sigset_t set;
-  sigfillset (&set);
-  sigprocmask (SIG_BLOCK, &set, NULL);
+static int meta_serial (void * dev, char * sn, size_t size) {
+  Metavision::I_HW_Identification * hw_identification =
+    ((meta_dev_t *) dev)->dev->get_facility<Metavision::I_HW_Identification>();
 
-  uint *                               sb = pipe_buf[pipe];
-  std::unique_ptr<Metavision::Device>  ud = std::move (usb_devs.params[dev].meta_hdl);
+  if (!hw_identification) {
+    sn[0] = '\0';
+    return (SPIFFER_ERROR);
+  }
 
-  Metavision::I_EventsStream                      * events_stream         = nullptr;
-  Metavision::I_EventsStreamDecoder               * events_stream_decoder = nullptr;
-  Metavision::I_EventDecoder<Metavision::EventCD> * cd_event_decoder;
-  Metavision::I_EventsStream::RawData             * ev_raw_data;
+  (void) snprintf (sn, size, "%s", hw_identification->get_system_info()["Serial"].c_str ());
 
-  uint evt_ctr = 0;
-  long rcv_bytes;
+  return (SPIFFER_OK);
+}
+//--------------------------------------------------------------------
 
-  // open event stream
-  events_stream = ud->get_facility<Metavision::I_EventsStream>();
-  if (!events_stream) {
-    log_time ();
-    fprintf (lf, "error: failed to start camera event transmission\n");
-    (void) fflush (lf);
 
-    return (nullptr);
+//--------------------------------------------------------------------
+// start camera event transmission
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+static int meta_start (void * dev, const plugin_start_t * ps, uint * width, uint * height,
+                       char * info, size_t size) {
+  meta_dev_t *         md = (meta_dev_t *) dev;
+  Metavision::Device * ud = md->dev.get ();
+
+  // decode raw data natively - if the format is supported and not disabled
+  md->format = EVT_NONE;
+  Metavision::I_HW_Identification * hw_identification = ud->get_facility<Metavision::I_HW_Identification>();
+  if (hw_identification && (ps->sdk_decoder == 0)) {
+    md->format = spiffer_evt_format (hw_identification->get_current_data_encoding_format ().c_str ());
   }
 
-  // get event stream dispatcher
-  events_stream_decoder = ud->get_facility<Metavision::I_EventsStreamDecoder>();
+  spiffer_evt_init (&md->dec, md->format);
+
+  // open event stream
+  md->stream = ud->get_facility<Metavision::I_EventsStream>();
+  if (!md->stream) {
+    return (SPIFFER_ERROR);
+  }
 
   // get CD (contrast detection) event decoder
-  cd_event_decoder = ud->get_facility<Metavision::I_EventDecoder<Metavision::EventCD>>();
+  Metavision::I_EventDecoder<Metavision::EventCD> * cd_event_decoder =
+    ud->get_facility<Metavision::I_EventDecoder<Metavision::EventCD>>();
 
-  // register event processing callback
-  if (cd_event_decoder) {
+  // register event processing callback - not used by the native decoder
+  //NOTE: events are kept until they fit in a batch
+  if (cd_event_decoder && (md->format == EVT_NONE)) {
     // Register a lambda function to be called on every CD event
     cd_event_decoder->add_event_buffer_callback (
-      [pipe, sb, &evt_ctr](const Metavision::EventCD *first, const Metavision::EventCD *last) {
+      [md](const Metavision::EventCD *first, const Metavision::EventCD *last) {
         for (auto it = first; it != last; ++it) {
           uint pol = it->p;
           uint x   = it->x;
           uint y   = it->y;
 
-          // format event and store in buffer
-          sb[evt_ctr] = SPIFFER_EVT_NO_TS | (x << SPIFFER_EVT_X_SHIFT) | (pol << SPIFFER_EVT_P_SHIFT) | (y << SPIFFER_EVT_Y_SHIFT);
-          if (++evt_ctr == SPIFFER_BATCH_SIZE) {
-            // trigger a transfer to SpiNNaker
-            spif_transfer (pipe, evt_ctr);
-
-            // wait until spif finishes the current transfer
-            //NOTE: report when waiting too long!
-            int wc = 0;
-            while (spif_busy (pipe)) {
-              wc++;
-              if (wc < 0) {
-                log_time ();
-                fprintf (lf, "warning: spif not responding\n");
-                (void) fflush (lf);
-                wc = 0;
-              }
-            }
-
-            evt_ctr = 0;
-          }
+          // format event and keep it - with its timestamp
+          md->sdk_ts.push_back ((uint) it->t);
+          md->sdk_evts.push_back (SPIFFER_EVT_NO_TS | (x << SPIFFER_EVT_X_SHIFT) | (pol << SPIFFER_EVT_P_SHIFT) | (y << SPIFFER_EVT_Y_SHIFT));
         }
       }
     );
   }
 
-  // start streaming events
-  events_stream->start ();
+  // report sensor size,
+  Metavision::I_Geometry * geometry = ud->get_facility<Metavision::I_Geometry>();
+  if (geometry) {
+    *width  = geometry->get_width ();
+    *height = geometry->get_height ();
+  }
 
-  log_time ();
-  fprintf (lf, "listening USB %s -> pipe%i\n", usb_devs.params[dev].sn, pipe);
-  (void) fflush (lf);
+  // and decoder
+  (void) snprintf (info, size, "%s decoder",
+           (md->format == EVT_2) ? "EVT 2.0 native" : ((md->format == EVT_3) ? "EVT 3.0 native" : "SDK"));
 
-  while (1) {
-    // this is a safe place to cancel this thread
-    pthread_setcancelstate (PTHREAD_CANCEL_ENABLE, 0);
-    pthread_testcancel ();
-    pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, 0);
+  // start streaming events
+  md->stream->start ();
 
-    // process next batch of events
-    short rc = events_stream->wait_next_buffer();
+  return (SPIFFER_OK);
+}
+//--------------------------------------------------------------------
 
-    // an error (rc < 0) usually means that the camera was disconnected
-    if (rc < 0) {
-      log_time ();
-      fprintf (lf, "warning: device %s stopped responding\n", usb_devs.params[dev].sn);
-      (void) fflush (lf);
 
-      // trigger a device survey
-      usb_survey_devs (&dev_to_ptr[dev]);
+//--------------------------------------------------------------------
+// fill a batch with events from the camera read being decoded
+//--------------------------------------------------------------------
+static void meta_decode (meta_dev_t * md, plugin_batch_t * batch) {
+  // events decoded by the SDK are copied,
+  if (md->format == EVT_NONE) {
+    size_t num = md->sdk_evts.size () - md->sdk_next;
+    if (num > batch->cap) {
+      num = batch->cap;
+    }
 
-      // shutdown disconnected camera
-      spiffer_meta_shutdown_dev (dev);
+    memcpy (batch->evts, md->sdk_evts.data () + md->sdk_next, num * sizeof (uint));
+    memcpy (batch->ts, md->sdk_ts.data () + md->sdk_next, num * sizeof (uint));
+    batch->num    = num;
+    md->sdk_next += num;
 
-      // wait for thread cancelling
-      pause ();
+    if (md->sdk_next == md->sdk_evts.size ()) {
+      md->left = 0;
     }
+  } else {
+    // or decoded natively - straight into the batch
+    size_t used;
+    batch->num = spiffer_evt_decode (&md->dec, md->raw, md->left, &used, batch->evts, batch->ts, batch->cap);
+
+    //NOTE: a trailing partial word is dropped - reads end on word boundaries
+    if (used == 0) {
+      md->left = 0;
+    }
+    md->raw  += used;
+    md->left -= used;
+  }
+
+  // send them together once the read is done - and reads add up to the budget
+  if (md->left == 0) {
+    batch->end   = true;
+    batch->bytes = md->bytes;
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// fill a batch with spif events
+// map them to spif events with format:
+//
+//    [31] timestamp (0: present, 1: absent)
+// [30:16] 15-bit x coordinate
+//    [15] polarity
+//  [14:0] 15-bit y coordinate
+//
+// timestamps are only used to process events (e.g., denoising)
+// and are not forwarded - time models itself
+//
+// a camera read may take several batches
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR if disconnected
+//--------------------------------------------------------------------
+static int meta_fill_batch (void * dev, plugin_batch_t * batch) {
+  meta_dev_t * md = (meta_dev_t *) dev;
+
+  // finish the current read first,
+  if (md->left != 0) {
+    meta_decode (md, batch);
+    return (SPIFFER_OK);
+  }
+
+  // process next batch of events
+  short rc = md->stream->wait_next_buffer();
+
+  // an error (rc < 0) usually means that the camera was disconnected
+  if (rc < 0) {
+    return (SPIFFER_ERROR);
+  }
+
+  // if buffer empty send queued events
+  if (rc == 0) {
+    batch->end = true;
+    return (SPIFFER_OK);
+  }
 
-    // if buffer empty try again
-    if (rc == 0) {
-      continue;
+  // decode events,
+  long rcv_bytes;
+  md->raw   = md->stream->get_latest_raw_data (rcv_bytes);
+  md->left  = rcv_bytes;
+  md->bytes = rcv_bytes;
+
+  if (md->format == EVT_NONE) {
+    md->sdk_evts.clear ();
+    md->sdk_ts.clear ();
+    md->sdk_next = 0;
+
+    Metavision::I_EventsStreamDecoder * events_stream_decoder =
+      md->dev->get_facility<Metavision::I_EventsStreamDecoder>();
+    if (events_stream_decoder) {
+      events_stream_decoder->decode(md->raw, md->raw + rcv_bytes);
     }
+  }
 
-    ev_raw_data = events_stream->get_latest_raw_data (rcv_bytes);
+  // and fill the batch
+  meta_decode (md, batch);
 
-    events_stream_decoder->decode(ev_raw_data, ev_raw_data + rcv_bytes);
+  return (SPIFFER_OK);
+}
+//--------------------------------------------------------------------
 
-    // trigger a transfer to SpiNNaker
-    if (evt_ctr != 0) {
-      spif_transfer (pipe, evt_ctr);
+
+//--------------------------------------------------------------------
+// apply sensor settings to a camera - event rate controller, region
+// of interest, anti-flicker filter and biases
+// settings the camera does not support are reported and skipped
+//--------------------------------------------------------------------
+static void meta_sensor (void * dev, int pipe, const sensor_cfg_t * sc) {
+  Metavision::Device * ud = ((meta_dev_t *) dev)->dev.get ();
+
+  // event rate controller,
+  if (sc->erc_set) {
+    Metavision::I_ErcModule * erc = ud->get_facility<Metavision::I_ErcModule>();
+
+    try {
+      if (!erc) {
+        host->log ("warning: pipe%i camera has no event rate controller", pipe);
+      } else if (sc->erc_rate == 0) {
+        (void) erc->enable (false);
+        host->log ("pipe%i sensor: event rate controller off", pipe);
+      } else {
+        (void) erc->set_cd_event_rate (sc->erc_rate);
+        (void) erc->enable (true);
+        host->log ("pipe%i sensor: event rate controller %u events/s", pipe, erc->get_cd_event_rate ());
+      }
+    } catch (const std::exception & e) {
+      host->log ("warning: pipe%i sensor event rate %u rejected: %s", pipe, sc->erc_rate, e.what ());
     }
+  }
 
-    // wait until spif finishes the current transfer
-    //NOTE: report when waiting too long!
-    int wc = 0;
-    while (spif_busy (pipe)) {
-      wc++;
-      if (wc < 0) {
-        log_time ();
-        fprintf (lf, "warning: spif not responding\n");
-        (void) fflush (lf);
-        wc = 0;
+  // region of interest,
+  if (sc->roi_set) {
+    Metavision::I_ROI * roi = ud->get_facility<Metavision::I_ROI>();
+
+    try {
+      if (!roi) {
+        host->log ("warning: pipe%i camera has no region of interest", pipe);
+      } else if ((sc->roi_w == 0) || (sc->roi_h == 0)) {
+        (void) roi->enable (false);
+        host->log ("pipe%i sensor: region of interest off", pipe);
+      } else {
+        (void) roi->set_window (Metavision::I_ROI::Window (sc->roi_x, sc->roi_y, sc->roi_w, sc->roi_h));
+        (void) roi->enable (true);
+        host->log ("pipe%i sensor: region of interest %ux%u at (%u, %u)",
+                   pipe, sc->roi_w, sc->roi_h, sc->roi_x, sc->roi_y);
       }
+    } catch (const std::exception & e) {
+      host->log ("warning: pipe%i sensor region of interest rejected: %s", pipe, e.what ());
     }
+  }
 
-    evt_ctr = 0;
+  // anti-flicker filter,
+  if (sc->flicker_set) {
+    Metavision::I_AntiFlickerModule * afk = ud->get_facility<Metavision::I_AntiFlickerModule>();
+
+    try {
+      if (!afk) {
+        host->log ("warning: pipe%i camera has no anti-flicker filter", pipe);
+      } else if (sc->flicker_high == 0) {
+        (void) afk->enable (false);
+        host->log ("pipe%i sensor: anti-flicker filter off", pipe);
+      } else {
+        (void) afk->set_frequency_band (sc->flicker_low, sc->flicker_high);
+        (void) afk->enable (true);
+        host->log ("pipe%i sensor: anti-flicker filter %u-%u Hz", pipe, sc->flicker_low, sc->flicker_high);
+      }
+    } catch (const std::exception & e) {
+      host->log ("warning: pipe%i sensor anti-flicker band rejected: %s", pipe, e.what ());
+    }
+  }
+
+  // and biases
+  Metavision::I_LL_Biases * biases = ud->get_facility<Metavision::I_LL_Biases>();
+  for (uint b = 0; b < sc->bias_num; b++) {
+    const sensor_bias_t * sb = &sc->bias[b];
+
+    try {
+      if (!biases) {
+        host->log ("warning: pipe%i camera biases cannot be set", pipe);
+      } else if (!biases->set (sb->name, sb->value)) {
+        host->log ("warning: pipe%i sensor bias %s %i rejected", pipe, sb->name, sb->value);
+      } else {
+        host->log ("pipe%i sensor: bias %s %i", pipe, sb->name, biases->get (sb->name));
+      }
+    } catch (const std::exception & e) {
+      host->log ("warning: pipe%i sensor bias %s %i rejected: %s", pipe, sb->name, sb->value, e.what ());
+    }
   }
 }
 //--------------------------------------------------------------------
 
 
 //--------------------------------------------------------------------
-// shutdown device
-//
-//TODO: needs updating!
+// stop and close a camera
 //--------------------------------------------------------------------
-void spiffer_meta_shutdown_dev (int dev) {
+static void meta_close (void * dev) {
   // destroy camera object
-  usb_devs.params[dev].meta_hdl.reset ();
+  delete (meta_dev_t *) dev;
+}
+//--------------------------------------------------------------------
+
+
+// Metavision SDK camera plugin
+static const spiffer_plugin_t meta_plugin = {
+  SPIFFER_PLUGIN_ABI,
+  meta_init,
+  meta_discover,
+  meta_open,
+  meta_serial,
+  meta_start,
+  meta_fill_batch,
+  meta_sensor,
+  meta_close
+};
+
+
+//--------------------------------------------------------------------
+// plugin entry point
+//--------------------------------------------------------------------
+extern "C" const spiffer_plugin_t * spiffer_plugin_get (void) {
+  return (&meta_plugin);
 }
 //--------------------------------------------------------------------
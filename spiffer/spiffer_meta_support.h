@@ -17,57 +17,38 @@
 #include <metavision/hal/facilities/i_event_decoder.h>
 #include <metavision/hal/facilities/i_events_stream.h>
 #include <metavision/hal/facilities/i_events_stream_decoder.h>
+#include <metavision/hal/facilities/i_geometry.h>
+#include <metavision/hal/facilities/i_erc_module.h>
+#include <metavision/hal/facilities/i_roi.h>
+#include <metavision/hal/facilities/i_antiflicker_module.h>
+#include <metavision/hal/facilities/i_ll_biases.h>
 
-#include <unistd.h>
-#include <signal.h>
+#include <memory>
+#include <vector>
 
 // spif and spiffer constants and function prototypes
 #include "spif.h"
 #include "spiffer.h"
 
-#define SPIFFER_META_DISCOVER_CNT  SPIFFER_USB_DISCOVER_CNT
-#define SPIFFER_META_DISCOVER_DLY  1
-
-int spif_busy (uint pipe);
-int spif_transfer (uint pipe, int length);
-
-
-//--------------------------------------------------------------------
-// include here any Metavision SDK initialisation
-//--------------------------------------------------------------------
-void spiffer_meta_init (void);
-//--------------------------------------------------------------------
-
-
-//--------------------------------------------------------------------
-// attempt to discover and open cameras supported by Metavision SDK
-//--------------------------------------------------------------------
-void spiffer_meta_discover_devs (void);
-//--------------------------------------------------------------------
-
-
-//--------------------------------------------------------------------
-// receive events from a USB device and forward them to spif
-// map them to spif events with format:
-//
-//    [31] timestamp (0: present, 1: absent)
-// [30:16] 15-bit x coordinate
-//    [15] polarity
-//  [14:0] 15-bit y coordinate
-//
-// timestamps are ignored - time models itself
-//
-// terminated as a result of signal servicing
-//--------------------------------------------------------------------
-void * spiffer_meta_usb_listener (void * data);
-//--------------------------------------------------------------------
-
-
-//--------------------------------------------------------------------
-// shutdown device
-//--------------------------------------------------------------------
-void spiffer_meta_shutdown_dev (int dev);
-//--------------------------------------------------------------------
+// spiffer camera plugin interface
+#include "spiffer_plugin.h"
+
+// native EVT2/EVT3 decoder
+#include "spiffer_evt.h"
+
+// camera state
+typedef struct meta_dev {
+  std::unique_ptr<Metavision::Device> dev;
+  Metavision::I_EventsStream *        stream;
+  evt_format_t                        format;     // EVT_NONE: SDK decoder
+  evt_dec_t                           dec;
+  const uint8_t *                     raw;        // camera read being decoded
+  size_t                              left;
+  long                                bytes;
+  std::vector<uint>                   sdk_evts;   // events decoded by the SDK
+  std::vector<uint>                   sdk_ts;
+  size_t                              sdk_next;   // next one to go in a batch
+} meta_dev_t;
 
 
 #endif /* __spiffer_meta_H__ */
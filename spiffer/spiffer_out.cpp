@@ -0,0 +1,440 @@
+//************************************************//
+//*                                              *//
+//*        spiffer batched SpiNNaker output      *//
+//*                                              *//
+//* output frames can be held and sent to the    *//
+//* output client together - with sendmmsg or a  *//
+//* single UDP GSO send - so that high output    *//
+//* rates do not cost a system call per frame.   *//
+//* Frames are never held for longer than the    *//
+//* configured hold time - a flusher thread      *//
+//* sends them if no more frames arrive          *//
+//*                                              *//
+//************************************************//
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <csignal>
+
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "spiffer_out.h"
+#include "spiffer_batch.h"
+#include "spiffer_config.h"
+#include "spiffer_rt.h"
+
+// global variables
+// spiffer configuration
+extern spiffer_cfg_t cfg;
+
+// spif pipes
+extern pipe_ctx_t * pipe_ctx;
+
+// log file
+extern FILE * lf;
+
+// per-pipe output state
+out_t out[SPIFFER_PIPES_MAX];
+
+// policy names - same order as out_policy_t
+static const char * out_policy_names[] = {"frame", "mmsg", "gso"};
+
+
+//--------------------------------------------------------------------
+// select the policy used to send output frames
+// arg is one of: frame, mmsg or gso
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_out_config (int pipe, const char * arg) {
+  for (uint i = OUT_FRAME; i <= OUT_GSO; i++) {
+    if (strcmp (arg, out_policy_names[i]) == 0) {
+      cfg.pipe[pipe].out_policy = i;
+      return (SPIFFER_OK);
+    }
+  }
+
+  return (SPIFFER_ERROR);
+}
+//--------------------------------------------------------------------
+
+
+// held frames are sent by their own thread when their time is up
+static void * out_flusher (void * data);
+
+
+//--------------------------------------------------------------------
+// start sending output frames on a pipe
+// policy, frames held and hold time are taken from the pipe configuration
+//
+// frames are sent one at a time if held frames cannot be allocated
+//--------------------------------------------------------------------
+void spiffer_out_start (int pipe) {
+  out_t * ot = &out[pipe];
+
+  ot->policy = cfg.pipe[pipe].out_policy;
+  ot->num    = 0;
+  ot->bytes  = 0;
+
+#ifndef UDP_SEGMENT
+  // no UDP GSO support - frames are still sent together
+  if (ot->policy == OUT_GSO) {
+    ot->policy = OUT_MMSG;
+  }
+#endif
+
+  if (ot->policy == OUT_FRAME) {
+    return;
+  }
+
+  // frames held - 0 means the default,
+  ot->frames = cfg.pipe[pipe].out_frames;
+  if (ot->frames == 0) {
+    ot->frames = SPIFFER_OUT_FRAMES;
+  } else if (ot->frames > SPIFFER_OUT_FRAMES_MAX) {
+    ot->frames = SPIFFER_OUT_FRAMES_MAX;
+  }
+
+  // hold time - 0 means the default,
+  uint hold = cfg.pipe[pipe].out_hold;
+  ot->hold = (uint64_t) ((hold == 0) ? SPIFFER_OUT_HOLD : hold) * 1000;
+
+  // the lock on the frames held - shared with the flusher thread,
+  //NOTE: the hold deadline is kept on the monotonic clock
+  pthread_condattr_t ca;
+  (void) pthread_condattr_init (&ca);
+  (void) pthread_condattr_setclock (&ca, CLOCK_MONOTONIC);
+  (void) pthread_cond_init (&ot->cond, &ca);
+  (void) pthread_condattr_destroy (&ca);
+  (void) pthread_mutex_init (&ot->mtx, NULL);
+
+  // room for the frames held,
+  ot->buf  = (char *) malloc (ot->frames * SPIFFER_OUT_FRAME_SIZE);
+  ot->iovs = (struct iovec *) calloc (ot->frames, sizeof (struct iovec));
+  ot->msgs = (struct mmsghdr *) calloc (ot->frames, sizeof (struct mmsghdr));
+  if ((ot->buf == NULL) || (ot->iovs == NULL) || (ot->msgs == NULL)) {
+    spiffer_out_stop ((void *) &pipe);
+    ot->policy = OUT_FRAME;
+
+    log_time ();
+    fprintf (lf, "warning: no memory for output frames on outpipe%i - sent one at a time\n", pipe);
+    (void) fflush (lf);
+    return;
+  }
+
+  // and a thread to send them when their time is up
+  ot->pipe     = pipe;
+  ot->flushing = (spiffer_rt_create (&ot->flusher, out_flusher, (void *) ot, "output flusher") == 0);
+  if (!ot->flushing) {
+    spiffer_out_stop ((void *) &pipe);
+    ot->policy = OUT_FRAME;
+
+    log_time ();
+    fprintf (lf, "warning: output frames on outpipe%i sent one at a time\n", pipe);
+    (void) fflush (lf);
+    return;
+  }
+
+  log_time ();
+  fprintf (lf, "outpipe%i: up to %u frames held for %llu us [%s]\n", pipe, ot->frames,
+           (unsigned long long) ot->hold / 1000, out_policy_names[ot->policy]);
+  (void) fflush (lf);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// stop sending output frames on a pipe - held frames are dropped
+//
+// data points to the pipe number - used as a thread cleanup handler
+//--------------------------------------------------------------------
+void spiffer_out_stop (void * data) {
+  out_t * ot = &out[*((int *) data)];
+
+  if (ot->flushing) {
+    (void) pthread_cancel (ot->flusher);
+    pthread_join (ot->flusher, NULL);
+    ot->flushing = false;
+  }
+
+  if (ot->policy != OUT_FRAME) {
+    (void) pthread_mutex_destroy (&ot->mtx);
+    (void) pthread_cond_destroy (&ot->cond);
+  }
+
+  free (ot->buf);
+  free (ot->iovs);
+  free (ot->msgs);
+
+  ot->buf  = NULL;
+  ot->iovs = NULL;
+  ot->msgs = NULL;
+  ot->num  = 0;
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// send held frames as a single UDP GSO send
+// the kernel splits them back into frames
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR if not supported
+//--------------------------------------------------------------------
+static int out_send_gso (int pipe, out_t * ot) {
+#ifdef UDP_SEGMENT
+  struct iovec  iov = {ot->buf, ot->bytes};
+  struct msghdr msg;
+  char          ctrl[CMSG_SPACE (sizeof (uint16_t))];
+
+  memset (&msg, 0, sizeof (msg));
+  msg.msg_name    = &pipe_ctx[pipe].client_addr;
+  msg.msg_namelen = pipe_ctx[pipe].client_addr_len;
+  msg.msg_iov     = &iov;
+  msg.msg_iovlen  = 1;
+
+  // segment size - a single frame needs none
+  if (ot->num > 1) {
+    memset (ctrl, 0, sizeof (ctrl));
+    msg.msg_control    = ctrl;
+    msg.msg_controllen = sizeof (ctrl);
+
+    struct cmsghdr * cm = CMSG_FIRSTHDR (&msg);
+    cm->cmsg_level = IPPROTO_UDP;
+    cm->cmsg_type  = UDP_SEGMENT;
+    cm->cmsg_len   = CMSG_LEN (sizeof (uint16_t));
+
+    uint16_t gs = ot->seg;
+    memcpy (CMSG_DATA (cm), &gs, sizeof (gs));
+  }
+
+  ot->calls++;
+  if (sendmsg (pipe_ctx[pipe].out_udp_skt, &msg, 0) >= 0) {
+    ot->sent += ot->num;
+    return (SPIFFER_OK);
+  }
+
+  // no GSO support in the kernel or the network device,
+  if ((errno == EIO) || (errno == EINVAL) || (errno == ENOPROTOOPT) || (errno == EOPNOTSUPP)) {
+    return (SPIFFER_ERROR);
+  }
+
+  // otherwise the frames are lost
+  ot->lost += ot->num;
+  return (SPIFFER_OK);
+#else
+  (void) pipe;
+  (void) ot;
+  return (SPIFFER_ERROR);
+#endif
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// send held frames with sendmmsg - one datagram per frame
+//--------------------------------------------------------------------
+static void out_send_mmsg (int pipe, out_t * ot) {
+  // point every message to its frame and to the output client,
+  for (uint m = 0; m < ot->num; m++) {
+    ot->msgs[m].msg_hdr.msg_name    = &pipe_ctx[pipe].client_addr;
+    ot->msgs[m].msg_hdr.msg_namelen = pipe_ctx[pipe].client_addr_len;
+    ot->msgs[m].msg_hdr.msg_iov     = &ot->iovs[m];
+    ot->msgs[m].msg_hdr.msg_iovlen  = 1;
+  }
+
+  // and send them - sendmmsg may take only some of them
+  uint done = 0;
+  while (done < ot->num) {
+    ot->calls++;
+    int rc = sendmmsg (pipe_ctx[pipe].out_udp_skt, &ot->msgs[done], ot->num - done, 0);
+    if (rc <= 0) {
+      ot->lost += ot->num - done;
+      break;
+    }
+
+    done += rc;
+  }
+
+  ot->sent += done;
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// send held frames to the output client - if still active
+//--------------------------------------------------------------------
+static void out_flush (int pipe, out_t * ot) {
+  if ((ot->num == 0) || (pipe_ctx[pipe].out_start == 0)) {
+    ot->num   = 0;
+    ot->bytes = 0;
+    return;
+  }
+
+  if ((ot->policy == OUT_GSO) && (out_send_gso (pipe, ot) == SPIFFER_ERROR)) {
+    // fall back to sendmmsg - for good
+    ot->policy = OUT_MMSG;
+
+    log_time ();
+    fprintf (lf, "warning: UDP GSO not available on outpipe%i - using sendmmsg\n", pipe);
+    (void) fflush (lf);
+  }
+
+  if (ot->policy == OUT_MMSG) {
+    out_send_mmsg (pipe, ot);
+  }
+
+  ot->num   = 0;
+  ot->bytes = 0;
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// send an output frame to the output client - if active
+// the frame is copied - it can be overwritten on return
+//
+// frames may be held and sent together with later ones
+//--------------------------------------------------------------------
+void spiffer_out_put (int pipe, const uint * frame, size_t bytes) {
+  out_t * ot = &out[pipe];
+
+  if ((pipe_ctx[pipe].out_start == 0) || (bytes == 0)) {
+    return;
+  }
+
+  // send frames one at a time - if configured,
+  if (ot->policy == OUT_FRAME) {
+    ot->calls++;
+    if (sendto (pipe_ctx[pipe].out_udp_skt, frame, bytes, 0,
+                (struct sockaddr *) &pipe_ctx[pipe].client_addr,
+                pipe_ctx[pipe].client_addr_len) < 0) {
+      ot->lost++;
+    } else {
+      ot->sent++;
+    }
+    return;
+  }
+
+  // held frames are shared with the flusher thread,
+  //NOTE: not cancelled while holding the lock - sends are cancellation points
+  int cs;
+  pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, &cs);
+  pthread_mutex_lock (&ot->mtx);
+
+  // GSO segments must all have the size of the first one - only
+  // the last one can be shorter,
+  if ((ot->policy == OUT_GSO) && (ot->num != 0) &&
+      ((bytes > ot->seg) || (ot->bytes != ot->num * ot->seg) ||
+       (ot->bytes + bytes > SPIFFER_OUT_GSO_SIZE) || (ot->num == SPIFFER_OUT_GSO_SEGS))) {
+    out_flush (pipe, ot);
+  }
+
+  // hold a copy of the frame - the flusher waits for the first one,
+  if (ot->num == 0) {
+    ot->seg      = bytes;
+    ot->deadline = spiffer_batch_now () + ot->hold;
+    (void) pthread_cond_signal (&ot->cond);
+  }
+
+  char * fb = ot->buf + ot->bytes;
+  memcpy (fb, frame, bytes);
+  ot->iovs[ot->num].iov_base = fb;
+  ot->iovs[ot->num].iov_len  = bytes;
+  ot->num++;
+  ot->bytes += bytes;
+
+  // and send held frames when there is no room for more or when
+  // the frame is short - spif output has paused and no more may come
+  if ((ot->num == ot->frames) || (bytes < SPIFFER_OUT_FRAME_SIZE)) {
+    out_flush (pipe, ot);
+  }
+
+  pthread_mutex_unlock (&ot->mtx);
+  pthread_setcancelstate (cs, NULL);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// release the held frames lock - if the flusher is cancelled
+//--------------------------------------------------------------------
+static void out_unlock (void * data) {
+  pthread_mutex_unlock (&((out_t *) data)->mtx);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// send held frames when the oldest one has been held for too long
+//
+// the SpiNNaker listener can be blocked in spif for much longer than
+// the hold time, so the deadline is kept by this thread
+//
+// terminated when the SpiNNaker listener stops
+//--------------------------------------------------------------------
+static void * out_flusher (void * data) {
+  out_t * ot = (out_t *) data;
+
+  // block signals - should be handled in a different thread
+  sigset_t set;
+  sigfillset (&set);
+  sigprocmask (SIG_BLOCK, &set, NULL);
+
+  // pin thread and set its priority - same as the SpiNNaker listener
+  spiffer_rt_thread (RT_SPINN, ot->pipe, "flush");
+
+  pthread_mutex_lock (&ot->mtx);
+  pthread_cleanup_push (out_unlock, data);
+
+  while (1) {
+    // wait for a frame to be held,
+    if (ot->num == 0) {
+      (void) pthread_cond_wait (&ot->cond, &ot->mtx);
+      continue;
+    }
+
+    // send held frames if their time is up,
+    if (spiffer_batch_now () >= ot->deadline) {
+      int cs;
+      pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, &cs);
+      out_flush (ot->pipe, ot);
+      pthread_setcancelstate (cs, NULL);
+      continue;
+    }
+
+    // or wait until it is - frames may be sent by the listener before
+    struct timespec ts;
+    ts.tv_sec  = ot->deadline / 1000000000;
+    ts.tv_nsec = ot->deadline % 1000000000;
+    (void) pthread_cond_timedwait (&ot->cond, &ot->mtx, &ts);
+  }
+
+  pthread_cleanup_pop (1);
+  return (NULL);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// report output statistics to the log file
+//--------------------------------------------------------------------
+void spiffer_out_report (int pipe) {
+  out_t * ot = &out[pipe];
+
+  log_time ();
+  fprintf (lf, "outpipe%i frames sent: %llu in %llu send calls (policy %s) lost: %llu\n",
+           pipe,
+           (unsigned long long) ot->sent,
+           (unsigned long long) ot->calls,
+           out_policy_names[ot->policy],
+           (unsigned long long) ot->lost
+           );
+}
+//--------------------------------------------------------------------
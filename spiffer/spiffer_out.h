@@ -0,0 +1,115 @@
+//************************************************//
+//*                                              *//
+//*        spiffer batched SpiNNaker output      *//
+//*                                              *//
+//************************************************//
+
+#ifndef __SPIFFER_OUT_H__
+#define __SPIFFER_OUT_H__
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// spif and spiffer constants and function prototypes
+#include "spif.h"
+#include "spiffer.h"
+
+// largest output frame - a spif output transfer (bytes)
+#define SPIFFER_OUT_FRAME_SIZE  (SPIFFER_BATCH_SIZE * sizeof (uint))
+
+// frames held before sending - default and largest
+#define SPIFFER_OUT_FRAMES      32
+#define SPIFFER_OUT_FRAMES_MAX  64
+
+// longest time the oldest frame is held (us) - default
+#define SPIFFER_OUT_HOLD        1000
+
+// largest UDP GSO send - payload bytes and segments
+#define SPIFFER_OUT_GSO_SIZE    65507
+#define SPIFFER_OUT_GSO_SEGS    64
+
+// policies used to send output frames
+typedef enum {
+  OUT_FRAME,    // one send per frame
+  OUT_MMSG,     // frames held and sent together - one datagram each
+  OUT_GSO       // frames held and sent as one UDP GSO send
+} out_policy_t;
+
+// per-pipe output state
+typedef struct alignas (SPIFFER_CACHE_LINE) out {
+  uint             policy;     // out_policy_t
+  uint             frames;     // frames held before sending
+  uint64_t         hold;       // send when the oldest frame is this old (ns)
+  char *           buf;        // held frames - back to back
+  struct iovec *   iovs;       // one iovec per frame
+  struct mmsghdr * msgs;       // sendmmsg message headers
+  uint             num;        // frames held
+  size_t           bytes;      // bytes held
+  size_t           seg;        // GSO segment size - size of the first frame
+  uint64_t         deadline;   // send held frames at this time (ns)
+  int              pipe;
+  pthread_mutex_t  mtx;        // held frames - shared with the flusher
+  pthread_cond_t   cond;       // first frame held
+  pthread_t        flusher;    // sends held frames when their time is up
+  bool             flushing;   // flusher started
+
+  // statistics
+  uint64_t         sent;       // frames sent
+  uint64_t         calls;      // send system calls
+  uint64_t         lost;       // frames not taken by the kernel
+} out_t;
+
+
+//--------------------------------------------------------------------
+// select the policy used to send output frames
+// arg is one of: frame, mmsg or gso
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_out_config (int pipe, const char * arg);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// start sending output frames on a pipe
+// policy, frames held and hold time are taken from the pipe configuration
+//
+// frames are sent one at a time if held frames cannot be allocated
+//--------------------------------------------------------------------
+void spiffer_out_start (int pipe);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// stop sending output frames on a pipe - held frames are dropped
+//
+// data points to the pipe number - used as a thread cleanup handler
+//--------------------------------------------------------------------
+void spiffer_out_stop (void * data);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// send an output frame to the output client - if active
+// the frame is copied - it can be overwritten on return
+//
+// frames may be held and sent together with later ones
+//--------------------------------------------------------------------
+void spiffer_out_put (int pipe, const uint * frame, size_t bytes);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// report output statistics to the log file
+//--------------------------------------------------------------------
+void spiffer_out_report (int pipe);
+//--------------------------------------------------------------------
+
+
+#endif /* __SPIFFER_OUT_H__ */
@@ -0,0 +1,292 @@
+//************************************************//
+//*                                              *//
+//*        spiffer timestamp-paced replay        *//
+//*                                              *//
+//* timestamped events are held and released to  *//
+//* spif at their recorded relative times,       *//
+//* optionally scaled by a speed factor          *//
+//*                                              *//
+//************************************************//
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "spiffer_pace.h"
+#include "spiffer_batch.h"
+#include "spiffer_config.h"
+
+// global variables
+// spiffer configuration
+extern spiffer_cfg_t cfg;
+
+// log file
+extern FILE * lf;
+
+// per-pipe pacing state
+pace_t pace[SPIFFER_PIPES_MAX];
+
+
+//--------------------------------------------------------------------
+// set the replay speed factor of a pipe
+// arg is a factor: 1.0 is real time, 0 disables pacing
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_pace_config (int pipe, const char * arg) {
+  char * end;
+  double speed = strtod (arg, &end);
+  if ((end == arg) || (*end != '\0') || (speed < 0)) {
+    return (SPIFFER_ERROR);
+  }
+
+  cfg.pipe[pipe].pace_speed = speed;
+
+  return (SPIFFER_OK);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// start pacing on a pipe - if configured
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_pace_start (int pipe) {
+  pace_t * pc = &pace[pipe];
+
+  pc->speed = cfg.pipe[pipe].pace_speed;
+  if (pc->speed == 0) {
+    return (SPIFFER_OK);
+  }
+
+  // a depth of 0 means "use default"
+  uint cap = cfg.pipe[pipe].pace_depth;
+  if (cap == 0) {
+    cap = SPIFFER_PACE_DEPTH;
+  }
+
+  // allocate the ring only once - listeners may restart
+  if (pc->evts == NULL) {
+    pc->evts = (pace_evt_t *) malloc (cap * sizeof (pace_evt_t));
+    if (pc->evts == NULL) {
+      pc->speed = 0;
+      return (SPIFFER_ERROR);
+    }
+    pc->cap = cap;
+  }
+
+  pc->head    = 0;
+  pc->cnt     = 0;
+  pc->ts_next = false;
+  pc->started = false;
+
+  return (SPIFFER_OK);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// compute the release time of an event from its timestamp
+//--------------------------------------------------------------------
+static uint64_t pace_release (pace_t * pc, uint ts) {
+  uint64_t now = spiffer_batch_now ();
+
+  // the first timestamp sets the time origin,
+  if (!pc->started) {
+    pc->started  = true;
+    pc->ts_last  = ts;
+    pc->ts_rel   = 0;
+    pc->origin   = now;
+    pc->last_rel = now;
+    return (now);
+  }
+
+  // timestamps wrap around - use differences,
+  int dt = (int) (ts - pc->ts_last);
+  pc->ts_last = ts;
+
+  // and restart from the last release if time goes back or jumps
+  if ((dt < 0) || (dt > SPIFFER_PACE_GAP_MAX)) {
+    pc->restarts++;
+    pc->ts_rel = 0;
+    pc->origin = (pc->last_rel > now) ? pc->last_rel : now;
+  } else {
+    pc->ts_rel += dt;
+  }
+
+  uint64_t rel = pc->origin + (uint64_t) (pc->ts_rel * 1000.0 / pc->speed);
+
+  // events that arrive too late move the origin - keeps their spacing
+  if ((rel + SPIFFER_PACE_LATE_MAX) < now) {
+    pc->restarts++;
+    pc->origin += now - rel;
+    rel = now;
+  }
+
+  pc->last_rel = rel;
+  return (rel);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// hold an event until its release time
+//--------------------------------------------------------------------
+static void pace_hold (pace_t * pc, uint evt, uint64_t rel) {
+  if (pc->cnt == pc->cap) {
+    pc->overflow++;
+    return;
+  }
+
+  pace_evt_t * pe = &pc->evts[(pc->head + pc->cnt) % pc->cap];
+  pe->rel = rel;
+  pe->evt = evt | SPIFFER_EVT_NO_TS;
+  pc->cnt++;
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// add timestamped events to be released at their relative times
+//
+// events go straight to the current batch if pacing is disabled
+//--------------------------------------------------------------------
+void spiffer_pace_add (int pipe, uint * evts, uint num) {
+  pace_t * pc = &pace[pipe];
+
+  if (pc->speed == 0) {
+    spiffer_batch_add (pipe, evts, num);
+    return;
+  }
+
+  for (uint i = 0; i < num; i++) {
+    uint w = evts[i];
+
+    // timestamps may arrive in a different datagram than their event,
+    if (pc->ts_next) {
+      pc->ts_next = false;
+      pace_hold (pc, pc->ts_evt, pace_release (pc, w));
+      continue;
+    }
+
+    // events without timestamp go with the previous one,
+    if (w & SPIFFER_EVT_NO_TS) {
+      pace_hold (pc, w, pc->started ? pc->last_rel : 0);
+      continue;
+    }
+
+    // and timestamped events wait for their timestamp
+    pc->ts_next = true;
+    pc->ts_evt  = w;
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// release all events that are due and send them to spif
+//
+// called by input listeners after every read from their source
+//--------------------------------------------------------------------
+void spiffer_pace_poll (int pipe) {
+  pace_t * pc = &pace[pipe];
+
+  if ((pc->speed == 0) || (pc->cnt == 0)) {
+    return;
+  }
+
+  uint64_t now = spiffer_batch_now ();
+  uint     buf[SPIFFER_BATCH_SIZE];
+  uint     cnt = 0;
+
+  // collect due events in a local buffer,
+  while ((pc->cnt != 0) && (pc->evts[pc->head].rel <= now)) {
+    pace_evt_t * pe = &pc->evts[pc->head];
+
+    if ((now - pe->rel) > pc->late_max) {
+      pc->late_max = now - pe->rel;
+    }
+
+    buf[cnt++] = pe->evt;
+    if (cnt == SPIFFER_BATCH_SIZE) {
+      spiffer_batch_add (pipe, buf, cnt);
+      cnt = 0;
+    }
+
+    pc->head = (pc->head + 1) % pc->cap;
+    pc->cnt--;
+    pc->released++;
+  }
+
+  // and send them - they are already on time
+  spiffer_batch_add (pipe, buf, cnt);
+  spiffer_batch_send (pipe);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// check if no more events can be held
+//--------------------------------------------------------------------
+bool spiffer_pace_full (int pipe) {
+  pace_t * pc = &pace[pipe];
+
+  return ((pc->speed != 0) && (pc->cnt == pc->cap));
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// get time left until the next event release or the given timeout,
+// whichever comes first
+//
+// returns NULL if neither exists
+//--------------------------------------------------------------------
+struct timespec * spiffer_pace_timeout (int pipe,
+                                        struct timespec * to,
+                                        struct timespec * ts
+                                        ) {
+  pace_t * pc = &pace[pipe];
+
+  if ((pc->speed == 0) || (pc->cnt == 0)) {
+    return (to);
+  }
+
+  uint64_t now  = spiffer_batch_now ();
+  uint64_t rel  = pc->evts[pc->head].rel;
+  uint64_t left = (rel > now) ? rel - now : 0;
+
+  if ((to != NULL) &&
+      (((uint64_t) to->tv_sec * 1000000000 + to->tv_nsec) <= left)) {
+    return (to);
+  }
+
+  ts->tv_sec  = left / 1000000000;
+  ts->tv_nsec = left % 1000000000;
+
+  return (ts);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// report pacing statistics to the log file
+//--------------------------------------------------------------------
+void spiffer_pace_report (int pipe) {
+  pace_t * pc = &pace[pipe];
+
+  if (pc->speed == 0) {
+    return;
+  }
+
+  log_time ();
+  fprintf (lf, "pipe%i pacing: x%g - events released: %llu held: %u late max: %llu us restarts: %llu overflow: %llu\n",
+           pipe, pc->speed,
+           (unsigned long long) pc->released,
+           pc->cnt,
+           (unsigned long long) (pc->late_max / 1000),
+           (unsigned long long) pc->restarts,
+           (unsigned long long) pc->overflow
+           );
+}
+//--------------------------------------------------------------------
@@ -0,0 +1,124 @@
+//************************************************//
+//*                                              *//
+//*        spiffer timestamp-paced replay        *//
+//*                                              *//
+//************************************************//
+
+#ifndef __SPIFFER_PACE_H__
+#define __SPIFFER_PACE_H__
+
+
+#include <cstdint>
+#include <ctime>
+
+#include <sys/types.h>
+
+// spif and spiffer constants and function prototypes
+#include "spif.h"
+#include "spiffer.h"
+
+// events held for release (default)
+#define SPIFFER_PACE_DEPTH     65536
+
+// timestamp jumps larger than this (us) restart pacing
+#define SPIFFER_PACE_GAP_MAX   10000000
+
+// events arriving later than this (ns) restart pacing
+#define SPIFFER_PACE_LATE_MAX  100000000
+
+// held event
+typedef struct pace_evt {
+  uint64_t rel;       // release time (ns)
+  uint     evt;       // event - timestamp stripped
+} pace_evt_t;
+
+// per-pipe pacing state
+//NOTE: events with bit 31 clear are followed by a timestamp (us)
+typedef struct alignas (SPIFFER_CACHE_LINE) pace {
+  double       speed;     // replay speed factor - 0: no pacing
+  pace_evt_t * evts;      // held events (ring)
+  uint         cap;       // ring capacity
+  uint         head;      // next event to release
+  uint         cnt;       // events held
+
+  bool         ts_next;   // next word is a timestamp
+  uint         ts_evt;    // event waiting for its timestamp
+  bool         started;   // time origin set
+  uint         ts_last;   // last timestamp (us)
+  uint64_t     ts_rel;    // time since origin (us)
+  uint64_t     origin;    // release time of origin (ns)
+  uint64_t     last_rel;  // last release time assigned (ns)
+
+  // statistics
+  uint64_t     released;  // events released
+  uint64_t     late_max;  // largest release delay (ns)
+  uint64_t     restarts;  // pacing restarts - gaps and late arrivals
+  uint64_t     overflow;  // events dropped - ring full
+} pace_t;
+
+
+//--------------------------------------------------------------------
+// set the replay speed factor of a pipe
+// arg is a factor: 1.0 is real time, 0 disables pacing
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_pace_config (int pipe, const char * arg);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// start pacing on a pipe - if configured
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_pace_start (int pipe);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// add timestamped events to be released at their relative times
+//
+// events go straight to the current batch if pacing is disabled
+//--------------------------------------------------------------------
+void spiffer_pace_add (int pipe, uint * evts, uint num);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// release all events that are due and send them to spif
+//
+// called by input listeners after every read from their source
+//--------------------------------------------------------------------
+void spiffer_pace_poll (int pipe);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// check if no more events can be held
+//--------------------------------------------------------------------
+bool spiffer_pace_full (int pipe);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// get time left until the next event release or the given timeout,
+// whichever comes first
+//
+// returns NULL if neither exists
+//--------------------------------------------------------------------
+struct timespec * spiffer_pace_timeout (int pipe,
+                                        struct timespec * to,
+                                        struct timespec * ts
+                                        );
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// report pacing statistics to the log file
+//--------------------------------------------------------------------
+void spiffer_pace_report (int pipe);
+//--------------------------------------------------------------------
+
+
+#endif /* __SPIFFER_PACE_H__ */
@@ -0,0 +1,408 @@
+//************************************************//
+//*                                              *//
+//*           spiffer USB camera plugins         *//
+//*                                              *//
+//* camera support libraries are loaded only     *//
+//* when a matching camera is connected. Plugins *//
+//* fill camera queue buffers with spif events   *//
+//* a batch at a time                            *//
+//*                                              *//
+//************************************************//
+
+#include <csignal>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <pthread.h>
+
+#include "spiffer_plugin.h"
+#include "spiffer_camera.h"
+#include "spiffer_config.h"
+#include "spiffer_queue.h"
+#include "spiffer_rt.h"
+
+// global variables
+// spiffer configuration
+extern spiffer_cfg_t cfg;
+
+// USB devices
+extern usb_devs_t usb_devs;
+
+// used to pass integers as (void *)
+extern int dev_to_ptr[SPIFFER_USB_DISCOVER_CNT + 1];
+
+// log file
+extern FILE * lf;
+
+// camera plugins
+static plugin_t plugins[] = {
+  {"Prophesee", "meta", "spiffer_meta.so", NULL, NULL, false},
+  {"Inivation", "caer", "spiffer_caer.so", NULL, NULL, false}
+};
+
+static const int plugins_num = sizeof (plugins) / sizeof (plugin_t);
+
+// supported USB cameras
+//NOTE: keep in line with 99-spiffer.rules
+static const plugin_id_t plugin_ids[] = {
+  {0x04b4, 0x00f4, 0},  // Prophesee cameras
+  {0x04b4, 0x00f5, 0},
+  {0x152a, 0,      1}   // Inivation cameras
+};
+
+// USB devices on the bus
+#define PLUGIN_USB_DEVS  "/sys/bus/usb/devices"
+
+
+//--------------------------------------------------------------------
+// write a time-stamped line to the log file - for plugins
+//--------------------------------------------------------------------
+static void plugin_log (const char * fmt, ...) {
+  va_list args;
+
+  log_time ();
+  va_start (args, fmt);
+  vfprintf (lf, fmt, args);
+  va_end (args);
+  fputc ('\n', lf);
+  (void) fflush (lf);
+}
+//--------------------------------------------------------------------
+
+static const plugin_host_t plugin_host = {plugin_log};
+
+
+//--------------------------------------------------------------------
+// read a hexadecimal USB attribute from sysfs
+//
+// returns the value or 0 if not available
+//--------------------------------------------------------------------
+static uint plugin_usb_attr (const char * dev, const char * attr) {
+  char name[300];
+  (void) snprintf (name, sizeof (name), "%s/%s/%s", PLUGIN_USB_DEVS, dev, attr);
+
+  FILE * f = fopen (name, "r");
+  if (f == NULL) {
+    return (0);
+  }
+
+  uint val = 0;
+  if (fscanf (f, "%x", &val) != 1) {
+    val = 0;
+  }
+  fclose (f);
+
+  return (val);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// check if a USB device supported by a plugin is on the bus
+//--------------------------------------------------------------------
+static bool plugin_usb_present (int p) {
+  DIR * dir = opendir (PLUGIN_USB_DEVS);
+  if (dir == NULL) {
+    return (false);
+  }
+
+  bool found = false;
+  struct dirent * de;
+  while (!found && ((de = readdir (dir)) != NULL)) {
+    if (de->d_name[0] == '.') {
+      continue;
+    }
+
+    found = (spiffer_plugin_find (plugin_usb_attr (de->d_name, "idVendor"),
+                                  plugin_usb_attr (de->d_name, "idProduct")) == p);
+  }
+  closedir (dir);
+
+  return (found);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// load a camera plugin - if not loaded yet
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+static int plugin_load (plugin_t * pl) {
+  if (pl->ops != NULL) {
+    return (SPIFFER_OK);
+  }
+
+  if (pl->failed) {
+    return (SPIFFER_ERROR);
+  }
+
+  struct timespec t0;
+  struct timespec t1;
+  clock_gettime (CLOCK_MONOTONIC, &t0);
+
+  // open the shared object,
+  char name[256];
+  (void) snprintf (name, sizeof (name), "%s/%s", SPIFFER_PLUGIN_DIR, pl->lib);
+
+  pl->so = dlopen (name, RTLD_NOW | RTLD_LOCAL);
+  if (pl->so == NULL) {
+    log_time ();
+    fprintf (lf, "warning: cannot load %s camera plugin: %s\n", pl->name, dlerror ());
+    pl->failed = true;
+    return (SPIFFER_ERROR);
+  }
+
+  // get its interface,
+  plugin_entry_t entry = (plugin_entry_t) dlsym (pl->so, SPIFFER_PLUGIN_ENTRY);
+  const spiffer_plugin_t * ops = (entry == NULL) ? NULL : entry ();
+  if ((ops == NULL) || (ops->abi != SPIFFER_PLUGIN_ABI)) {
+    log_time ();
+    fprintf (lf, "warning: %s is not a spiffer camera plugin (version %i)\n", name, SPIFFER_PLUGIN_ABI);
+    dlclose (pl->so);
+    pl->so     = NULL;
+    pl->failed = true;
+    return (SPIFFER_ERROR);
+  }
+
+  // and set it up
+  if (ops->init (&plugin_host) == SPIFFER_ERROR) {
+    log_time ();
+    fprintf (lf, "warning: %s camera plugin failed to start\n", pl->name);
+    dlclose (pl->so);
+    pl->so     = NULL;
+    pl->failed = true;
+    return (SPIFFER_ERROR);
+  }
+  pl->ops = ops;
+
+  clock_gettime (CLOCK_MONOTONIC, &t1);
+  log_time ();
+  fprintf (lf, "loaded %s camera plugin %s in %li ms\n", pl->name, name,
+           (t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_nsec - t0.tv_nsec) / 1000000);
+
+  return (SPIFFER_OK);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// find the plugin that supports a USB device
+//
+// returns the plugin or SPIFFER_PLUGIN_NONE
+//--------------------------------------------------------------------
+int spiffer_plugin_find (uint vid, uint pid) {
+  for (size_t i = 0; i < (sizeof (plugin_ids) / sizeof (plugin_ids[0])); i++) {
+    if ((plugin_ids[i].vid == vid) && ((plugin_ids[i].pid == 0) || (plugin_ids[i].pid == pid))) {
+      return (plugin_ids[i].plugin);
+    }
+  }
+
+  return (SPIFFER_PLUGIN_NONE);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// discover and open new cameras
+// plugins are loaded the first time a matching USB device is present
+//
+// new cameras get a free device entry - and a pipe later
+//--------------------------------------------------------------------
+void spiffer_plugin_discover_devs (void) {
+  for (int p = 0; p < plugins_num; p++) {
+    plugin_t * pl = &plugins[p];
+
+    // only plugins with a camera on the bus are needed,
+    if ((pl->ops == NULL) && !plugin_usb_present (p)) {
+      continue;
+    }
+
+    if (!SPIFFER_USB_MIX_CAMERAS && usb_dev_other (p)) {
+      log_time ();
+      fprintf (lf, "warning: %s discovery cancelled - camera mixing disallowed\n", pl->name);
+      continue;
+    }
+
+    // and they are loaded the first time,
+    if (plugin_load (pl) == SPIFFER_ERROR) {
+      continue;
+    }
+
+    // find their cameras,
+    char ids[SPIFFER_PLUGIN_IDS_MAX][SPIFFER_PLUGIN_ID_SIZE];
+    int  num = pl->ops->discover (ids, SPIFFER_PLUGIN_IDS_MAX);
+
+    // and open new ones
+    int ndd = 0;
+    for (int i = 0; i < num; i++) {
+      // cameras already connected are left alone,
+      if (usb_dev_known (ids[i])) {
+        continue;
+      }
+
+      int dv = usb_dev_slot ();
+      if (dv == SPIFFER_USB_NO_DEVICE) {
+        break;
+      }
+
+      void * hdl = pl->ops->open (ids[i]);
+      if (hdl == NULL) {
+        log_time ();
+        fprintf (lf, "warning: cannot open device: %s\n", ids[i]);
+        continue;
+      }
+
+      // report camera info
+      log_time ();
+      fprintf (lf, "%s\n", ids[i]);
+
+      // new devices get a free entry - and a pipe later
+      usb_devs.params[dv].present = true;
+      usb_devs.params[dv].pipe    = SPIFFER_USB_NO_DEVICE;
+      usb_devs.params[dv].type    = CAMERA;
+      usb_devs.params[dv].plugin  = p;
+      usb_devs.params[dv].hdl     = hdl;
+      (void) pl->ops->serial (hdl, usb_devs.params[dv].sn, sizeof (serial_t));
+
+      usb_devs.cnt++;
+      ndd++;
+    }
+
+    log_time ();
+    fprintf (lf, "discovered %i %s device%c\n", ndd, pl->name, ndd == 1 ? ' ' : 's');
+  }
+
+  (void) fflush (lf);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// receive events from a camera and forward them to spif
+// the plugin fills camera queue buffers directly
+//
+// terminated as a result of signal servicing
+//--------------------------------------------------------------------
+void * spiffer_plugin_listener (void * data) {
+  int dev  = *((int *) data);
+  int pipe = usb_devs.params[dev].pipe;
+
+  // block signals - should be handled in a different thread
+  sigset_t set;
+  sigfillset (&set);
+  sigprocmask (SIG_BLOCK, &set, NULL);
+
+  plugin_t * pl  = &plugins[usb_devs.params[dev].plugin];
+  void *     hdl = usb_devs.params[dev].hdl;
+
+  // pin thread and set its priority - if configured
+  spiffer_rt_thread (RT_INPUT, pipe, pl->tag);
+
+  // plugins are cancelled only between batches
+  pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, 0);
+
+  // set the sensor up - settings can change while running,
+  sensor_cfg_t sensor_cfg;
+  uint         sensor_gen = 0;
+  if ((pl->ops->sensor != NULL) && spiffer_sensor_get (pipe, &sensor_cfg, &sensor_gen)) {
+    pl->ops->sensor (hdl, pipe, &sensor_cfg);
+  }
+
+  // turn on camera event transmission,
+  plugin_start_t ps = {cfg.pipe[pipe].batch_delay, cfg.pipe[pipe].sdk_decoder};
+  uint           width  = 0;
+  uint           height = 0;
+  char           info[SPIFFER_PLUGIN_INFO_SIZE] = "";
+  if (pl->ops->start (hdl, &ps, &width, &height, info, sizeof (info)) == SPIFFER_ERROR) {
+    log_time ();
+    fprintf (lf, "error: failed to start camera event transmission\n");
+    (void) fflush (lf);
+
+    // give the pipe back - as if the camera was disconnected
+    //NOTE: this thread is joined when the next camera leaves the pipe or spiffer stops
+    usb_release_dev (dev);
+    return (nullptr);
+  }
+
+  // and start processing and batching events - in their own thread
+  if ((width == 0) || (height == 0)) {
+    width  = SPIFFER_EVT_X_MASK + 1;
+    height = SPIFFER_EVT_Y_MASK + 1;
+  }
+  spiffer_camera_start (pipe, width, height);
+
+  if (spiffer_queue_start (pipe) == SPIFFER_ERROR) {
+    log_time ();
+    fprintf (lf, "error: failed to start camera queue on pipe%i\n", pipe);
+    (void) fflush (lf);
+
+    // undo camera processing, and give the pipe back
+    spiffer_camera_stop (pipe);
+    usb_release_dev (dev);
+    return (nullptr);
+  }
+
+  //NOTE: it is stopped when this listener is cancelled
+  pthread_cleanup_push (spiffer_queue_stop, (void *) &dev_to_ptr[pipe]);
+
+  log_time ();
+  fprintf (lf, "listening USB %s -> pipe%i [%s]\n", usb_devs.params[dev].sn, pipe, info);
+  (void) fflush (lf);
+
+  while (1) {
+    // this is a safe place to cancel this thread
+    pthread_setcancelstate (PTHREAD_CANCEL_ENABLE, 0);
+    pthread_testcancel ();
+    pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, 0);
+
+    // apply changed sensor settings,
+    if ((pl->ops->sensor != NULL) && spiffer_sensor_get (pipe, &sensor_cfg, &sensor_gen)) {
+      pl->ops->sensor (hdl, pipe, &sensor_cfg);
+    }
+
+    // get the next batch of events - straight into a queue buffer,
+    queue_buf_t *  qb = spiffer_queue_get (pipe);
+    plugin_batch_t pb = {qb->evts, qb->ts, SPIFFER_BATCH_SIZE, 0, false, 0};
+
+    // an error usually means that the camera was disconnected
+    if (pl->ops->fill_batch (hdl, &pb) == SPIFFER_ERROR) {
+      break;
+    }
+
+    // queue them for processing and batching,
+    spiffer_queue_put (pipe, pb.num);
+
+    // and send them together - once reads add up to the budget
+    if (pb.end) {
+      spiffer_queue_end (pipe, pb.bytes);
+    }
+  }
+
+  log_time ();
+  fprintf (lf, "warning: device %s stopped responding\n", usb_devs.params[dev].sn);
+  (void) fflush (lf);
+
+  // stop processing its events - before the pipe can get a new camera,
+  pthread_cleanup_pop (1);
+
+  // and shutdown disconnected camera - other pipes keep running
+  //NOTE: this thread is joined when the next camera leaves the pipe or spiffer stops
+  usb_survey_devs (&dev_to_ptr[dev]);
+
+  return (nullptr);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// close a camera
+//--------------------------------------------------------------------
+void spiffer_plugin_shutdown_dev (int dev) {
+  plugins[usb_devs.params[dev].plugin].ops->close (usb_devs.params[dev].hdl);
+}
+//--------------------------------------------------------------------
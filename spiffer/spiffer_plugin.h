@@ -0,0 +1,156 @@
+//************************************************//
+//*                                              *//
+//*           spiffer USB camera plugins         *//
+//*                                              *//
+//************************************************//
+
+#ifndef __SPIFFER_PLUGIN_H__
+#define __SPIFFER_PLUGIN_H__
+
+
+#include <cstddef>
+
+#include <sys/types.h>
+
+// spif and spiffer constants and function prototypes
+#include "spif.h"
+#include "spiffer.h"
+
+// sensor settings applied by plugins
+#include "spiffer_sensor.h"
+
+// plugin interface version - bump when the interface changes
+#define SPIFFER_PLUGIN_ABI        1
+
+// plugin entry point - returns the plugin interface
+#define SPIFFER_PLUGIN_ENTRY      "spiffer_plugin_get"
+
+// plugin shared objects - loaded on first matching USB device
+#ifndef SPIFFER_PLUGIN_DIR
+#define SPIFFER_PLUGIN_DIR        "/usr/local/lib/spiffer"
+#endif
+
+#define SPIFFER_PLUGIN_ID_SIZE    128
+#define SPIFFER_PLUGIN_IDS_MAX    SPIFFER_USB_DISCOVER_CNT
+#define SPIFFER_PLUGIN_INFO_SIZE  64
+#define SPIFFER_PLUGIN_NONE       -1
+
+// services offered to plugins by spiffer
+typedef struct plugin_host {
+  void (* log) (const char * fmt, ...);   // time-stamped log file line
+} plugin_host_t;
+
+// camera start up parameters - from the pipe configuration
+typedef struct plugin_start {
+  uint batch_delay;             // batch deadline (us) - 0: none
+  uint sdk_decoder;             // use the camera SDK decoder
+} plugin_start_t;
+
+// event batch filled by a plugin - straight into a camera queue buffer
+typedef struct plugin_batch {
+  uint * evts;                  // spif events
+  uint * ts;                    // and their timestamps
+  uint   cap;                   // room in evts and ts
+  uint   num;                   // events filled in
+  bool   end;                   // camera read finished - send its events
+  size_t bytes;                 // raw bytes of the read - 0: send now
+} plugin_batch_t;
+
+// plugin interface
+//NOTE: calls are never cancelled - fill_batch must return regularly,
+//      with no events if the camera is idle
+typedef struct spiffer_plugin {
+  uint         abi;             // SPIFFER_PLUGIN_ABI
+
+  // set the plugin up - once, when loaded
+  int    (* init)       (const plugin_host_t * host);
+
+  // find cameras - ids must contain the camera serial number
+  // returns the number of ids
+  int    (* discover)   (char (* ids)[SPIFFER_PLUGIN_ID_SIZE], int max);
+
+  // open a camera found by discover - returns NULL on error
+  void * (* open)       (const char * id);
+
+  // get the serial number of a camera
+  int    (* serial)     (void * dev, char * sn, size_t size);
+
+  // start camera event transmission - returns sensor size and a
+  // short description for the log
+  int    (* start)      (void * dev, const plugin_start_t * ps, uint * width, uint * height,
+                         char * info, size_t size);
+
+  // fill a batch with spif events - SPIFFER_ERROR if disconnected
+  int    (* fill_batch) (void * dev, plugin_batch_t * batch);
+
+  // apply sensor settings - may be NULL
+  void   (* sensor)     (void * dev, int pipe, const sensor_cfg_t * sc);
+
+  // stop and close a camera
+  void   (* close)      (void * dev);
+} spiffer_plugin_t;
+
+typedef const spiffer_plugin_t * (* plugin_entry_t) (void);
+
+// camera plugins known to spiffer
+typedef struct plugin {
+  const char *             name;          // camera make - for the log
+  const char *             tag;           // listener thread name
+  const char *             lib;           // shared object
+  void *                   so;            // dlopen handle - NULL: not loaded
+  const spiffer_plugin_t * ops;
+  bool                     failed;        // could not be loaded - not tried again
+} plugin_t;
+
+// USB cameras supported by plugins
+typedef struct plugin_id {
+  uint vid;                     // USB vendor ID
+  uint pid;                     // USB product ID - 0: any
+  int  plugin;
+} plugin_id_t;
+
+
+//--------------------------------------------------------------------
+// find the plugin that supports a USB device
+//
+// returns the plugin or SPIFFER_PLUGIN_NONE
+//--------------------------------------------------------------------
+int spiffer_plugin_find (uint vid, uint pid);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// discover and open new cameras
+// plugins are loaded the first time a matching USB device is present
+//
+// new cameras get a free device entry - and a pipe later
+//--------------------------------------------------------------------
+void spiffer_plugin_discover_devs (void);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// receive events from a camera and forward them to spif
+// the plugin fills camera queue buffers directly
+//
+// terminated as a result of signal servicing
+//--------------------------------------------------------------------
+void * spiffer_plugin_listener (void * data);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// close a camera
+//--------------------------------------------------------------------
+void spiffer_plugin_shutdown_dev (int dev);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// plugin entry point - implemented by every plugin
+//--------------------------------------------------------------------
+extern "C" const spiffer_plugin_t * spiffer_plugin_get (void);
+//--------------------------------------------------------------------
+
+
+#endif /* __SPIFFER_PLUGIN_H__ */
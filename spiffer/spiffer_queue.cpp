@@ -0,0 +1,315 @@
+//************************************************//
+//*                                              *//
+//*      spiffer camera acquisition queues       *//
+//*                                              *//
+//* camera acquisition threads fill buffers of   *//
+//* events into a lock-free ring and a DMA       *//
+//* thread drains it into the pipe batch, so     *//
+//* that waiting for spif never holds up the     *//
+//* USB stack                                    *//
+//*                                              *//
+//************************************************//
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "spiffer_queue.h"
+#include "spiffer_batch.h"
+#include "spiffer_camera.h"
+#include "spiffer_config.h"
+#include "spiffer_rt.h"
+
+// global variables
+// spiffer configuration
+extern spiffer_cfg_t cfg;
+
+// log file
+extern FILE * lf;
+
+// per-pipe camera queues
+queue_t queue[SPIFFER_PIPES_MAX];
+
+
+//--------------------------------------------------------------------
+// queue the event buffer being filled
+// and let the DMA thread know
+//--------------------------------------------------------------------
+static void queue_push (queue_t * qu, uint num, bool end) {
+  uint tl = qu->tail.load (std::memory_order_relaxed);
+  uint dp = tl - qu->head.load (std::memory_order_relaxed);
+
+  qu->cur->cnt = num;
+  qu->cur->end = end;
+  qu->tail.store (tl + 1, std::memory_order_release);
+
+  // update statistics,
+  qu->depth_sum += dp;
+  if (dp > qu->depth_max) {
+    qu->depth_max = dp;
+  }
+
+  // and let the DMA thread know
+  uint64_t sig = 1;
+  (void) write (qu->efd, &sig, sizeof (sig));
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// start the DMA thread of a camera on a pipe
+// it drains the queue into the pipe batch - the camera
+// acquisition thread only fills the queue
+//
+// called by camera listeners once event processing is started
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_queue_start (int pipe) {
+  queue_t * qu = &queue[pipe];
+
+  // a depth of 0 means "use default" - rounded up to a power of 2
+  uint depth = cfg.pipe[pipe].queue_depth;
+  if (depth == 0) {
+    depth = SPIFFER_QUEUE_DEPTH;
+  }
+  if (depth & (depth - 1)) {
+    depth = 1u << (32 - __builtin_clz (depth));
+  }
+
+  // the ring is kept across camera restarts,
+  if (qu->depth != depth) {
+    free (qu->ring);
+    qu->ring = (queue_buf_t *) malloc (depth * sizeof (queue_buf_t));
+    if (qu->ring == NULL) {
+      qu->depth = 0;
+      return (SPIFFER_ERROR);
+    }
+    qu->depth = depth;
+  }
+
+  qu->efd = eventfd (0, EFD_NONBLOCK);
+  if (qu->efd == SPIFFER_ERROR) {
+    return (SPIFFER_ERROR);
+  }
+
+  // drop events from the previous run,
+  qu->pipe = pipe;
+  qu->head.store (0);
+  qu->tail.store (0);
+  qu->cur    = &qu->ring[0];
+  qu->open   = 0;
+  qu->read   = 0;
+  qu->budget = cfg.pipe[pipe].read_budget;
+
+  // and start draining the queue into the pipe batch
+  spiffer_batch_start (pipe);
+
+  if (spiffer_rt_create (&qu->thread, spiffer_queue_listener, (void *) qu, "queue") != 0) {
+    close (qu->efd);
+    return (SPIFFER_ERROR);
+  }
+  qu->running.store (true);
+
+  return (SPIFFER_OK);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// stop the DMA thread of a camera on a pipe - if running
+//
+// runs as a cleanup handler when the camera listener is cancelled
+//--------------------------------------------------------------------
+void spiffer_queue_stop (void * data) {
+  queue_t * qu = &queue[*((int *) data)];
+
+  //NOTE: only one caller gets to stop it
+  if (!qu->running.exchange (false)) {
+    return;
+  }
+
+  (void) pthread_cancel (qu->thread);
+  pthread_join (qu->thread, NULL);
+
+  close (qu->efd);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// get the event buffer to be filled next
+//
+// never fails - if the queue is full the buffer is dropped when put
+//--------------------------------------------------------------------
+queue_buf_t * spiffer_queue_get (int pipe) {
+  queue_t * qu = &queue[pipe];
+
+  uint tl = qu->tail.load (std::memory_order_relaxed);
+
+  if ((tl - qu->head.load (std::memory_order_acquire)) == qu->depth) {
+    qu->cur = &qu->spare;
+  } else {
+    qu->cur = &qu->ring[tl & (qu->depth - 1)];
+  }
+
+  return (qu->cur);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// check if the queue is full - the next buffer would be dropped
+// used by producers that can wait, e.g., recording replay
+//--------------------------------------------------------------------
+bool spiffer_queue_full (int pipe) {
+  queue_t * qu = &queue[pipe];
+
+  return ((qu->tail.load (std::memory_order_relaxed) - qu->head.load (std::memory_order_acquire)) == qu->depth);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// queue the event buffer being filled - if not empty
+// and let the DMA thread know
+//--------------------------------------------------------------------
+void spiffer_queue_put (int pipe, uint num) {
+  queue_t * qu = &queue[pipe];
+
+  if (num == 0) {
+    return;
+  }
+
+  // drop the buffer if the ring was full,
+  if (qu->cur == &qu->spare) {
+    qu->overflow++;
+    qu->lost += num;
+    return;
+  }
+
+  // or queue it
+  queue_push (qu, num, false);
+
+  qu->open++;
+  qu->bufs++;
+  qu->evts += num;
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// end a camera read of raw data
+// events read are sent to spif together, once reads add up to
+// the configured budget - bytes = 0 sends them now (e.g., when
+// the camera is idle)
+//
+// only matters if the pipe has no batch deadline - batches are
+// sent when the camera is drained
+//--------------------------------------------------------------------
+void spiffer_queue_end (int pipe, size_t bytes) {
+  queue_t * qu = &queue[pipe];
+
+  qu->read += bytes;
+
+  // nothing to send - or keep reading up to the budget,
+  if ((qu->open == 0) || ((bytes != 0) && (qu->read < qu->budget))) {
+    return;
+  }
+
+  // an empty buffer marks the end of the read,
+  //NOTE: if the queue is full the mark is tried again on the next read
+  if (spiffer_queue_get (pipe) == &qu->spare) {
+    return;
+  }
+
+  queue_push (qu, 0, true);
+
+  qu->open = 0;
+  qu->read = 0;
+  qu->reads++;
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// drain the queue of a camera into its pipe batch
+//
+// terminated when the camera listener is cancelled
+//--------------------------------------------------------------------
+void * spiffer_queue_listener (void * data) {
+  queue_t * qu   = (queue_t *) data;
+  int       pipe = qu->pipe;
+
+  // block signals - should be handled in a different thread
+  sigset_t set;
+  sigfillset (&set);
+  sigprocmask (SIG_BLOCK, &set, NULL);
+
+  // pin thread and set its priority - as the camera listener
+  spiffer_rt_thread (RT_INPUT, pipe, "dma");
+
+  struct pollfd   pfd = {qu->efd, POLLIN, 0};
+  struct timespec ts;
+
+  //NOTE: without a batch deadline the camera is drained
+  //      at the end of every read (or read budget)
+  bool deadline = (cfg.pipe[pipe].batch_delay != 0);
+
+  while (1) {
+    // process queued buffers and add them to the current batch,
+    bool drained = false;
+    uint hd      = qu->head.load (std::memory_order_relaxed);
+    while (hd != qu->tail.load (std::memory_order_acquire)) {
+      queue_buf_t * qb = &qu->ring[hd & (qu->depth - 1)];
+
+      spiffer_camera_add (pipe, qb->evts, qb->ts, qb->cnt);
+      drained |= qb->end;
+
+      qu->head.store (++hd, std::memory_order_release);
+    }
+
+    // send batch if the camera was drained or its deadline has expired,
+    if (drained || deadline) {
+      spiffer_batch_poll (pipe);
+    }
+
+    // and wait for more buffers - or until the batch deadline
+    //NOTE: this is a thread cancellation point
+    struct timespec * to = deadline ? spiffer_batch_timeout (pipe, &ts) : NULL;
+    if (ppoll (&pfd, 1, to, NULL) > 0) {
+      uint64_t sig;
+      (void) read (qu->efd, &sig, sizeof (sig));
+    }
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// report queue statistics to the log file
+//--------------------------------------------------------------------
+void spiffer_queue_report (int pipe) {
+  queue_t * qu = &queue[pipe];
+
+  if (qu->depth == 0) {
+    return;
+  }
+
+  log_time ();
+  fprintf (lf, "pipe%i camera queue: reads: %llu buffers: %llu events: %llu depth mean: %.1f max: %u/%u overflow buffers: %llu events: %llu\n",
+           pipe,
+           (unsigned long long) qu->reads,
+           (unsigned long long) qu->bufs,
+           (unsigned long long) qu->evts,
+           qu->bufs ? (double) qu->depth_sum / qu->bufs : 0.0,
+           qu->depth_max, qu->depth,
+           (unsigned long long) qu->overflow,
+           (unsigned long long) qu->lost
+           );
+}
+//--------------------------------------------------------------------
@@ -0,0 +1,139 @@
+//************************************************//
+//*                                              *//
+//*      spiffer camera acquisition queues       *//
+//*                                              *//
+//************************************************//
+
+#ifndef __SPIFFER_QUEUE_H__
+#define __SPIFFER_QUEUE_H__
+
+
+#include <atomic>
+#include <cstdint>
+
+#include <pthread.h>
+#include <sys/types.h>
+
+// spif and spiffer constants and function prototypes
+#include "spif.h"
+#include "spiffer.h"
+
+// event buffers held per camera - default
+#define SPIFFER_QUEUE_DEPTH  64
+
+// event buffer - events and their timestamps
+typedef struct queue_buf {
+  uint cnt;
+  bool end;                     // ends a camera read - send the batch
+  uint evts[SPIFFER_BATCH_SIZE];
+  uint ts[SPIFFER_BATCH_SIZE];
+} queue_buf_t;
+
+// per-pipe camera queue - a single-producer/single-consumer ring
+//NOTE: the producer (acquisition thread) owns tail and cur,
+//      the consumer (DMA thread) owns head - in separate cache lines
+typedef struct alignas (SPIFFER_CACHE_LINE) queue {
+  int               pipe;
+  queue_buf_t *     ring;
+  uint              depth;      // buffers - a power of 2
+  alignas (SPIFFER_CACHE_LINE)
+  std::atomic<uint> head;
+  alignas (SPIFFER_CACHE_LINE)
+  std::atomic<uint> tail;
+  queue_buf_t *     cur;        // buffer being filled
+  uint              open;       // buffers queued since the last read end
+  size_t            read;       // raw bytes read since the last read end
+  size_t            budget;     // raw bytes read per batch - 0: every read
+  queue_buf_t       spare;      // filled when the ring is full - dropped
+  int               efd;        // producer signals new buffers
+  pthread_t         thread;     // consumer
+  std::atomic<bool> running;    // DMA thread started - stopped once
+
+  // statistics
+  uint64_t          reads;      // camera reads ended
+  uint64_t          bufs;       // buffers queued
+  uint64_t          evts;       // events queued
+  uint64_t          depth_sum;  // queue depth seen by the producer
+  uint              depth_max;
+  uint64_t          overflow;   // buffers dropped - ring full
+  uint64_t          lost;       // events dropped - ring full
+} queue_t;
+
+
+//--------------------------------------------------------------------
+// start the DMA thread of a camera on a pipe
+// it drains the queue into the pipe batch - the camera
+// acquisition thread only fills the queue
+//
+// called by camera listeners once event processing is started
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_queue_start (int pipe);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// stop the DMA thread of a camera on a pipe - if running
+//
+// runs as a cleanup handler when the camera listener is cancelled
+//--------------------------------------------------------------------
+void spiffer_queue_stop (void * data);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// get the event buffer to be filled next
+//
+// never fails - if the queue is full the buffer is dropped when put
+//--------------------------------------------------------------------
+queue_buf_t * spiffer_queue_get (int pipe);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// check if the queue is full - the next buffer would be dropped
+// used by producers that can wait, e.g., recording replay
+//--------------------------------------------------------------------
+bool spiffer_queue_full (int pipe);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// queue the event buffer being filled - if not empty
+// and let the DMA thread know
+//--------------------------------------------------------------------
+void spiffer_queue_put (int pipe, uint num);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// end a camera read of raw data
+// events read are sent to spif together, once reads add up to
+// the configured budget - bytes = 0 sends them now (e.g., when
+// the camera is idle)
+//
+// only matters if the pipe has no batch deadline - batches are
+// sent when the camera is drained
+//--------------------------------------------------------------------
+void spiffer_queue_end (int pipe, size_t bytes);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// drain the queue of a camera into its pipe batch
+//
+// terminated when the camera listener is cancelled
+//--------------------------------------------------------------------
+void * spiffer_queue_listener (void * data);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// report queue statistics to the log file
+//--------------------------------------------------------------------
+void spiffer_queue_report (int pipe);
+//--------------------------------------------------------------------
+
+
+#endif /* __SPIFFER_QUEUE_H__ */
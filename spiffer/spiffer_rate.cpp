@@ -0,0 +1,207 @@
+//************************************************//
+//*                                              *//
+//*          spiffer input rate limiting         *//
+//*                                              *//
+//* a per-pipe token bucket sheds events over a  *//
+//* configured rate before they reach spif, so   *//
+//* that overload is not handled by the spif     *//
+//* input drop timeout                           *//
+//*                                              *//
+//************************************************//
+
+#include <cstdio>
+#include <cstring>
+
+#include "spiffer_rate.h"
+#include "spiffer_batch.h"
+#include "spiffer_config.h"
+
+// global variables
+// spiffer configuration
+extern spiffer_cfg_t cfg;
+
+// log file
+extern FILE * lf;
+
+// per-pipe token buckets
+rate_t rate[SPIFFER_PIPES_MAX];
+
+// policy names - same order as rate_policy_t
+static const char * rate_policy_names[] = {"newest", "oldest", "subsample"};
+
+
+//--------------------------------------------------------------------
+// select the policy used to shed events over the rate limit
+// arg is one of: newest, oldest or subsample
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_rate_config (int pipe, const char * arg) {
+  for (uint i = RATE_DROP_NEWEST; i <= RATE_SUBSAMPLE; i++) {
+    if (strcmp (arg, rate_policy_names[i]) == 0) {
+      cfg.pipe[pipe].rate_policy = i;
+      return (SPIFFER_OK);
+    }
+  }
+
+  return (SPIFFER_ERROR);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// start rate limiting on a pipe
+// limit, bucket size and policy are taken from the pipe configuration
+//--------------------------------------------------------------------
+void spiffer_rate_start (int pipe) {
+  rate_t * rt = &rate[pipe];
+
+  rt->rate   = cfg.pipe[pipe].rate_limit;
+  rt->policy = cfg.pipe[pipe].rate_policy;
+
+  // a bucket size of 0 means "events allowed in SPIFFER_RATE_BURST_MS"
+  rt->burst = cfg.pipe[pipe].rate_burst;
+  if (rt->burst == 0) {
+    rt->burst = (double) rt->rate * SPIFFER_RATE_BURST_MS / 1000;
+  }
+
+  if (rt->burst < 1) {
+    rt->burst = 1;
+  }
+
+  // start with a full bucket
+  rt->tokens = rt->burst;
+  rt->last   = spiffer_batch_now ();
+
+  rt->ts_next = false;
+  rt->ts_drop = false;
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// drop events over the rate limit of a pipe
+// kept events are compacted in place
+//
+// events are dropped whole - with the timestamp that follows them
+//
+// returns the number of kept words
+//--------------------------------------------------------------------
+uint spiffer_rate_apply (int pipe, uint * evts, uint num) {
+  rate_t * rt = &rate[pipe];
+
+  if ((rt->rate == 0) || (num == 0)) {
+    return (num);
+  }
+
+  // refill the bucket,
+  uint64_t now = spiffer_batch_now ();
+  rt->tokens += (double) (now - rt->last) * rt->rate / 1000000000;
+  rt->last    = now;
+  if (rt->tokens > rt->burst) {
+    rt->tokens = rt->burst;
+  }
+
+  // count events - not their timestamps,
+  //NOTE: events without the no-timestamp bit are followed by one
+  bool lead = rt->ts_next;
+  bool tn   = rt->ts_next;
+  uint nev  = 0;
+  for (uint i = 0; i < num; i++) {
+    if (tn) {
+      tn = false;
+    } else {
+      nev++;
+      tn = !(evts[i] & SPIFFER_EVT_NO_TS);
+    }
+  }
+
+  rt->evts += nev;
+
+  // take as many tokens as possible,
+  uint kept = (rt->tokens >= nev) ? nev : (uint) rt->tokens;
+  rt->tokens -= kept;
+
+  // nothing to drop - not even the timestamp of a dropped event,
+  if ((kept == nev) && !(lead && rt->ts_drop)) {
+    rt->ts_next = tn;
+    rt->ts_drop = false;
+    return (num);
+  }
+
+  rt->dropped += nev - kept;
+
+  // and shed the rest according to policy - whole events
+  uint cnt = 0;
+  uint ev  = 0;
+  uint acc = 0;
+  for (uint i = 0; i < num; i++) {
+    uint e = evts[i];
+
+    // a timestamp goes wherever its event went,
+    if (rt->ts_next) {
+      rt->ts_next = false;
+      if (!rt->ts_drop) {
+        evts[cnt++] = e;
+      }
+      continue;
+    }
+
+    bool keep;
+    switch (rt->policy) {
+    case RATE_DROP_OLDEST:
+      keep = (ev >= (nev - kept));
+      break;
+
+    case RATE_SUBSAMPLE:
+      // keep kept out of every nev events, evenly spread
+      acc += kept;
+      keep = (acc >= nev);
+      if (keep) {
+        acc -= nev;
+      }
+      break;
+
+    default:
+      keep = (ev < kept);
+      break;
+    }
+    ev++;
+
+    if (keep) {
+      evts[cnt++] = e;
+    }
+
+    rt->ts_next = !(e & SPIFFER_EVT_NO_TS);
+    rt->ts_drop = !keep;
+  }
+
+  return (cnt);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// report rate limiter statistics to the log file
+//
+// returns the number of events dropped by the rate limiter
+//--------------------------------------------------------------------
+uint64_t spiffer_rate_report (int pipe) {
+  rate_t * rt = &rate[pipe];
+
+  if (rt->rate == 0) {
+    return (0);
+  }
+
+  log_time ();
+  fprintf (lf, "pipe%i rate limit: %llu events/s (policy %s) - events: %llu dropped: %llu\n",
+           pipe,
+           (unsigned long long) rt->rate,
+           rate_policy_names[rt->policy],
+           (unsigned long long) rt->evts,
+           (unsigned long long) rt->dropped
+           );
+
+  return (rt->dropped);
+}
+//--------------------------------------------------------------------
@@ -0,0 +1,84 @@
+//************************************************//
+//*                                              *//
+//*          spiffer input rate limiting         *//
+//*                                              *//
+//************************************************//
+
+#ifndef __SPIFFER_RATE_H__
+#define __SPIFFER_RATE_H__
+
+
+#include <cstdint>
+
+#include <sys/types.h>
+
+// spif and spiffer constants and function prototypes
+#include "spif.h"
+#include "spiffer.h"
+
+// default bucket size - events allowed in this time (ms) at full rate
+#define SPIFFER_RATE_BURST_MS  10
+
+// policies used to shed events over the rate limit
+typedef enum {
+  RATE_DROP_NEWEST,   // keep the first events
+  RATE_DROP_OLDEST,   // keep the last events
+  RATE_SUBSAMPLE      // keep events evenly spread
+} rate_policy_t;
+
+// per-pipe token bucket
+typedef struct alignas (SPIFFER_CACHE_LINE) rate {
+  uint64_t rate;      // events per second - 0: no limit
+  double   burst;     // bucket size (events)
+  double   tokens;    // events that can be sent now
+  uint64_t last;      // last bucket refill (ns)
+  uint     policy;    // rate_policy_t
+  bool     ts_next;   // next word is a timestamp - split across calls
+  bool     ts_drop;   // and its event was dropped
+
+  // statistics
+  uint64_t evts;      // events offered
+  uint64_t dropped;   // events dropped
+} rate_t;
+
+
+//--------------------------------------------------------------------
+// select the policy used to shed events over the rate limit
+// arg is one of: newest, oldest or subsample
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_rate_config (int pipe, const char * arg);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// start rate limiting on a pipe
+// limit, bucket size and policy are taken from the pipe configuration
+//--------------------------------------------------------------------
+void spiffer_rate_start (int pipe);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// drop events over the rate limit of a pipe
+// kept events are compacted in place
+//
+// events are dropped whole - with the timestamp that follows them
+//
+// returns the number of kept words
+//--------------------------------------------------------------------
+uint spiffer_rate_apply (int pipe, uint * evts, uint num);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// report rate limiter statistics to the log file
+//
+// returns the number of events dropped by the rate limiter
+//--------------------------------------------------------------------
+uint64_t spiffer_rate_report (int pipe);
+//--------------------------------------------------------------------
+
+
+#endif /* __SPIFFER_RATE_H__ */
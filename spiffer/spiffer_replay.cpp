@@ -0,0 +1,806 @@
+//************************************************//
+//*                                              *//
+//*        spiffer recorded camera replay        *//
+//*                                              *//
+//* memory-mapped camera recordings are streamed *//
+//* into a pipe as a virtual camera - in real    *//
+//* time, scaled or as fast as possible - so     *//
+//* that camera workloads can be reproduced      *//
+//* without a camera                             *//
+//*                                              *//
+//************************************************//
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "spiffer_replay.h"
+#include "spiffer_camera.h"
+#include "spiffer_config.h"
+#include "spiffer_queue.h"
+#include "spiffer_route.h"
+#include "spiffer_rt.h"
+
+// global variables
+// spiffer configuration
+extern spiffer_cfg_t cfg;
+
+// spif pipes
+extern int          pipe_num_in;
+extern pipe_ctx_t * pipe_ctx;
+
+// USB devices
+extern usb_devs_t usb_devs;
+
+// used to pass integers as (void *)
+extern int dev_to_ptr[SPIFFER_USB_DISCOVER_CNT + 1];
+
+// log file
+extern FILE * lf;
+
+// per-pipe replay state
+replay_t replay[SPIFFER_PIPES_MAX];
+
+// AEDAT 4.0 files start with a version line
+#define AEDAT4_VERSION     "#!AER-DAT4.0\r\n"
+
+// AEDAT 4.0 event packets - flatbuffers of Event structs
+#define AEDAT4_EVTS_ID     "EVTS"
+#define AEDAT4_EVT_SIZE    16
+
+static const char * replay_fmt_name[] = {"spif", "Prophesee raw", "AEDAT 4.0"};
+
+
+//--------------------------------------------------------------------
+// read unaligned little-endian values from a recording
+//--------------------------------------------------------------------
+static inline uint16_t rd16 (const uint8_t * p) {
+  uint16_t v;
+  memcpy (&v, p, sizeof (v));
+  return (v);
+}
+
+static inline uint32_t rd32 (const uint8_t * p) {
+  uint32_t v;
+  memcpy (&v, p, sizeof (v));
+  return (v);
+}
+
+static inline uint64_t rd64 (const uint8_t * p) {
+  uint64_t v;
+  memcpy (&v, p, sizeof (v));
+  return (v);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// get current time (in ns)
+//--------------------------------------------------------------------
+static uint64_t replay_now (void) {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ((uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// find a flatbuffer table field
+//
+// returns the field offset or 0 if not present
+//--------------------------------------------------------------------
+static size_t fb_field (const uint8_t * fb, size_t len, size_t table, uint field) {
+  if ((table + 4) > len) {
+    return (0);
+  }
+
+  // the table starts with a (signed) offset to its vtable,
+  size_t vt = table - (int32_t) rd32 (&fb[table]);
+  if ((vt + 4) > len) {
+    return (0);
+  }
+
+  // which lists the offsets of the fields present
+  size_t vt_size = rd16 (&fb[vt]);
+  size_t entry   = 4 + 2 * field;
+  if ((entry + 2) > vt_size || (vt + vt_size) > len) {
+    return (0);
+  }
+
+  uint off = rd16 (&fb[vt + entry]);
+  if ((off == 0) || ((table + off) >= len)) {
+    return (0);
+  }
+
+  return (table + off);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// find the root table of a flatbuffer - with or without size prefix
+//
+// returns the root table offset or 0 if the buffer is too small
+//--------------------------------------------------------------------
+static size_t fb_root (const uint8_t ** fb, size_t * len) {
+  if (*len < 8) {
+    return (0);
+  }
+
+  if ((rd32 (*fb) + 4) == *len) {
+    *fb  += 4;
+    *len -= 4;
+  }
+
+  size_t root = rd32 (*fb);
+  return ((root < *len) ? root : 0);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// find the number that follows a key in a recording header
+// e.g., width=640 or <attr key="sizeX" type="int">640</attr>
+//
+// returns 0 if not found
+//--------------------------------------------------------------------
+static uint replay_hdr_num (const char * hdr, size_t len, const char * key, char sep) {
+  const char * k = (const char *) memmem (hdr, len, key, strlen (key));
+  if (k == NULL) {
+    return (0);
+  }
+
+  const char * s = (const char *) memchr (k, sep, hdr + len - k);
+  if (s == NULL) {
+    return (0);
+  }
+
+  return ((uint) strtoul (s + 1, NULL, 10));
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// parse the header of an AEDAT 4.0 recording
+// only uncompressed recordings can be replayed
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+static int replay_aedat4_open (replay_t * rp) {
+  size_t pos = strlen (AEDAT4_VERSION);
+  if ((pos + 4) > rp->size) {
+    return (SPIFFER_ERROR);
+  }
+
+  // the version line is followed by the size of the IO header,
+  size_t          len = rd32 (&rp->map[pos]);
+  const uint8_t * fb  = &rp->map[pos + 4];
+  if ((pos + 4 + len) > rp->size) {
+    return (SPIFFER_ERROR);
+  }
+  rp->start = pos + 4 + len;
+  rp->end   = rp->size;
+
+  // and the IO header itself - a flatbuffer,
+  size_t root = fb_root (&fb, &len);
+  if (root == 0) {
+    return (SPIFFER_ERROR);
+  }
+
+  // compression - NONE if not present,
+  size_t f = fb_field (fb, len, root, 0);
+  if ((f != 0) && (rd32 (&fb[f]) != 0)) {
+    log_time ();
+    fprintf (lf, "error: compressed AEDAT 4.0 recordings are not supported\n");
+    return (SPIFFER_ERROR);
+  }
+
+  // data table position - events end there,
+  f = fb_field (fb, len, root, 1);
+  if (f != 0) {
+    int64_t dtp = (int64_t) rd64 (&fb[f]);
+    if ((dtp > (int64_t) rp->start) && ((size_t) dtp < rp->size)) {
+      rp->end = dtp;
+    }
+  }
+
+  // and sensor size - from the stream descriptions
+  f = fb_field (fb, len, root, 2);
+  if ((f != 0) && ((f + rd32 (&fb[f]) + 4) <= len)) {
+    size_t       s   = f + rd32 (&fb[f]);
+    const char * xml = (const char *) &fb[s + 4];
+    size_t       xl  = rd32 (&fb[s]);
+    if ((s + 4 + xl) <= len) {
+      rp->width  = replay_hdr_num (xml, xl, "\"sizeX\"", '>');
+      rp->height = replay_hdr_num (xml, xl, "\"sizeY\"", '>');
+    }
+  }
+
+  return (SPIFFER_OK);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// parse the header of a Prophesee raw recording - "% ..." lines
+// only EVT 2.0 and EVT 3.0 recordings can be replayed
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+static int replay_raw_open (replay_t * rp) {
+  evt_format_t format = EVT_NONE;
+  size_t       pos    = 0;
+
+  while ((pos < rp->size) && (rp->map[pos] == '%')) {
+    const char * line = (const char *) &rp->map[pos];
+    const char * eol  = (const char *) memchr (line, '\n', rp->size - pos);
+    if (eol == NULL) {
+      return (SPIFFER_ERROR);
+    }
+
+    // format - e.g., "% format EVT3;height=720;width=1280" or "% evt 3.0",
+    char buf[256];
+    size_t ll = ((size_t) (eol - line) < sizeof (buf)) ? (size_t) (eol - line) : sizeof (buf) - 1;
+    memcpy (buf, line, ll);
+    buf[ll] = '\0';
+
+    if ((format == EVT_NONE) && ((strstr (buf, "format") != NULL) || (strstr (buf, "evt") != NULL))) {
+      format = spiffer_evt_format (buf);
+    }
+
+    // and sensor size - e.g., "width=1280" or "% geometry 1280x720"
+    if (rp->width == 0) {
+      rp->width  = replay_hdr_num (buf, ll, "width", '=');
+      rp->height = replay_hdr_num (buf, ll, "height", '=');
+    }
+    if ((rp->width == 0) && (strncmp (buf, "% geometry ", 11) == 0)) {
+      rp->width  = (uint) strtoul (&buf[11], NULL, 10);
+      rp->height = replay_hdr_num (buf, ll, "geometry", 'x');
+    }
+
+    pos = eol + 1 - (const char *) rp->map;
+  }
+
+  if (format == EVT_NONE) {
+    log_time ();
+    fprintf (lf, "error: raw recording format not supported\n");
+    return (SPIFFER_ERROR);
+  }
+
+  spiffer_evt_init (&rp->dec, format);
+  rp->start = pos;
+  rp->end   = rp->size;
+
+  return (SPIFFER_OK);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// open and map a recording - and find its format
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+static int replay_open (replay_t * rp, const char * name) {
+  struct stat st;
+
+  rp->fd = open (name, O_RDONLY);
+  if ((rp->fd == SPIFFER_ERROR) || (fstat (rp->fd, &st) == SPIFFER_ERROR) || (st.st_size == 0)) {
+    if (rp->fd != SPIFFER_ERROR) {
+      close (rp->fd);
+    }
+    return (SPIFFER_ERROR);
+  }
+
+  // recordings are read sequentially,
+  rp->size = st.st_size;
+  rp->map  = (const uint8_t *) mmap (NULL, rp->size, PROT_READ, MAP_PRIVATE, rp->fd, 0);
+  if (rp->map == MAP_FAILED) {
+    rp->map = NULL;
+    close (rp->fd);
+    return (SPIFFER_ERROR);
+  }
+  (void) madvise ((void *) rp->map, rp->size, MADV_SEQUENTIAL);
+
+  // and their format is found from their header
+  rp->width  = 0;
+  rp->height = 0;
+
+  int rc;
+  if ((rp->size >= strlen (AEDAT4_VERSION)) &&
+      (memcmp (rp->map, AEDAT4_VERSION, strlen (AEDAT4_VERSION)) == 0)) {
+    rp->fmt = REPLAY_AEDAT4;
+    rc      = replay_aedat4_open (rp);
+  } else if (rp->map[0] == '%') {
+    rp->fmt = REPLAY_RAW;
+    rc      = replay_raw_open (rp);
+  } else {
+    rp->fmt   = REPLAY_BIN;
+    rp->start = 0;
+    rp->end   = rp->size;
+    rc        = SPIFFER_OK;
+  }
+
+  // unknown sensor size - events are not checked against it
+  if ((rp->width == 0) || (rp->height == 0)) {
+    rp->width  = SPIFFER_EVT_X_MASK + 1;
+    rp->height = SPIFFER_EVT_Y_MASK + 1;
+  }
+
+  if (rc == SPIFFER_ERROR) {
+    munmap ((void *) rp->map, rp->size);
+    rp->map = NULL;
+    close (rp->fd);
+  }
+
+  return (rc);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// start a new pass over a recording
+//--------------------------------------------------------------------
+static void replay_rewind (replay_t * rp) {
+  rp->pos      = rp->start;
+  rp->elems    = NULL;
+  rp->elem_num = 0;
+  rp->elem_idx = 0;
+  rp->ts_valid = false;
+  rp->ts_last  = 0;
+
+  if (rp->fmt == REPLAY_RAW) {
+    spiffer_evt_init (&rp->dec, rp->dec.format);
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// find the next event packet of an AEDAT 4.0 recording
+// packets of other streams are skipped
+//
+// returns false at the end of the recording
+//--------------------------------------------------------------------
+static bool replay_aedat4_packet (replay_t * rp) {
+  while ((rp->pos + 8) <= rp->end) {
+    // packets start with stream ID and size,
+    size_t          len = rd32 (&rp->map[rp->pos + 4]);
+    const uint8_t * fb  = &rp->map[rp->pos + 8];
+    if ((rp->pos + 8 + len) > rp->end) {
+      return (false);
+    }
+    rp->pos += 8 + len;
+
+    // only event packets count,
+    size_t root = fb_root (&fb, &len);
+    if ((root == 0) || (memcmp (&fb[4], AEDAT4_EVTS_ID, 4) != 0)) {
+      continue;
+    }
+
+    // and their events are a vector of structs
+    size_t f = fb_field (fb, len, root, 0);
+    if ((f == 0) || ((f + 4) > len)) {
+      continue;
+    }
+
+    size_t v = f + rd32 (&fb[f]);
+    if ((v + 4) > len) {
+      continue;
+    }
+
+    uint num = rd32 (&fb[v]);
+    if ((num == 0) || ((v + 4 + (size_t) num * AEDAT4_EVT_SIZE) > len)) {
+      continue;
+    }
+
+    rp->elems    = &fb[v + 4];
+    rp->elem_num = num;
+    rp->elem_idx = 0;
+    return (true);
+  }
+
+  return (false);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// decode the next events of a recording into spif events
+//
+// returns the number of events - 0 at the end of the recording
+//--------------------------------------------------------------------
+static uint replay_decode (replay_t * rp, uint * evts, uint * ts, uint max) {
+  uint cnt = 0;
+
+  switch (rp->fmt) {
+  // spif events - a timestamp follows events with bit 31 clear,
+  case REPLAY_BIN: {
+    uint t = (uint) rp->ts_last;
+    while ((cnt < max) && ((rp->pos + 4) <= rp->end)) {
+      uint w = rd32 (&rp->map[rp->pos]);
+      rp->pos += 4;
+
+      if (!(w & SPIFFER_EVT_NO_TS)) {
+        if ((rp->pos + 4) > rp->end) {
+          break;
+        }
+        t = rd32 (&rp->map[rp->pos]);
+        rp->pos += 4;
+      }
+
+      evts[cnt]  = w | SPIFFER_EVT_NO_TS;
+      ts[cnt++]  = t;
+    }
+    break;
+  }
+
+  // Prophesee raw data - some words carry no events,
+  case REPLAY_RAW:
+    while ((cnt == 0) && (rp->pos < rp->end)) {
+      size_t used;
+      cnt = spiffer_evt_decode (&rp->dec, &rp->map[rp->pos], rp->end - rp->pos, &used, evts, ts, max);
+      if (used == 0) {
+        break;
+      }
+      rp->pos += used;
+    }
+    break;
+
+  // and AEDAT 4.0 event packets
+  case REPLAY_AEDAT4:
+    while (cnt < max) {
+      if ((rp->elem_idx == rp->elem_num) && !replay_aedat4_packet (rp)) {
+        break;
+      }
+
+      const uint8_t * e = &rp->elems[(size_t) rp->elem_idx++ * AEDAT4_EVT_SIZE];
+      uint x = rd16 (&e[8]);
+      uint y = rd16 (&e[10]);
+      uint p = e[12] ? 1 : 0;
+
+      evts[cnt] = SPIFFER_EVT_NO_TS | (x << SPIFFER_EVT_X_SHIFT) | (p << SPIFFER_EVT_P_SHIFT) | (y << SPIFFER_EVT_Y_SHIFT);
+      ts[cnt++] = (uint) rd64 (e);
+    }
+    break;
+  }
+
+  return (cnt);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// get the recording time of an event - relative to the first event
+// of the pass (us). 32-bit timestamps are extended when they wrap
+//--------------------------------------------------------------------
+static uint64_t replay_time (replay_t * rp, uint ts) {
+  uint64_t t = (rp->ts_last & ~0xffffffffull) | ts;
+
+  if (!rp->ts_valid) {
+    rp->ts_valid = true;
+    rp->ts_first = t;
+  } else if ((ts < (uint) rp->ts_last) && (((uint) rp->ts_last - ts) > 0x80000000u)) {
+    t += 1ull << 32;
+  }
+
+  // events out of order keep their place
+  if (t > rp->ts_last) {
+    rp->ts_last = t;
+  }
+
+  return ((t > rp->ts_first) ? t - rp->ts_first : 0);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// get the next queue buffer
+// unpaced replay never drops events - it waits for the queue to drain
+//
+//NOTE: this is a thread cancellation point
+//--------------------------------------------------------------------
+static queue_buf_t * replay_get (int pipe, bool wait) {
+  while (wait && spiffer_queue_full (pipe)) {
+    struct timespec wts = {0, SPIFFER_REPLAY_WAIT};
+    (void) nanosleep (&wts, NULL);
+    replay[pipe].waits++;
+  }
+
+  return (spiffer_queue_get (pipe));
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// send the events read so far - a camera read
+// and get the next queue buffer
+//--------------------------------------------------------------------
+static queue_buf_t * replay_send (int pipe, uint * qn, bool wait) {
+  spiffer_queue_put (pipe, *qn);
+  spiffer_queue_end (pipe, 0);
+  *qn = 0;
+
+  return (replay_get (pipe, wait));
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// select a recording to replay on a pipe - instead of a camera
+// arg has the form: <file> [<speed>] [loop]
+// speed is a factor: 1.0 is real time (default), 0 is as fast as possible
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_replay_config (int pipe, const char * arg) {
+  char name[256];
+  char opt1[32] = "";
+  char opt2[32] = "";
+
+  int num = sscanf (arg, "%255s %31s %31s", name, opt1, opt2);
+  if (num < 1) {
+    return (SPIFFER_ERROR);
+  }
+
+  // speed factor and looping - in any order,
+  double speed = 1.0;
+  uint   loop  = 0;
+  const char * opts[] = {opt1, opt2};
+  for (const char * opt : opts) {
+    if (*opt == '\0') {
+      continue;
+    }
+
+    if (strcmp (opt, "loop") == 0) {
+      loop = 1;
+      continue;
+    }
+
+    char * end;
+    speed = strtod (opt, &end);
+    if ((end == opt) || (*end != '\0') || (speed < 0)) {
+      return (SPIFFER_ERROR);
+    }
+  }
+
+  // and the recording itself
+  char * file = strdup (name);
+  if (file == NULL) {
+    return (SPIFFER_ERROR);
+  }
+
+  free (cfg.pipe[pipe].replay_file);
+  cfg.pipe[pipe].replay_file  = file;
+  cfg.pipe[pipe].replay_speed = speed;
+  cfg.pipe[pipe].replay_loop  = loop;
+
+  return (SPIFFER_OK);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// open the configured recordings - as virtual cameras
+// each one gets the pipe it is configured for, if still free
+//--------------------------------------------------------------------
+void spiffer_replay_discover_devs (void) {
+  for (int pipe = 0; pipe < pipe_num_in; pipe++) {
+    const char * file = cfg.pipe[pipe].replay_file;
+
+    // recordings already open - or pipes not free - are left alone,
+    if ((file == NULL) || (replay[pipe].map != NULL) ||
+        (pipe_ctx[pipe].dev != SPIFFER_USB_NO_DEVICE) || spiffer_route_taken (pipe)) {
+      continue;
+    }
+
+    int dv = usb_dev_slot ();
+    if (dv == SPIFFER_USB_NO_DEVICE) {
+      return;
+    }
+
+    if (replay_open (&replay[pipe], file) == SPIFFER_ERROR) {
+      log_time ();
+      fprintf (lf, "warning: cannot replay %s on pipe%i\n", file, pipe);
+      continue;
+    }
+
+    log_time ();
+    fprintf (lf, "%s recording %s [%ux%u]\n", replay_fmt_name[replay[pipe].fmt],
+             file, replay[pipe].width, replay[pipe].height);
+
+    // recordings are devices with a fixed pipe
+    usb_devs.params[dv].present = true;
+    usb_devs.params[dv].type    = REPLAY;
+    (void) snprintf (usb_devs.params[dv].sn, sizeof (serial_t), "replay%i", pipe);
+    usb_give_pipe (dv, pipe);
+
+    usb_devs.cnt++;
+  }
+
+  (void) fflush (lf);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// replay a recording into a pipe
+// events go through the camera queue and processing, as if they
+// came from a camera
+//
+// terminated as a result of signal servicing
+//--------------------------------------------------------------------
+void * spiffer_replay_listener (void * data) {
+  int dev  = *((int *) data);
+  int pipe = usb_devs.params[dev].pipe;
+
+  // block signals - should be handled in a different thread
+  sigset_t set;
+  sigfillset (&set);
+  sigprocmask (SIG_BLOCK, &set, NULL);
+
+  // pin thread and set its priority - if configured
+  spiffer_rt_thread (RT_INPUT, pipe, "replay");
+
+  replay_t * rp    = &replay[pipe];
+  double     speed = cfg.pipe[pipe].replay_speed;
+  bool       loop  = cfg.pipe[pipe].replay_loop;
+  bool       afap  = (speed == 0);
+
+  // start processing and batching events - in their own thread,
+  spiffer_camera_start (pipe, rp->width, rp->height);
+  if (spiffer_queue_start (pipe) == SPIFFER_ERROR) {
+    log_time ();
+    fprintf (lf, "error: failed to start camera queue on pipe%i\n", pipe);
+    (void) fflush (lf);
+
+    return (nullptr);
+  }
+
+  //NOTE: it is stopped when this listener is cancelled
+  pthread_cleanup_push (spiffer_queue_stop, (void *) &dev_to_ptr[pipe]);
+
+  log_time ();
+  if (afap) {
+    fprintf (lf, "replaying %s -> pipe%i [as fast as possible%s]\n",
+             cfg.pipe[pipe].replay_file, pipe, loop ? " - loop" : "");
+  } else {
+    fprintf (lf, "replaying %s -> pipe%i [speed x%g%s]\n",
+             cfg.pipe[pipe].replay_file, pipe, speed, loop ? " - loop" : "");
+  }
+  (void) fflush (lf);
+
+  uint evts[SPIFFER_BATCH_SIZE];
+  uint ts[SPIFFER_BATCH_SIZE];
+
+  queue_buf_t * qb        = replay_get (pipe, afap);
+  uint          qn        = 0;
+  uint          read      = 0;
+  uint64_t      slice_end = 0;
+  uint64_t      origin    = replay_now ();
+
+  replay_rewind (rp);
+
+  while (1) {
+    pthread_testcancel ();
+
+    uint num = replay_decode (rp, evts, ts, SPIFFER_BATCH_SIZE);
+
+    // end of the recording - send the events left,
+    if (num == 0) {
+      qb = replay_send (pipe, &qn, afap);
+      rp->loops++;
+
+      if (!loop) {
+        log_time ();
+        fprintf (lf, "replay finished on pipe%i\n", pipe);
+        (void) fflush (lf);
+
+        // wait for thread cancelling
+        while (1) {
+          pause ();
+        }
+      }
+
+      // and start again - time starts again too
+      replay_rewind (rp);
+      origin    = replay_now ();
+      slice_end = 0;
+      continue;
+    }
+
+    for (uint i = 0; i < num; i++) {
+      // paced replay - camera reads cover a slice of recording time,
+      if (!afap) {
+        uint64_t t = replay_time (rp, ts[i]);
+        if ((t >= slice_end) || (qn == 0)) {
+          if (qn != 0) {
+            qb = replay_send (pipe, &qn, afap);
+          }
+
+          // released when due,
+          //NOTE: this is a thread cancellation point
+          uint64_t rel = origin + (uint64_t) (t * 1000 / speed);
+          uint64_t now = replay_now ();
+          if (rel > now) {
+            struct timespec rts = {(time_t) (rel / 1000000000), (long) (rel % 1000000000)};
+            (void) clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &rts, NULL);
+          } else if ((now - rel) > rp->late_max) {
+            rp->late_max = now - rel;
+          }
+
+          slice_end = t + SPIFFER_REPLAY_SLICE;
+        }
+      }
+
+      qb->evts[qn] = evts[i];
+      qb->ts[qn++] = ts[i];
+
+      // and buffers are queued when full
+      if (qn == SPIFFER_BATCH_SIZE) {
+        spiffer_queue_put (pipe, qn);
+        qn = 0;
+        qb = replay_get (pipe, afap);
+      }
+    }
+
+    rp->evts += num;
+
+    // unpaced replay - camera reads have a fixed number of events
+    if (afap) {
+      read += num;
+      if (read >= SPIFFER_REPLAY_READ) {
+        qb   = replay_send (pipe, &qn, afap);
+        read = 0;
+      }
+    }
+  }
+
+  pthread_cleanup_pop (0);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// close a recording
+//--------------------------------------------------------------------
+void spiffer_replay_shutdown_dev (int dev) {
+  replay_t * rp = &replay[usb_devs.params[dev].pipe];
+
+  if (rp->map != NULL) {
+    munmap ((void *) rp->map, rp->size);
+    close (rp->fd);
+    rp->map = NULL;
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// report replay statistics to the log file
+//--------------------------------------------------------------------
+void spiffer_replay_report (int pipe) {
+  replay_t * rp = &replay[pipe];
+
+  if (cfg.pipe[pipe].replay_file == NULL) {
+    return;
+  }
+
+  log_time ();
+  fprintf (lf, "pipe%i replay: events: %llu passes: %llu queue waits: %llu late max: %.3f ms\n",
+           pipe,
+           (unsigned long long) rp->evts,
+           (unsigned long long) rp->loops,
+           (unsigned long long) rp->waits,
+           (double) rp->late_max / 1000000
+           );
+}
+//--------------------------------------------------------------------
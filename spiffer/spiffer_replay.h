@@ -0,0 +1,114 @@
+//************************************************//
+//*                                              *//
+//*        spiffer recorded camera replay        *//
+//*                                              *//
+//************************************************//
+
+#ifndef __SPIFFER_REPLAY_H__
+#define __SPIFFER_REPLAY_H__
+
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+#include <sys/types.h>
+
+// spif and spiffer constants and function prototypes
+#include "spif.h"
+#include "spiffer.h"
+
+// Prophesee raw stream decoder
+#include "spiffer_evt.h"
+
+// recording time covered by a camera read (us) - paced replay
+#define SPIFFER_REPLAY_SLICE   1000
+
+// events in a camera read - unpaced replay
+#define SPIFFER_REPLAY_READ    (16 * SPIFFER_BATCH_SIZE)
+
+// wait for the camera queue to drain (ns) - unpaced replay
+#define SPIFFER_REPLAY_WAIT    50000
+
+// recording file formats
+typedef enum {
+  REPLAY_BIN,     // spif events - timestamp words after events with bit 31 clear
+  REPLAY_RAW,     // Prophesee raw (EVT 2.0 and EVT 3.0)
+  REPLAY_AEDAT4   // Inivation AEDAT 4.0 - uncompressed
+} replay_fmt_t;
+
+// per-pipe replay state
+typedef struct alignas (SPIFFER_CACHE_LINE) replay {
+  replay_fmt_t    fmt;
+  int             fd;
+  const uint8_t * map;        // memory-mapped recording
+  size_t          size;
+  size_t          start;      // first event data
+  size_t          end;        // end of event data
+  size_t          pos;        // next event data
+  uint            width;      // sensor size - from the recording
+  uint            height;
+
+  evt_dec_t       dec;        // REPLAY_RAW decoder state
+
+  const uint8_t * elems;      // REPLAY_AEDAT4 - current event packet
+  uint            elem_num;
+  uint            elem_idx;
+
+  bool            ts_valid;   // time origin of this pass set
+  uint64_t        ts_first;   // first timestamp of this pass (us)
+  uint64_t        ts_last;    // last timestamp (us) - extended to 64 bits
+
+  // statistics
+  uint64_t        evts;       // events replayed
+  uint64_t        loops;      // recording passes completed
+  uint64_t        waits;      // queue full waits - unpaced replay
+  uint64_t        late_max;   // largest read delay (ns) - paced replay
+} replay_t;
+
+
+//--------------------------------------------------------------------
+// select a recording to replay on a pipe - instead of a camera
+// arg has the form: <file> [<speed>] [loop]
+// speed is a factor: 1.0 is real time (default), 0 is as fast as possible
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_replay_config (int pipe, const char * arg);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// open the configured recordings - as virtual cameras
+// each one gets the pipe it is configured for, if still free
+//--------------------------------------------------------------------
+void spiffer_replay_discover_devs (void);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// replay a recording into a pipe
+// events go through the camera queue and processing, as if they
+// came from a camera
+//
+// terminated as a result of signal servicing
+//--------------------------------------------------------------------
+void * spiffer_replay_listener (void * data);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// close a recording
+//--------------------------------------------------------------------
+void spiffer_replay_shutdown_dev (int dev);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// report replay statistics to the log file
+//--------------------------------------------------------------------
+void spiffer_replay_report (int pipe);
+//--------------------------------------------------------------------
+
+
+#endif /* __SPIFFER_REPLAY_H__ */
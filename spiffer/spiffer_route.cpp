@@ -0,0 +1,332 @@
+//************************************************//
+//*                                              *//
+//*          spiffer software event routing      *//
+//*                                              *//
+//* spreads the events of one source across      *//
+//* several spif pipes - by x/y region, polarity *//
+//* or a per-pixel lookup table - so that a      *//
+//* single high-rate source can use the input    *//
+//* bandwidth of all of them                     *//
+//*                                              *//
+//************************************************//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "spiffer_route.h"
+#include "spiffer_batch.h"
+#include "spiffer_config.h"
+
+// global variables
+// spif pipes
+extern int pipe_num_in;
+
+// log file
+extern FILE * lf;
+
+// per-pipe routing state
+route_t route[SPIFFER_PIPES_MAX];
+
+
+//--------------------------------------------------------------------
+// check that a pipe can feed a set of destination pipes
+// destinations cannot be routed themselves or fed by other pipes
+//--------------------------------------------------------------------
+static bool route_valid (int pipe, uint pipes) {
+  // destinations fed by other pipes are taken,
+  uint taken = 0;
+  for (int p = 0; p < SPIFFER_PIPES_MAX; p++) {
+    if (p != pipe) {
+      taken |= route[p].pipes & ~(1u << p);
+    }
+  }
+
+  // the pipe itself cannot be fed by another pipe,
+  if (taken & (1u << pipe)) {
+    return (false);
+  }
+
+  // and its destinations must be free input pipes
+  for (int p = 0; p < SPIFFER_PIPES_MAX; p++) {
+    if ((p != pipe) && (pipes & (1u << p)) &&
+        ((p >= pipe_num_in) || (route[p].rule != ROUTE_NONE) || (taken & (1u << p)))) {
+      return (false);
+    }
+  }
+
+  return (true);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// load a routing lookup table file
+// lines have the form: <x> <y> <width> <height> <pipe>
+// later rectangles override earlier ones
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+static int route_lut_load (int pipe, route_t * rt, const char * name) {
+  FILE * tf = fopen (name, "r");
+  if (tf == NULL) {
+    return (SPIFFER_ERROR);
+  }
+
+  // first pass finds the table size and destinations,
+  char line[SPIFFER_CFG_LINE_MAX];
+  uint w = 0;
+  uint h = 0;
+  uint pipes = 1u << pipe;
+  while (fgets (line, sizeof (line), tf) != NULL) {
+    uint x, y, rw, rh, d;
+    if ((line[0] == '#') || (sscanf (line, "%u %u %u %u %u", &x, &y, &rw, &rh, &d) != 5)) {
+      continue;
+    }
+
+    if ((x + rw > SPIFFER_EVT_X_MASK + 1) || (y + rh > SPIFFER_EVT_Y_MASK + 1) ||
+        (d >= SPIFFER_PIPES_MAX)) {
+      fclose (tf);
+      return (SPIFFER_ERROR);
+    }
+
+    w = (x + rw > w) ? x + rw : w;
+    h = (y + rh > h) ? y + rh : h;
+    pipes |= 1u << d;
+  }
+
+  if ((w == 0) || (h == 0) || !route_valid (pipe, pipes)) {
+    fclose (tf);
+    return (SPIFFER_ERROR);
+  }
+
+  uint8_t * lut = (uint8_t *) malloc (w * h);
+  if (lut == NULL) {
+    fclose (tf);
+    return (SPIFFER_ERROR);
+  }
+
+  // pixels not covered by a rectangle stay on the own pipe,
+  memset (lut, pipe, w * h);
+
+  // and the second pass fills the table
+  rewind (tf);
+  while (fgets (line, sizeof (line), tf) != NULL) {
+    uint x, y, rw, rh, d;
+    if ((line[0] == '#') || (sscanf (line, "%u %u %u %u %u", &x, &y, &rw, &rh, &d) != 5)) {
+      continue;
+    }
+
+    for (uint j = y; j < y + rh; j++) {
+      memset (lut + j * w + x, d, rw);
+    }
+  }
+
+  fclose (tf);
+
+  free (rt->lut);
+  rt->lut   = lut;
+  rt->lut_w = w;
+  rt->lut_h = h;
+  rt->pipes = pipes;
+
+  return (SPIFFER_OK);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// set the routing rule of a pipe
+// arg has the form: x <split> <pipe> <pipe> | y <split> <pipe> <pipe> |
+//                   polarity <pipe> <pipe> | lut <file>
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_route_config (int pipe, const char * arg) {
+  route_t * rt = &route[pipe];
+
+  char rule[16];
+  int  used;
+  if (sscanf (arg, "%15s %n", rule, &used) != 1) {
+    return (SPIFFER_ERROR);
+  }
+  arg += used;
+
+  // lookup tables come from a file,
+  if (strcmp (rule, "lut") == 0) {
+    if ((*arg == '\0') || (route_lut_load (pipe, rt, arg) == SPIFFER_ERROR)) {
+      return (SPIFFER_ERROR);
+    }
+
+    rt->rule   = ROUTE_LUT;
+    rt->ts_dst = -1;
+    return (SPIFFER_OK);
+  }
+
+  // the rest split events between two pipes
+  route_rule_t rr;
+  uint split = 0;
+  int  d0;
+  int  d1;
+  int  end = 0;
+  if (strcmp (rule, "polarity") == 0) {
+    rr = ROUTE_POLARITY;
+    (void) sscanf (arg, "%i %i %n", &d0, &d1, &end);
+  } else if ((strcmp (rule, "x") == 0) || (strcmp (rule, "y") == 0)) {
+    rr = (rule[0] == 'x') ? ROUTE_X : ROUTE_Y;
+    (void) sscanf (arg, "%u %i %i %n", &split, &d0, &d1, &end);
+  } else {
+    return (SPIFFER_ERROR);
+  }
+
+  if ((end == 0) || (arg[end] != '\0') ||
+      (d0 < 0) || (d0 >= SPIFFER_PIPES_MAX) || (d1 < 0) || (d1 >= SPIFFER_PIPES_MAX)) {
+    return (SPIFFER_ERROR);
+  }
+
+  uint pipes = (1u << pipe) | (1u << d0) | (1u << d1);
+  if (!route_valid (pipe, pipes)) {
+    return (SPIFFER_ERROR);
+  }
+
+  rt->rule   = rr;
+  rt->split  = split;
+  rt->dst[0] = d0;
+  rt->dst[1] = d1;
+  rt->pipes  = pipes;
+  rt->ts_dst = -1;
+
+  return (SPIFFER_OK);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// get the pipes whose batches are fed by the listener of a pipe
+//
+// returns a bit mask of pipes - always includes the pipe itself
+//--------------------------------------------------------------------
+uint spiffer_route_pipes (int pipe) {
+  return (route[pipe].pipes | (1u << pipe));
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// check if a pipe is fed by the listener of another pipe
+//
+// such pipes must not have a listener of their own
+//--------------------------------------------------------------------
+bool spiffer_route_taken (int pipe) {
+  for (int p = 0; p < SPIFFER_PIPES_MAX; p++) {
+    if ((p != pipe) && (route[p].pipes & (1u << pipe))) {
+      return (true);
+    }
+  }
+
+  return (false);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// check if events of a pipe are spread across several pipes
+//--------------------------------------------------------------------
+bool spiffer_route_active (int pipe) {
+  return (route[pipe].rule != ROUTE_NONE);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// find the destination pipe of an event
+//--------------------------------------------------------------------
+static inline int route_dst (int pipe, const route_t * rt, uint e) {
+  uint x = (e >> SPIFFER_EVT_X_SHIFT) & SPIFFER_EVT_X_MASK;
+  uint y = (e >> SPIFFER_EVT_Y_SHIFT) & SPIFFER_EVT_Y_MASK;
+
+  switch (rt->rule) {
+  case ROUTE_X:
+    return (rt->dst[x >= rt->split]);
+  case ROUTE_Y:
+    return (rt->dst[y >= rt->split]);
+  case ROUTE_POLARITY:
+    return (rt->dst[(e >> SPIFFER_EVT_P_SHIFT) & SPIFFER_EVT_P_MASK]);
+  case ROUTE_LUT:
+    if ((x < rt->lut_w) && (y < rt->lut_h)) {
+      return (rt->lut[y * rt->lut_w + x]);
+    }
+    return (pipe);
+  default:
+    return (pipe);
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// spread events of a pipe across its destination pipes
+//
+// events are added to the batches of their destination pipes
+//--------------------------------------------------------------------
+void spiffer_route_apply (int pipe, uint * evts, uint num) {
+  route_t * rt = &route[pipe];
+
+  for (uint i = 0; i < num; i++) {
+    uint e = evts[i];
+
+    // a timestamp goes wherever its event went,
+    //NOTE: events without the no-timestamp bit are followed by one
+    int d;
+    if (rt->ts_dst != -1) {
+      d = rt->ts_dst;
+      rt->ts_dst = -1;
+    } else {
+      d = route_dst (pipe, rt, e);
+      rt->evts[d]++;
+      if (!(e & SPIFFER_EVT_NO_TS)) {
+        rt->ts_dst = d;
+      }
+    }
+
+    // stage the event for its destination,
+    rt->stage[d][rt->cnt[d]++] = e;
+
+    // and batch staged events when the stage is full
+    if (rt->cnt[d] == SPIFFER_ROUTE_CHUNK) {
+      spiffer_batch_put (d, rt->stage[d], rt->cnt[d]);
+      rt->cnt[d] = 0;
+    }
+  }
+
+  // batch the rest
+  for (int d = 0; d < SPIFFER_PIPES_MAX; d++) {
+    if (rt->cnt[d] != 0) {
+      spiffer_batch_put (d, rt->stage[d], rt->cnt[d]);
+      rt->cnt[d] = 0;
+    }
+  }
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// report routing statistics to the log file
+//--------------------------------------------------------------------
+void spiffer_route_report (int pipe) {
+  route_t * rt = &route[pipe];
+
+  if (rt->rule == ROUTE_NONE) {
+    return;
+  }
+
+  log_time ();
+  fprintf (lf, "pipe%i routed events:", pipe);
+  for (int d = 0; d < SPIFFER_PIPES_MAX; d++) {
+    if (rt->pipes & (1u << d)) {
+      fprintf (lf, " pipe%i: %llu", d, (unsigned long long) rt->evts[d]);
+    }
+  }
+  fprintf (lf, "\n");
+}
+//--------------------------------------------------------------------
@@ -0,0 +1,105 @@
+//************************************************//
+//*                                              *//
+//*          spiffer software event routing      *//
+//*                                              *//
+//************************************************//
+
+#ifndef __SPIFFER_ROUTE_H__
+#define __SPIFFER_ROUTE_H__
+
+
+#include <cstdint>
+
+#include <sys/types.h>
+
+// spif and spiffer constants and function prototypes
+#include "spif.h"
+#include "spiffer.h"
+
+// events staged per destination before they are batched
+#define SPIFFER_ROUTE_CHUNK  SPIFFER_BATCH_SIZE
+
+// routing rules
+typedef enum {
+  ROUTE_NONE,                                   // all events to own pipe
+  ROUTE_X,                                      // split at an x coordinate
+  ROUTE_Y,                                      // split at a y coordinate
+  ROUTE_POLARITY,                               // split by polarity
+  ROUTE_LUT                                     // per-pixel lookup table
+} route_rule_t;
+
+// per-pipe routing state
+//NOTE: the listener of a routed pipe owns the batches of all
+//      its destination pipes - they get no listener of their own
+typedef struct alignas (SPIFFER_CACHE_LINE) route {
+  route_rule_t rule;
+  uint         split;                           // ROUTE_X/ROUTE_Y split coordinate
+  int          dst[2];                          // below/above split - polarity 0/1
+  uint8_t *    lut;                             // ROUTE_LUT destination per pixel
+  uint         lut_w;                           // pixels outside the table go
+  uint         lut_h;                           // to the own pipe
+  uint         pipes;                           // destination pipes (bit mask)
+  int          ts_dst;                          // next word is a timestamp for this pipe
+
+  // events waiting to be batched - one stage per destination
+  uint         cnt[SPIFFER_PIPES_MAX];
+  uint         stage[SPIFFER_PIPES_MAX][SPIFFER_ROUTE_CHUNK];
+
+  // statistics
+  uint64_t     evts[SPIFFER_PIPES_MAX];         // events routed per destination
+} route_t;
+
+
+//--------------------------------------------------------------------
+// set the routing rule of a pipe
+// arg has the form: x <split> <pipe> <pipe> | y <split> <pipe> <pipe> |
+//                   polarity <pipe> <pipe> | lut <file>
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_route_config (int pipe, const char * arg);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// get the pipes whose batches are fed by the listener of a pipe
+//
+// returns a bit mask of pipes - always includes the pipe itself
+//--------------------------------------------------------------------
+uint spiffer_route_pipes (int pipe);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// check if a pipe is fed by the listener of another pipe
+//
+// such pipes must not have a listener of their own
+//--------------------------------------------------------------------
+bool spiffer_route_taken (int pipe);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// check if events of a pipe are spread across several pipes
+//--------------------------------------------------------------------
+bool spiffer_route_active (int pipe);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// spread events of a pipe across its destination pipes
+//
+// events are added to the batches of their destination pipes
+//--------------------------------------------------------------------
+void spiffer_route_apply (int pipe, uint * evts, uint num);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// report routing statistics to the log file
+//--------------------------------------------------------------------
+void spiffer_route_report (int pipe);
+//--------------------------------------------------------------------
+
+
+#endif /* __SPIFFER_ROUTE_H__ */
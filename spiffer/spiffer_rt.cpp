@@ -0,0 +1,253 @@
+//************************************************//
+//*                                              *//
+//*     spiffer thread placement and memory      *//
+//*                                              *//
+//* threads can be pinned to CPUs and run with   *//
+//* real-time (SCHED_FIFO) priority, and memory  *//
+//* can be locked, so that listeners are not     *//
+//* preempted or stalled by page faults          *//
+//*                                              *//
+//************************************************//
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "spiffer_rt.h"
+#include "spiffer_config.h"
+
+// global variables
+// spif pipes
+extern int          pipe_num_in;
+extern int          pipe_num_out;
+extern pipe_ctx_t * pipe_ctx;
+
+// spiffer configuration
+extern spiffer_cfg_t cfg;
+
+// log file
+extern FILE * lf;
+
+
+//--------------------------------------------------------------------
+// parse a list of CPUs or CPU ranges into a CPU mask
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+static int rt_parse_cpus (const char * arg, uint * mask) {
+  uint m = 0;
+
+  while (1) {
+    char * end;
+    unsigned long first = strtoul (arg, &end, 10);
+    if ((end == arg) || (first > SPIFFER_RT_CPU_MAX)) {
+      return (SPIFFER_ERROR);
+    }
+
+    unsigned long last = first;
+    if (*end == '-') {
+      arg  = end + 1;
+      last = strtoul (arg, &end, 10);
+      if ((end == arg) || (last > SPIFFER_RT_CPU_MAX) || (last < first)) {
+        return (SPIFFER_ERROR);
+      }
+    }
+
+    for (unsigned long c = first; c <= last; c++) {
+      m |= 1u << c;
+    }
+
+    if (*end == '\0') {
+      break;
+    }
+
+    if (*end != ',') {
+      return (SPIFFER_ERROR);
+    }
+    arg = end + 1;
+  }
+
+  *mask = m;
+  return (SPIFFER_OK);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// select the CPUs used by the threads of a pipe
+// arg is a list of CPUs or CPU ranges, e.g., 0,2-3
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_rt_input_cpus (int pipe, const char * arg) {
+  return (rt_parse_cpus (arg, &cfg.pipe[pipe].input_cpus));
+}
+
+int spiffer_rt_spinn_cpus (int pipe, const char * arg) {
+  return (rt_parse_cpus (arg, &cfg.pipe[pipe].spinn_cpus));
+}
+
+int spiffer_rt_command_cpus (int pipe, const char * arg) {
+  return (rt_parse_cpus (arg, &cfg.pipe[pipe].command_cpus));
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// lock all spiffer memory and prefault the spif pipe buffers
+// - if configured
+//--------------------------------------------------------------------
+void spiffer_rt_memory (void) {
+  if (!cfg.mlock) {
+    return;
+  }
+
+  // lock current and future memory - faults it in,
+  if (mlockall (MCL_CURRENT | MCL_FUTURE) != 0) {
+    log_time ();
+    fprintf (lf, "warning: failed to lock memory (%s)\n", strerror (errno));
+    (void) fflush (lf);
+    return;
+  }
+
+  // and touch every page of the spif buffers - mapped from the device
+  long   pg = sysconf (_SC_PAGESIZE);
+  size_t sz = 0;
+  for (int pipe = 0; pipe < pipe_num_in; pipe++) {
+    volatile char * bp = (volatile char *) pipe_ctx[pipe].buf;
+    for (size_t i = 0; i < spif_get_buffer_size (pipe); i += pg) {
+      bp[i] = 0;
+    }
+    sz += spif_get_buffer_size (pipe);
+  }
+
+  for (int pipe = 0; pipe < pipe_num_out; pipe++) {
+    volatile char * bp = (volatile char *) pipe_ctx[pipe].out_buf;
+    for (size_t i = 0; i < spif_get_buffer_size (pipe); i += pg) {
+      (void) bp[i];
+    }
+    sz += spif_get_buffer_size (pipe);
+  }
+
+  log_time ();
+  fprintf (lf, "memory locked - %lu KB of spif buffers prefaulted\n",
+           (unsigned long) (sz / 1024));
+  (void) fflush (lf);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// apply the configured CPU affinity and real-time priority
+// to the calling thread and report its placement
+//
+// called by every thread when it starts
+//--------------------------------------------------------------------
+void spiffer_rt_thread (rt_role_t role, int pipe, const char * tag) {
+  pipe_cfg_t * pc = &cfg.pipe[pipe];
+
+  uint cpus = 0;
+  uint prio = 0;
+  switch (role) {
+  case RT_INPUT:
+    cpus = pc->input_cpus;
+    prio = pc->input_prio;
+    break;
+  case RT_SPINN:
+    cpus = pc->spinn_cpus;
+    prio = pc->spinn_prio;
+    break;
+  case RT_COMMAND:
+    cpus = pc->command_cpus;
+    prio = pc->command_prio;
+    break;
+  }
+
+  // name thread - shows in ps and top,
+  char name[16];
+  snprintf (name, sizeof (name), "spiffer-%s%i", tag, pipe);
+  (void) pthread_setname_np (pthread_self (), name);
+
+  // pin thread to CPUs,
+  const char * cpus_err = "";
+  if (cpus != 0) {
+    cpu_set_t cs;
+    CPU_ZERO (&cs);
+    for (int c = 0; c <= SPIFFER_RT_CPU_MAX; c++) {
+      if (cpus & (1u << c)) {
+        CPU_SET (c, &cs);
+      }
+    }
+
+    if (pthread_setaffinity_np (pthread_self (), sizeof (cs), &cs) != 0) {
+      cpus_err = " [failed]";
+    }
+  }
+
+  // set real-time priority,
+  const char * prio_err = "";
+  if (prio != 0) {
+    struct sched_param sp;
+    sp.sched_priority = prio;
+    if (pthread_setschedparam (pthread_self (), SCHED_FIFO, &sp) != 0) {
+      prio_err = " [failed]";
+    }
+  }
+
+  // and report placement
+  log_time ();
+  fprintf (lf, "%s: cpus", name);
+  if (cpus == 0) {
+    fprintf (lf, " any");
+  } else {
+    for (int c = 0; c <= SPIFFER_RT_CPU_MAX; c++) {
+      if (cpus & (1u << c)) {
+        fprintf (lf, " %i", c);
+      }
+    }
+  }
+  fprintf (lf, "%s - ", cpus_err);
+
+  if (prio == 0) {
+    fprintf (lf, "SCHED_OTHER\n");
+  } else {
+    fprintf (lf, "SCHED_FIFO priority %u%s\n", prio, prio_err);
+  }
+  (void) fflush (lf);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// create a spiffer thread with a bounded stack
+// failures are reported in the log
+//
+// returns 0 on success or the pthread_create error number
+//--------------------------------------------------------------------
+int spiffer_rt_create (pthread_t * thread, void * (* start) (void *),
+                       void * arg, const char * what) {
+  //NOTE: the default stack (8 MB) would be locked in full with mlock
+  pthread_attr_t attr;
+  int            rc = pthread_attr_init (&attr);
+
+  if (rc == 0) {
+    (void) pthread_attr_setstacksize (&attr, SPIFFER_RT_STACK_SIZE);
+    rc = pthread_create (thread, &attr, start, arg);
+    (void) pthread_attr_destroy (&attr);
+  }
+
+  if (rc != 0) {
+    log_time ();
+    fprintf (lf, "error: failed to create %s thread (%s)\n", what, strerror (rc));
+    (void) fflush (lf);
+  }
+
+  return (rc);
+}
+//--------------------------------------------------------------------
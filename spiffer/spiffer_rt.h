@@ -0,0 +1,73 @@
+//************************************************//
+//*                                              *//
+//*     spiffer thread placement and memory      *//
+//*                                              *//
+//************************************************//
+
+#ifndef __SPIFFER_RT_H__
+#define __SPIFFER_RT_H__
+
+
+#include <pthread.h>
+#include <sys/types.h>
+
+// spif and spiffer constants and function prototypes
+#include "spif.h"
+#include "spiffer.h"
+
+// largest CPU number that can be selected
+#define SPIFFER_RT_CPU_MAX  31
+
+// thread stack size - bounded, as locked memory includes every stack
+#define SPIFFER_RT_STACK_SIZE  (1024 * 1024)
+
+// thread roles - each has its own placement configuration
+typedef enum {
+  RT_INPUT,     // UDP and USB listeners - and merged sources
+  RT_SPINN,     // SpiNNaker listeners
+  RT_COMMAND    // output command listeners
+} rt_role_t;
+
+
+//--------------------------------------------------------------------
+// select the CPUs used by the threads of a pipe
+// arg is a list of CPUs or CPU ranges, e.g., 0,2-3
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_rt_input_cpus (int pipe, const char * arg);
+int spiffer_rt_spinn_cpus (int pipe, const char * arg);
+int spiffer_rt_command_cpus (int pipe, const char * arg);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// lock all spiffer memory and prefault the spif pipe buffers
+// - if configured
+//--------------------------------------------------------------------
+void spiffer_rt_memory (void);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// apply the configured CPU affinity and real-time priority
+// to the calling thread and report its placement
+//
+// called by every thread when it starts
+//--------------------------------------------------------------------
+void spiffer_rt_thread (rt_role_t role, int pipe, const char * tag);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// create a spiffer thread with a bounded stack
+// failures are reported in the log
+//
+// returns 0 on success or the pthread_create error number
+//--------------------------------------------------------------------
+int spiffer_rt_create (pthread_t * thread, void * (* start) (void *),
+                       void * arg, const char * what);
+//--------------------------------------------------------------------
+
+
+#endif /* __SPIFFER_RT_H__ */
@@ -0,0 +1,185 @@
+//************************************************//
+//*                                              *//
+//*       spiffer camera-side rate control       *//
+//*                                              *//
+//* event rate controllers, regions of interest, *//
+//* anti-flicker filters and biases are set in   *//
+//* the camera sensor, so that events the pipe   *//
+//* cannot carry never leave the camera          *//
+//*                                              *//
+//************************************************//
+
+#include <cstdio>
+#include <cstring>
+
+#include <pthread.h>
+
+#include "spiffer_sensor.h"
+#include "spiffer_config.h"
+
+// global variables
+// spif pipes
+extern int pipe_num_in;
+
+// log file
+extern FILE * lf;
+
+// per-pipe sensor control state
+sensor_t sensor[SPIFFER_PIPES_MAX];
+
+// settings are changed at runtime by a different thread
+static pthread_mutex_t sensor_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+
+//--------------------------------------------------------------------
+// configure camera sensor settings for a pipe
+// arg has the form:
+//   erc <events/s>                   - Prophesee event rate controller
+//   roi <x> <y> <width> <height>     - sensor region of interest
+//   anti_flicker <low> <high>        - Prophesee anti-flicker band (Hz)
+//   bias <name> <value> [<fine>]     - sensor bias
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_sensor_config (int pipe, const char * arg) {
+  sensor_cfg_t * sc = &sensor[pipe].cfg;
+
+  char setting[16];
+  int  used;
+  if (sscanf (arg, "%15s %n", setting, &used) != 1) {
+    return (SPIFFER_ERROR);
+  }
+  arg += used;
+
+  int end = 0;
+  if (strcmp (setting, "erc") == 0) {
+    uint rate;
+    (void) sscanf (arg, "%u %n", &rate, &end);
+    if ((end == 0) || (arg[end] != '\0')) {
+      return (SPIFFER_ERROR);
+    }
+
+    sc->erc_set  = true;
+    sc->erc_rate = rate;
+  } else if (strcmp (setting, "roi") == 0) {
+    uint x;
+    uint y;
+    uint w;
+    uint h;
+    (void) sscanf (arg, "%u %u %u %u %n", &x, &y, &w, &h, &end);
+    if ((end == 0) || (arg[end] != '\0')) {
+      return (SPIFFER_ERROR);
+    }
+
+    sc->roi_set = true;
+    sc->roi_x   = x;
+    sc->roi_y   = y;
+    sc->roi_w   = w;
+    sc->roi_h   = h;
+  } else if (strcmp (setting, "anti_flicker") == 0) {
+    uint low;
+    uint high;
+    (void) sscanf (arg, "%u %u %n", &low, &high, &end);
+    if ((end == 0) || (arg[end] != '\0') || (low > high)) {
+      return (SPIFFER_ERROR);
+    }
+
+    sc->flicker_set  = true;
+    sc->flicker_low  = low;
+    sc->flicker_high = high;
+  } else if (strcmp (setting, "bias") == 0) {
+    sensor_bias_t sb;
+    sb.fine = -1;
+    (void) sscanf (arg, "%23s %i %n", sb.name, &sb.value, &end);
+    if (end != 0) {
+      int fe = 0;
+      (void) sscanf (&arg[end], "%i %n", &sb.fine, &fe);
+      end += fe;
+    }
+    if ((end == 0) || (arg[end] != '\0')) {
+      return (SPIFFER_ERROR);
+    }
+
+    // a bias set again replaces its previous value
+    uint b;
+    for (b = 0; b < sc->bias_num; b++) {
+      if (strcmp (sc->bias[b].name, sb.name) == 0) {
+        break;
+      }
+    }
+
+    if (b == SPIFFER_SENSOR_BIAS_MAX) {
+      return (SPIFFER_ERROR);
+    }
+
+    sc->bias[b] = sb;
+    if (b == sc->bias_num) {
+      sc->bias_num++;
+    }
+  } else {
+    return (SPIFFER_ERROR);
+  }
+
+  // listeners apply changed settings
+  sensor[pipe].gen++;
+
+  return (SPIFFER_OK);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// get the sensor settings of a pipe - if changed since last applied
+// gen is the generation last applied, updated on return
+//
+// returns true if the settings must be applied to the camera
+//--------------------------------------------------------------------
+bool spiffer_sensor_get (int pipe, sensor_cfg_t * sc, uint * gen) {
+  // usually nothing changed - no need to lock
+  if (sensor[pipe].gen.load (std::memory_order_acquire) == *gen) {
+    return (false);
+  }
+
+  pthread_mutex_lock (&sensor_mtx);
+  *sc  = sensor[pipe].cfg;
+  *gen = sensor[pipe].gen.load (std::memory_order_relaxed);
+  pthread_mutex_unlock (&sensor_mtx);
+
+  return (true);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// re-read sensor settings from the configuration file
+// camera listeners apply them to their cameras while running
+//--------------------------------------------------------------------
+void spiffer_sensor_reload (void) {
+  pthread_mutex_lock (&sensor_mtx);
+
+  log_time ();
+  fprintf (lf, "reloading sensor settings from %s\n", cfg_name);
+
+  // settings no longer configured are turned off,
+  //NOTE: biases keep their last value until the camera is reconnected
+  for (int pipe = 0; pipe < pipe_num_in; pipe++) {
+    sensor_cfg_t * sc = &sensor[pipe].cfg;
+
+    sc->erc_rate     = 0;
+    sc->roi_w        = 0;
+    sc->roi_h        = 0;
+    sc->flicker_low  = 0;
+    sc->flicker_high = 0;
+    sc->bias_num     = 0;
+  }
+
+  // and the rest take their new values
+  spiffer_config_reload (cfg_name, "sensor");
+
+  for (int pipe = 0; pipe < pipe_num_in; pipe++) {
+    sensor[pipe].gen++;
+  }
+
+  pthread_mutex_unlock (&sensor_mtx);
+}
+//--------------------------------------------------------------------
@@ -0,0 +1,89 @@
+//************************************************//
+//*                                              *//
+//*       spiffer camera-side rate control       *//
+//*                                              *//
+//************************************************//
+
+#ifndef __SPIFFER_SENSOR_H__
+#define __SPIFFER_SENSOR_H__
+
+
+#include <atomic>
+#include <cstdint>
+
+#include <sys/types.h>
+
+// spif and spiffer constants and function prototypes
+#include "spif.h"
+#include "spiffer.h"
+
+// sensor biases set per camera
+#define SPIFFER_SENSOR_BIAS_MAX   8
+#define SPIFFER_SENSOR_NAME_MAX   24
+
+// sensor bias - Prophesee biases have a value,
+// DAVIS biases a coarse and a fine value
+typedef struct sensor_bias {
+  char name[SPIFFER_SENSOR_NAME_MAX];
+  int  value;                   // Prophesee value or DAVIS coarse value
+  int  fine;                    // DAVIS fine value - -1: none
+} sensor_bias_t;
+
+// per-pipe sensor settings
+//NOTE: settings not configured leave the camera defaults alone,
+//      settings removed at runtime are turned off
+typedef struct sensor_cfg {
+  bool          erc_set;        // Prophesee event rate controller
+  uint          erc_rate;       // events per second - 0: off
+  bool          roi_set;        // sensor region of interest
+  uint          roi_x;
+  uint          roi_y;
+  uint          roi_w;          // 0: off - whole sensor
+  uint          roi_h;
+  bool          flicker_set;    // Prophesee anti-flicker filter
+  uint          flicker_low;    // band (Hz) - 0: off
+  uint          flicker_high;
+  uint          bias_num;       // sensor biases
+  sensor_bias_t bias[SPIFFER_SENSOR_BIAS_MAX];
+} sensor_cfg_t;
+
+// per-pipe sensor control state
+typedef struct sensor {
+  sensor_cfg_t      cfg;
+  std::atomic<uint> gen;        // changes every time cfg changes
+} sensor_t;
+
+
+//--------------------------------------------------------------------
+// configure camera sensor settings for a pipe
+// arg has the form:
+//   erc <events/s>                   - Prophesee event rate controller
+//   roi <x> <y> <width> <height>     - sensor region of interest
+//   anti_flicker <low> <high>        - Prophesee anti-flicker band (Hz)
+//   bias <name> <value> [<fine>]     - sensor bias
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_sensor_config (int pipe, const char * arg);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// get the sensor settings of a pipe - if changed since last applied
+// gen is the generation last applied, updated on return
+//
+// returns true if the settings must be applied to the camera
+//--------------------------------------------------------------------
+bool spiffer_sensor_get (int pipe, sensor_cfg_t * sc, uint * gen);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// re-read sensor settings from the configuration file
+// camera listeners apply them to their cameras while running
+//--------------------------------------------------------------------
+void spiffer_sensor_reload (void);
+//--------------------------------------------------------------------
+
+
+#endif /* __SPIFFER_SENSOR_H__ */
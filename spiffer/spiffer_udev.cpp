@@ -0,0 +1,301 @@
+//************************************************//
+//*                                              *//
+//*      spiffer USB camera connection monitor   *//
+//*                                              *//
+//* udev events are received in-process through  *//
+//* a netlink socket, so that supported cameras  *//
+//* are attached as soon as they are ready -     *//
+//* no signals from udev rules or fixed delays   *//
+//*                                              *//
+//************************************************//
+
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "spiffer_udev.h"
+#include "spiffer_plugin.h"
+#include "spiffer_rt.h"
+
+// global variables
+// USB devices
+extern usb_devs_t usb_devs;
+
+// log file
+extern FILE * lf;
+
+// udev messages start with a header - kernel messages do not
+#define UDEV_PREFIX  "libudev"
+#define UDEV_MAGIC   0xfeedcafe
+
+typedef struct udev_hdr {
+  char prefix[8];
+  uint magic;
+  uint header_size;
+  uint properties_off;
+  uint properties_len;
+} udev_hdr_t;
+
+// USB camera events
+typedef enum {
+  UDEV_NONE,
+  UDEV_ADD,
+  UDEV_REMOVE
+} udev_act_t;
+
+// connection monitor
+static int       udev_skt = -1;
+static pthread_t udev_thread;
+static bool      udev_running;
+
+
+//--------------------------------------------------------------------
+// milliseconds elapsed since a given time
+//--------------------------------------------------------------------
+static long udev_ms (const struct timespec * since) {
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  return ((now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// check if a USB device is a supported camera - one with a plugin
+//--------------------------------------------------------------------
+static bool udev_supported (uint vid, uint pid) {
+  return (spiffer_plugin_find (vid, pid) != SPIFFER_PLUGIN_NONE);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// receive a udev event - messages from unprivileged senders are ignored
+//
+// returns the camera event, and its USB IDs, or UDEV_NONE
+//--------------------------------------------------------------------
+static udev_act_t udev_recv (char * buf, uint * vid, uint * pid) {
+  char          ctrl[CMSG_SPACE (sizeof (struct ucred))];
+  struct iovec  iov = {buf, SPIFFER_UDEV_BUF_SIZE - 1};
+  struct msghdr msg;
+
+  memset (&msg, 0, sizeof (msg));
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = ctrl;
+  msg.msg_controllen = sizeof (ctrl);
+
+  ssize_t len = recvmsg (udev_skt, &msg, MSG_DONTWAIT);
+  if (len <= 0) {
+    return (UDEV_NONE);
+  }
+  buf[len] = '\0';
+
+  // only root (udevd or the kernel) can announce devices,
+  struct cmsghdr * cm = CMSG_FIRSTHDR (&msg);
+  if ((cm == NULL) || (cm->cmsg_type != SCM_CREDENTIALS) ||
+      (((struct ucred *) CMSG_DATA (cm))->uid != 0)) {
+    return (UDEV_NONE);
+  }
+
+  // find the event properties - a list of KEY=value strings,
+  size_t off;
+  size_t end = len;
+  udev_hdr_t * hdr = (udev_hdr_t *) buf;
+  if ((len >= (ssize_t) sizeof (udev_hdr_t)) && (memcmp (hdr->prefix, UDEV_PREFIX, sizeof (UDEV_PREFIX)) == 0)) {
+    if ((ntohl (hdr->magic) != UDEV_MAGIC) || (hdr->properties_off >= (size_t) len)) {
+      return (UDEV_NONE);
+    }
+    off = hdr->properties_off;
+    if ((off + hdr->properties_len) < end) {
+      end = off + hdr->properties_len;
+    }
+  } else {
+    // kernel messages start with action@devpath
+    off = strlen (buf) + 1;
+  }
+
+  // and check them
+  udev_act_t act    = UDEV_NONE;
+  bool       usb    = false;
+  bool       device = false;
+  bool       ids    = false;
+  uint       bcd;
+
+  for (; off < end; off += strlen (&buf[off]) + 1) {
+    const char * prop = &buf[off];
+
+    if (strcmp (prop, "ACTION=add") == 0) {
+      act = UDEV_ADD;
+    } else if (strcmp (prop, "ACTION=remove") == 0) {
+      act = UDEV_REMOVE;
+    } else if (strcmp (prop, "SUBSYSTEM=usb") == 0) {
+      usb = true;
+    } else if (strcmp (prop, "DEVTYPE=usb_device") == 0) {
+      device = true;
+    } else if (strncmp (prop, "PRODUCT=", 8) == 0) {
+      ids = (sscanf (&prop[8], "%x/%x/%x", vid, pid, &bcd) == 3);
+    }
+  }
+
+  // USB interfaces are announced too - only devices count
+  if (!usb || !device || !ids || !udev_supported (*vid, *pid)) {
+    return (UDEV_NONE);
+  }
+
+  return (act);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// start monitoring USB camera connections
+// udev events are received through a netlink socket
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_udev_start (void) {
+  udev_skt = socket (AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+  if (udev_skt == SPIFFER_ERROR) {
+    return (SPIFFER_ERROR);
+  }
+
+  // udev events are sent once devices are ready to be opened,
+  struct sockaddr_nl addr;
+  memset (&addr, 0, sizeof (addr));
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = SPIFFER_UDEV_GROUP;
+
+  // senders must be checked,
+  int on = 1;
+  if ((setsockopt (udev_skt, SOL_SOCKET, SO_PASSCRED, &on, sizeof (on)) == SPIFFER_ERROR) ||
+      (bind (udev_skt, (struct sockaddr *) &addr, sizeof (addr)) == SPIFFER_ERROR)) {
+    close (udev_skt);
+    udev_skt = -1;
+    return (SPIFFER_ERROR);
+  }
+
+  // and events are processed in their own thread
+  if (spiffer_rt_create (&udev_thread, spiffer_udev_listener, NULL, "udev") != 0) {
+    close (udev_skt);
+    udev_skt = -1;
+    return (SPIFFER_ERROR);
+  }
+  udev_running = true;
+
+  return (SPIFFER_OK);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// stop monitoring USB camera connections - if started
+//--------------------------------------------------------------------
+void spiffer_udev_stop (void) {
+  if (!udev_running) {
+    return;
+  }
+
+  (void) pthread_cancel (udev_thread);
+  pthread_join (udev_thread, NULL);
+
+  close (udev_skt);
+  udev_running = false;
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// survey USB devices when a supported camera is connected
+// keeps polling until the camera is ready or a timeout expires
+//
+// terminated when spiffer stops
+//--------------------------------------------------------------------
+void * spiffer_udev_listener (void * data) {
+  (void) data;
+
+  // block signals - should be handled in a different thread
+  sigset_t set;
+  sigfillset (&set);
+  sigprocmask (SIG_BLOCK, &set, NULL);
+
+  static char buf[SPIFFER_UDEV_BUF_SIZE];
+
+  struct pollfd   pfd     = {udev_skt, POLLIN, 0};
+  bool            pending = false;  // a camera is being attached
+  bool            retry   = false;  // and was tried before
+  struct timespec conn;
+  struct timespec tried;
+  uint            found = 0;
+
+  while (1) {
+    // wait for udev events - or until the next readiness poll
+    //NOTE: this is a thread cancellation point
+    if (poll (&pfd, 1, pending ? SPIFFER_UDEV_POLL : -1) > 0) {
+      uint vid;
+      uint pid;
+
+      switch (udev_recv (buf, &vid, &pid)) {
+      case UDEV_ADD:
+        log_time ();
+        fprintf (lf, "USB camera %04x:%04x connected\n", vid, pid);
+        (void) fflush (lf);
+
+        // try to attach it now,
+        if (!pending) {
+          pending = true;
+          found   = usb_devs.found;
+          clock_gettime (CLOCK_MONOTONIC, &conn);
+        }
+        retry = false;
+        break;
+
+      //NOTE: disconnections are detected by the camera listeners
+      case UDEV_REMOVE:
+        log_time ();
+        fprintf (lf, "USB camera %04x:%04x removed\n", vid, pid);
+        (void) fflush (lf);
+        break;
+
+      default:
+        break;
+      }
+    }
+
+    // or keep polling until the camera is ready,
+    if (!pending || (retry && (udev_ms (&tried) < SPIFFER_UDEV_POLL))) {
+      continue;
+    }
+
+    pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, 0);
+    usb_survey_devs (NULL);
+    pthread_setcancelstate (PTHREAD_CANCEL_ENABLE, 0);
+    clock_gettime (CLOCK_MONOTONIC, &tried);
+    retry = true;
+
+    // and report how long it took
+    if (usb_devs.found != found) {
+      log_time ();
+      fprintf (lf, "USB camera ready after %li ms\n", udev_ms (&conn));
+      (void) fflush (lf);
+
+      pending = false;
+    } else if (udev_ms (&conn) >= SPIFFER_UDEV_WAIT) {
+      log_time ();
+      fprintf (lf, "warning: USB camera not ready after %i ms\n", SPIFFER_UDEV_WAIT);
+      (void) fflush (lf);
+
+      pending = false;
+    }
+  }
+}
+//--------------------------------------------------------------------
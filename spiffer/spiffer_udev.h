@@ -0,0 +1,55 @@
+//************************************************//
+//*                                              *//
+//*      spiffer USB camera connection monitor   *//
+//*                                              *//
+//************************************************//
+
+#ifndef __SPIFFER_UDEV_H__
+#define __SPIFFER_UDEV_H__
+
+
+#include <sys/types.h>
+
+// spif and spiffer constants and function prototypes
+#include "spif.h"
+#include "spiffer.h"
+
+// netlink multicast group of udev - devices are ready to be opened
+#define SPIFFER_UDEV_GROUP     2
+
+// uevent receive buffer size
+#define SPIFFER_UDEV_BUF_SIZE  8192
+
+// readiness polling after a camera connection (ms)
+#define SPIFFER_UDEV_POLL      50
+#define SPIFFER_UDEV_WAIT      3000
+
+
+//--------------------------------------------------------------------
+// start monitoring USB camera connections
+// udev events are received through a netlink socket
+//
+// returns SPIFFER_OK on success or SPIFFER_ERROR on error
+//--------------------------------------------------------------------
+int spiffer_udev_start (void);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// stop monitoring USB camera connections - if started
+//--------------------------------------------------------------------
+void spiffer_udev_stop (void);
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// survey USB devices when a supported camera is connected
+// keeps polling until the camera is ready or a timeout expires
+//
+// terminated when spiffer stops
+//--------------------------------------------------------------------
+void * spiffer_udev_listener (void * data);
+//--------------------------------------------------------------------
+
+
+#endif /* __SPIFFER_UDEV_H__ */
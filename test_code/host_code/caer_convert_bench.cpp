@@ -0,0 +1,135 @@
+//************************************************//
+//*                                              *//
+//* benchmark libcaer polarity event conversion  *//
+//*                                              *//
+//* - compares the per-event accessor loop with  *//
+//*   the bulk spiffer converter                 *//
+//* - checks that both produce the same events   *//
+//*                                              *//
+//* build (needs libcaer headers - add           *//
+//* -I<prefix>/include if not installed in a     *//
+//* system include directory):                   *//
+//*   g++ -O2 -I../include -I../../spiffer       *//
+//*       caer_convert_bench.cpp                 *//
+//*                                              *//
+//* exits with -1 if problems found              *//
+//*                                              *//
+//************************************************//
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#include "spiffer_caer_support.h"
+
+
+#define NUM_EVTS          4096
+#define NUM_RUNS          10000
+#define INVALID_PCT       10
+
+#define NSEC_PER_SEC      1000000000
+
+
+//--------------------------------------------------------------------
+// get current time (in ns)
+//--------------------------------------------------------------------
+static double now (void) {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ((double) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// convert events one at a time - as spiffer used to
+//--------------------------------------------------------------------
+static uint convert_scalar (caerPolarityEventPacketConst pkt, uint num,
+                            uint * buf, uint * ts) {
+  uint cnt = 0;
+
+  for (uint i = 0; i < num; i++) {
+    caerPolarityEventConst event = caerPolarityEventPacketGetEventConst (pkt, i);
+    if (!caerPolarityEventIsValid (event)) {
+      continue;
+    }
+
+    bool     pol = caerPolarityEventGetPolarity (event);
+    uint16_t x   = caerPolarityEventGetX (event);
+    uint16_t y   = caerPolarityEventGetY (event);
+
+    ts[cnt]    = caerPolarityEventGetTimestamp (event);
+    buf[cnt++] = SPIFFER_EVT_NO_TS | (x << SPIFFER_EVT_X_SHIFT) | (pol << SPIFFER_EVT_P_SHIFT) | (y << SPIFFER_EVT_Y_SHIFT);
+  }
+
+  return (cnt);
+}
+//--------------------------------------------------------------------
+
+
+int main (void) {
+  // build a packet of random events - some of them invalid,
+  caerPolarityEventPacket pkt = (caerPolarityEventPacket)
+    malloc (sizeof (*pkt) + NUM_EVTS * sizeof (struct caer_polarity_event));
+  if (pkt == NULL) {
+    fprintf (stderr, "error: no memory for events\n");
+    exit (-1);
+  }
+
+  srand (1);
+  for (int i = 0; i < NUM_EVTS; i++) {
+    uint x = rand () % 640;
+    uint y = rand () % 480;
+    uint p = rand () & 1;
+    uint v = (rand () % 100) >= INVALID_PCT;
+
+    pkt->events[i].data = (x << POLARITY_X_ADDR_SHIFT) | (y << POLARITY_Y_ADDR_SHIFT) |
+      (p << POLARITY_SHIFT) | (v << VALID_MARK_SHIFT);
+    pkt->events[i].timestamp = i * 10;
+  }
+
+  static uint buf_s[NUM_EVTS];
+  static uint ts_s[NUM_EVTS];
+  static uint buf_v[NUM_EVTS];
+  static uint ts_v[NUM_EVTS];
+
+  // check that both conversions agree,
+  uint cnt_s = convert_scalar (pkt, NUM_EVTS, buf_s, ts_s);
+  uint cnt_v = spiffer_caer_convert (pkt->events, NUM_EVTS, buf_v, ts_v);
+  if (cnt_s != cnt_v) {
+    fprintf (stderr, "error: event count mismatch %u / %u\n", cnt_s, cnt_v);
+    exit (-1);
+  }
+
+  for (uint i = 0; i < cnt_s; i++) {
+    if ((buf_s[i] != buf_v[i]) || (ts_s[i] != ts_v[i])) {
+      fprintf (stderr, "error: event %u mismatch 0x%08x / 0x%08x\n", i, buf_s[i], buf_v[i]);
+      exit (-1);
+    }
+  }
+
+  // time the accessor loop,
+  uint   chk = 0;
+  double start = now ();
+  for (int r = 0; r < NUM_RUNS; r++) {
+    chk += convert_scalar (pkt, NUM_EVTS, buf_s, ts_s);
+    asm volatile ("" : : "r" (buf_s), "r" (ts_s) : "memory");
+  }
+  double t_s = now () - start;
+
+  // and the bulk converter
+  start = now ();
+  for (int r = 0; r < NUM_RUNS; r++) {
+    chk += spiffer_caer_convert (pkt->events, NUM_EVTS, buf_v, ts_v);
+    asm volatile ("" : : "r" (buf_v), "r" (ts_v) : "memory");
+  }
+  double t_v = now () - start;
+
+  double evts = (double) NUM_EVTS * NUM_RUNS;
+  printf ("%u events (%u valid) x %u runs [check %u]\n", NUM_EVTS, cnt_s, NUM_RUNS, chk);
+  printf ("accessor loop:  %7.1f Mev/s\n", evts * 1000 / t_s);
+  printf ("bulk converter: %7.1f Mev/s (x%.2f)\n", evts * 1000 / t_v, t_s / t_v);
+
+  free (pkt);
+  return (0);
+}
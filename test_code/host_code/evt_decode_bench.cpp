@@ -0,0 +1,292 @@
+//************************************************//
+//*                                              *//
+//* benchmark Prophesee raw stream decoding      *//
+//*                                              *//
+//* - decodes a recorded .raw file (EVT 2.0 or   *//
+//*   EVT 3.0) with the native spiffer decoder   *//
+//* - without a file, checks the decoder with a  *//
+//*   synthetic EVT 3.0 stream                   *//
+//* - with Metavision SDK support, compares the  *//
+//*   native decoder with the SDK decode path    *//
+//*                                              *//
+//* build:                                       *//
+//*   g++ -O2 -I../include -I../../spiffer       *//
+//*       evt_decode_bench.cpp                   *//
+//*       ../../spiffer/spiffer_evt.cpp          *//
+//* add -DMETA_SUPPORT=1 and the SDK libraries   *//
+//* to compare with the SDK                      *//
+//*                                              *//
+//* usage: evt_decode_bench [<file.raw>]         *//
+//*                                              *//
+//* exits with -1 if problems found              *//
+//*                                              *//
+//************************************************//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "spiffer_evt.h"
+
+#ifdef META_SUPPORT
+#include "spiffer_meta_support.h"
+#endif
+
+
+#define NUM_EVTS          (1 << 20)
+#define NUM_RUNS          20
+
+#define NSEC_PER_SEC      1000000000
+
+
+//--------------------------------------------------------------------
+// get current time (in ns)
+//--------------------------------------------------------------------
+static double now (void) {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ((double) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// decode a whole raw stream - in spiffer-sized buffers
+//--------------------------------------------------------------------
+static size_t decode (evt_format_t format, const uint8_t * raw, size_t bytes,
+                      uint * evts, uint * ts) {
+  evt_dec_t dc;
+  spiffer_evt_init (&dc, format);
+
+  size_t cnt = 0;
+  while (bytes != 0) {
+    size_t used;
+    cnt += spiffer_evt_decode (&dc, raw, bytes, &used,
+                               &evts[cnt], &ts[cnt], SPIFFER_BATCH_SIZE);
+    if (used == 0) {
+      break;
+    }
+    raw   += used;
+    bytes -= used;
+  }
+
+  return (cnt);
+}
+//--------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------
+// build a synthetic EVT 3.0 stream - single events and vectors
+// returns the expected events and timestamps
+//--------------------------------------------------------------------
+static std::vector<uint16_t> synth_evt3 (std::vector<uint> & evts, std::vector<uint> & ts) {
+  std::vector<uint16_t> raw;
+  uint t = 0;
+
+  srand (1);
+  raw.push_back ((uint16_t) ((0x8 << 12) | 0));
+  raw.push_back ((uint16_t) ((0x6 << 12) | 0));
+
+  while (evts.size () < NUM_EVTS) {
+    // time moves on - and wraps around,
+    t += rand () % 200;
+    raw.push_back ((uint16_t) ((0x8 << 12) | ((t >> 12) & 0xfff)));
+    raw.push_back ((uint16_t) ((0x6 << 12) | (t & 0xfff)));
+
+    uint y = rand () % 720;
+    raw.push_back ((uint16_t) ((0x0 << 12) | y));
+
+    uint p = rand () & 1;
+    uint x = rand () % 1100;
+    if (rand () & 1) {
+      // a single event,
+      raw.push_back ((uint16_t) ((0x2 << 12) | (p << 11) | x));
+      evts.push_back (SPIFFER_EVT_NO_TS | (x << SPIFFER_EVT_X_SHIFT) | (p << SPIFFER_EVT_P_SHIFT) | (y << SPIFFER_EVT_Y_SHIFT));
+      ts.push_back (t);
+    } else {
+      // or a 12-bit and an 8-bit vector
+      uint m12 = rand () & 0xfff;
+      uint m8  = rand () & 0xff;
+      raw.push_back ((uint16_t) ((0x3 << 12) | (p << 11) | x));
+      raw.push_back ((uint16_t) ((0x4 << 12) | m12));
+      raw.push_back ((uint16_t) ((0x5 << 12) | m8));
+      for (uint b = 0; b < 20; b++) {
+        if ((b < 12) ? (m12 & (1 << b)) : (m8 & (1 << (b - 12)))) {
+          evts.push_back (SPIFFER_EVT_NO_TS | ((x + b) << SPIFFER_EVT_X_SHIFT) | (p << SPIFFER_EVT_P_SHIFT) | (y << SPIFFER_EVT_Y_SHIFT));
+          ts.push_back (t);
+        }
+      }
+    }
+  }
+
+  return (raw);
+}
+//--------------------------------------------------------------------
+
+
+#ifdef META_SUPPORT
+//--------------------------------------------------------------------
+// decode a raw file with the Metavision SDK
+// events are checked against the native decoder
+//--------------------------------------------------------------------
+static void sdk_decode (const char * file, const uint8_t * raw, size_t bytes,
+                        const uint * evts, size_t cnt) {
+  std::unique_ptr<Metavision::Device> dev = Metavision::DeviceDiscovery::open_raw_file (file);
+  if (!dev) {
+    fprintf (stderr, "error: SDK cannot open %s\n", file);
+    exit (-1);
+  }
+
+  Metavision::I_EventsStreamDecoder * dec = dev->get_facility<Metavision::I_EventsStreamDecoder>();
+  Metavision::I_EventDecoder<Metavision::EventCD> * cd_dec =
+    dev->get_facility<Metavision::I_EventDecoder<Metavision::EventCD>>();
+  if (!dec || !cd_dec) {
+    fprintf (stderr, "error: no SDK decoder for %s\n", file);
+    exit (-1);
+  }
+
+  // build spif events - as spiffer used to,
+  size_t sdk_cnt = 0;
+  bool   check   = true;
+  cd_dec->add_event_buffer_callback (
+    [&](const Metavision::EventCD * first, const Metavision::EventCD * last) {
+      for (auto it = first; it != last; ++it) {
+        uint e = SPIFFER_EVT_NO_TS | (it->x << SPIFFER_EVT_X_SHIFT) | (it->p << SPIFFER_EVT_P_SHIFT) | (it->y << SPIFFER_EVT_Y_SHIFT);
+        if (check && ((sdk_cnt >= cnt) || (evts[sdk_cnt] != e))) {
+          fprintf (stderr, "error: event %zu mismatch 0x%08x\n", sdk_cnt, e);
+          exit (-1);
+        }
+        sdk_cnt++;
+      }
+    }
+  );
+
+  // check the events,
+  dec->decode (raw, raw + bytes);
+  if (sdk_cnt != cnt) {
+    fprintf (stderr, "error: event count mismatch %zu / %zu\n", sdk_cnt, cnt);
+    exit (-1);
+  }
+
+  // and time the SDK decode path
+  check = false;
+  double start = now ();
+  for (int r = 0; r < NUM_RUNS; r++) {
+    dec->decode (raw, raw + bytes);
+  }
+  double t = now () - start;
+
+  printf ("SDK decoder:    %7.1f Mev/s\n", (double) cnt * NUM_RUNS * 1000 / t);
+}
+//--------------------------------------------------------------------
+#endif
+
+
+int main (int argc, char * argv[]) {
+  const uint8_t * raw;
+  size_t          bytes;
+  evt_format_t    format;
+
+  std::vector<uint>     exp_evts;
+  std::vector<uint>     exp_ts;
+  std::vector<uint16_t> synth;
+
+  if (argc > 1) {
+    // map the recorded file,
+    int fd = open (argv[1], O_RDONLY);
+    struct stat st;
+    if ((fd == -1) || (fstat (fd, &st) == -1)) {
+      fprintf (stderr, "error: cannot open %s\n", argv[1]);
+      exit (-1);
+    }
+
+    raw = (const uint8_t *) mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (raw == MAP_FAILED) {
+      fprintf (stderr, "error: cannot map %s\n", argv[1]);
+      exit (-1);
+    }
+    bytes = st.st_size;
+
+    // and find its format in the header - "% ..." lines
+    format = EVT_NONE;
+    while ((bytes != 0) && (*raw == '%')) {
+      const uint8_t * eol = (const uint8_t *) memchr (raw, '\n', bytes);
+      if (eol == NULL) {
+        break;
+      }
+
+      std::string line ((const char *) raw, eol - raw);
+      if ((format == EVT_NONE) && ((line.find ("format") != std::string::npos) ||
+                                   (line.find ("evt") != std::string::npos))) {
+        format = spiffer_evt_format (line.c_str ());
+      }
+
+      bytes -= eol + 1 - raw;
+      raw    = eol + 1;
+    }
+
+    if (format == EVT_NONE) {
+      fprintf (stderr, "error: %s format not supported\n", argv[1]);
+      exit (-1);
+    }
+  } else {
+    // or build a synthetic stream
+    synth  = synth_evt3 (exp_evts, exp_ts);
+    raw    = (const uint8_t *) synth.data ();
+    bytes  = synth.size () * sizeof (uint16_t);
+    format = EVT_3;
+  }
+
+  // every raw word produces at most SPIFFER_EVT_WORD_EVTS events
+  size_t max = (bytes / 2) * SPIFFER_EVT_WORD_EVTS + SPIFFER_BATCH_SIZE;
+  std::vector<uint> evts (max);
+  std::vector<uint> ts (max);
+
+  size_t cnt = decode (format, raw, bytes, evts.data (), ts.data ());
+
+  // check the synthetic events,
+  if (!exp_evts.empty ()) {
+    if (cnt != exp_evts.size ()) {
+      fprintf (stderr, "error: event count mismatch %zu / %zu\n", cnt, exp_evts.size ());
+      exit (-1);
+    }
+
+    for (size_t i = 0; i < cnt; i++) {
+      if ((evts[i] != exp_evts[i]) || (ts[i] != exp_ts[i])) {
+        fprintf (stderr, "error: event %zu mismatch 0x%08x / 0x%08x\n", i, evts[i], exp_evts[i]);
+        exit (-1);
+      }
+    }
+  }
+
+  // time the native decoder,
+  size_t chk = 0;
+  double start = now ();
+  for (int r = 0; r < NUM_RUNS; r++) {
+    chk += decode (format, raw, bytes, evts.data (), ts.data ());
+    asm volatile ("" : : "r" (evts.data ()), "r" (ts.data ()) : "memory");
+  }
+  double t = now () - start;
+
+  printf ("%s: %zu bytes %zu events x %u runs [check %zu]\n",
+          (format == EVT_2) ? "EVT 2.0" : "EVT 3.0", bytes, cnt, NUM_RUNS, chk);
+  printf ("native decoder: %7.1f Mev/s %7.1f MB/s\n",
+          (double) cnt * NUM_RUNS * 1000 / t, (double) bytes * NUM_RUNS * 1000 / t);
+
+#ifdef META_SUPPORT
+  // and compare with the SDK
+  if (argc > 1) {
+    sdk_decode (argv[1], raw, bytes, evts.data (), cnt);
+  }
+#endif
+
+  return (0);
+}
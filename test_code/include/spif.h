@@ -14,6 +14,7 @@
 // spif constants
 //--------------------------------------------------------------------
 #define SPIF_HW_PIPES_NUM     2     //
+#define SPIF_HW_PIPES_MAX     15    // pipes that can be reported in SPIF_VERSION
 #define SPIF_BUF_MAX_SIZE     4096  // KB reserved memory
 
 #define SPIF_ROUTER_NUM       16    // number of ROUTER registers
@@ -10,6 +10,7 @@
 #ifndef __SPIF_REMOTE_H__
 #define __SPIF_REMOTE_H__
 
+#include <stdio.h>
 #include <stdlib.h>
 
 #include <fcntl.h>
@@ -49,6 +50,7 @@
 #define SPIF_TRANSFER        SPIF_OP_REQ(3)
 #define SPIF_GET_OUTP        SPIF_OP_REQ(4)
 #define SPIF_BUF_SIZE        SPIF_OP_REQ(5)
+#define SPIF_SET_SRC         SPIF_OP_REQ(6)
 // ---------------------------------
 
 
@@ -62,13 +64,10 @@ struct pipe_data {
   uint   buf_size;  // pipe buffer size
 };
 
-static struct pipe_data pipe_data[SPIF_HW_PIPES_NUM];
-
-// convenient static data place holder - to interact with kernel module
-static int open_dummy[SPIF_HW_PIPES_NUM];
-static int read_dummy[SPIF_HW_PIPES_NUM];
-static int busy_dummy[SPIF_HW_PIPES_NUM];
-static int out_dummy[SPIF_HW_PIPES_NUM];
+//NOTE: only written when a pipe is opened - results of requests to the
+//      kernel module are kept on the caller's stack, so that threads
+//      serving different pipes do not write to shared cache lines
+static struct pipe_data pipe_data[SPIF_HW_PIPES_MAX];
 // ---------------------------------
 
 
@@ -85,8 +84,9 @@ static int out_dummy[SPIF_HW_PIPES_NUM];
 int spif_open (uint pipe)
 {
   // create device name from pipe
-  char fname[11];
-  (void) sprintf (fname, "/dev/spif%u", pipe);
+  //NOTE: pipe numbers have up to two digits
+  char fname[12];
+  (void) snprintf (fname, sizeof (fname), "/dev/spif%u", pipe);
 
   // open spif device
   int fd = open (fname, O_RDWR | O_SYNC);
@@ -95,11 +95,12 @@ int spif_open (uint pipe)
   }
 
   // get device buffer size (for a single pipe)
-  (void) ioctl (fd, SPIF_BUF_SIZE, (void *) &(open_dummy[pipe]));
+  int buf_size = 0;
+  (void) ioctl (fd, SPIF_BUF_SIZE, (void *) &buf_size);
 
   // map pipe memory (2x buffer size) to user space
   //NOTE: input buffer is located at beginning of pipe memory
-  void * iva = mmap (NULL, 2 * open_dummy[pipe],
+  void * iva = mmap (NULL, 2 * buf_size,
 		     PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
 
   if (iva == MAP_FAILED) {
@@ -109,13 +110,13 @@ int spif_open (uint pipe)
 
   // map output buffer to user space
   //NOTE: output buffer is located after input buffer
-  void * ova = (void *) ((char *) iva + open_dummy[pipe]);
+  void * ova = (void *) ((char *) iva + buf_size);
 
   // keep pipe state to service future requests
   pipe_data[pipe].fd       = fd;
   pipe_data[pipe].buf_iva  = iva;
   pipe_data[pipe].buf_ova  = ova;
-  pipe_data[pipe].buf_size = open_dummy[pipe];
+  pipe_data[pipe].buf_size = buf_size;
 
   return fd;
 }
@@ -138,6 +139,17 @@ void * spif_get_buffer (uint pipe, uint buf_size)
 }
 
 
+//--------------------------------------------------------------------
+// get the size of the spif input buffer associated with a pipe
+//
+// returns buffer size in bytes
+//--------------------------------------------------------------------
+uint spif_get_buffer_size (uint pipe)
+{
+  return (pipe_data[pipe].buf_size);
+}
+
+
 //--------------------------------------------------------------------
 // request a spif output buffer associated with a pipe
 //
@@ -178,9 +190,10 @@ int spif_read_reg (uint pipe, unsigned int reg)
 
   // send request to spif and convey result
   //NOTE: ioctl never fails with this request
-  (void) ioctl (pipe_data[pipe].fd, req, (void *) &(read_dummy[pipe]));
+  int val = 0;
+  (void) ioctl (pipe_data[pipe].fd, req, (void *) &val);
 
-  return read_dummy[pipe];
+  return val;
 }
 
 
@@ -208,9 +221,10 @@ int spif_busy (uint pipe)
 {
   // send request to spif and convey result
   //NOTE: ioctl never fails with this request
-  (void) ioctl (pipe_data[pipe].fd, SPIF_STATUS_RD, (void *) &(busy_dummy[pipe]));
+  int busy = 0;
+  (void) ioctl (pipe_data[pipe].fd, SPIF_STATUS_RD, (void *) &busy);
 
-  return busy_dummy[pipe];
+  return busy;
 }
 
 
@@ -256,6 +270,20 @@ int spif_transfer (uint pipe, int length)
 }
 
 
+//--------------------------------------------------------------------
+// select the input buffer offset (in bytes) used by the next transfer
+//
+// offset must be word-aligned and spif must be idle
+//
+// returns 0 if successful
+//--------------------------------------------------------------------
+int spif_set_source (uint pipe, int offset)
+{
+  // send request to spif and convey result
+  return (ioctl (pipe_data[pipe].fd, SPIF_SET_SRC, (void *) (long) offset));
+}
+
+
 //--------------------------------------------------------------------
 // wait for a transfer from SpiNNaker
 //
@@ -263,13 +291,13 @@ int spif_transfer (uint pipe, int length)
 //--------------------------------------------------------------------
 int spif_get_output (uint pipe, int length)
 {
-  // dummy is used to send requested length and receive actual length
-  out_dummy[pipe] = length;
+  // used to send requested length and receive actual length
+  int len = length;
 
   // send request to spif and convey result
-  ioctl (pipe_data[pipe].fd, SPIF_GET_OUTP, (void *) &(out_dummy[pipe]));
+  ioctl (pipe_data[pipe].fd, SPIF_GET_OUTP, (void *) &len);
 
-  return (out_dummy[pipe]);
+  return (len);
 }
 
 